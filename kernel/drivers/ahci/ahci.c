@@ -1,5 +1,5 @@
 #include <drivers/ahci/ahci.h>
-#include <drivers/hpet.h>
+#include <time.h>
 #include <drivers/block.h>
 #include <mm/pmm.h>
 #include <fs/fd.h>
@@ -0,0 +1,104 @@
+#include <drivers/clocksource.h>
+#include <drivers/hpet.h>
+#include <debug.h>
+#include <string.h>
+#include <cpu.h>
+
+struct clocksource *clocksource;
+
+static uint64_t tsc_read() {
+	uint32_t low, high;
+
+	// keep rdtsc from being hoisted above earlier loads
+	asm volatile ("lfence\n\trdtsc" : "=a"(low), "=d"(high) :: "memory");
+
+	return ((uint64_t)high << 32) | low;
+}
+
+static struct clocksource tsc_clocksource = {
+	.name = "tsc",
+	.read = tsc_read
+};
+
+static struct clocksource hpet_clocksource = {
+	.name = "hpet",
+	.read = hpet_read_counter
+};
+
+static bool tsc_invariant() {
+	struct cpuid_state cpuid_state = cpuid(0x80000007, 0);
+
+	return cpuid_state.rdx & (1 << 8);
+}
+
+static uint64_t tsc_calibrate() {
+	uint64_t best = ~0ull;
+
+	// the shortest round was disturbed the least, so it gives the tightest estimate
+	for(int i = 0; i < CLOCKSOURCE_CALIBRATION_ROUNDS; i++) {
+		uint64_t hpet_start = hpet_read_ns();
+		uint64_t tsc_start = tsc_read();
+
+		uint64_t hpet_end;
+		do {
+			asm ("pause");
+			hpet_end = hpet_read_ns();
+		} while(hpet_end - hpet_start < CLOCKSOURCE_CALIBRATION_NS);
+
+		uint64_t tsc_end = tsc_read();
+
+		uint64_t frequency = (tsc_end - tsc_start) * 1000000000ull / (hpet_end - hpet_start);
+		if(frequency < best) {
+			best = frequency;
+		}
+	}
+
+	return best;
+}
+
+static void clocksource_select(struct clocksource *source, uint64_t frequency) {
+	source->frequency = frequency;
+	source->mult = ((__uint128_t)1000000000ull << CLOCKSOURCE_SHIFT) / frequency;
+	// carry on from where the boot time hpet clock was, time must not go backwards
+	source->offset = hpet_read_ns();
+	source->base = source->read();
+
+	clocksource = source;
+
+	print("clocksource: using %s at %d Hz\n", source->name, frequency);
+}
+
+uint64_t clocksource_read_ns() {
+	struct clocksource *source = clocksource;
+
+	if(source == NULL) {
+		return hpet_read_ns();
+	}
+
+	uint64_t cycles = source->read() - source->base;
+
+	return source->offset + (((__uint128_t)cycles * source->mult) >> CLOCKSOURCE_SHIFT);
+}
+
+uint64_t clocksource_resolution_ns() {
+	if(clocksource == NULL) {
+		return 1;
+	}
+
+	return DIV_ROUNDUP(1000000000ull, clocksource->frequency);
+}
+
+void clocksource_init() {
+	if(tsc_invariant()) {
+		uint64_t frequency = tsc_calibrate();
+
+		if(frequency) {
+			clocksource_select(&tsc_clocksource, frequency);
+			return;
+		}
+	}
+
+	print("clocksource: no invariant tsc, falling back to the hpet\n");
+
+	clocksource_select(&hpet_clocksource, hpet_frequency());
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <types.h>
+
+#define CLOCKSOURCE_SHIFT 32
+#define CLOCKSOURCE_CALIBRATION_NS 10000000
+#define CLOCKSOURCE_CALIBRATION_ROUNDS 3
+
+struct clocksource {
+	const char *name;
+	uint64_t (*read)();
+
+	uint64_t frequency;
+	uint64_t mult; // ns = (cycles * mult) >> CLOCKSOURCE_SHIFT
+	uint64_t base;
+	uint64_t offset;
+};
+
+extern struct clocksource *clocksource;
+
+uint64_t clocksource_read_ns();
+uint64_t clocksource_resolution_ns();
+void clocksource_init();
@@ -4,6 +4,7 @@
 #include <limine.h>
 #include <vector.h>
 #include <string.h>
+#include <simd.h>
 #include <errno.h>
 #include <debug.h>
 #include <cpu.h>
@@ -96,7 +97,7 @@ static ssize_t fbdev_write(struct file_handle *file, const void *buf, size_t cnt
 		cnt = device->fix->smem_len - offset;
 	}
 
-	memcpy8((void*)device->fix->smem_start, buf, cnt);
+	memcpy_user_bulk((void*)device->fix->smem_start, buf, cnt);
 
 	return cnt;
 }
@@ -1,5 +1,5 @@
 #include <drivers/hda/hda.h>
-#include <drivers/hpet.h>
+#include <time.h>
 #include <mm/pmm.h>
 #include <int/idt.h>
 #include <debug.h>
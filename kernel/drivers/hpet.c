@@ -5,34 +5,23 @@
 static volatile struct hpet_table *hpet_table;
 static volatile struct hpet_regs *hpet_regs;
 
-void msleep(size_t ms) {
-	uint32_t period = hpet_regs->capabilities >> 32;
-
-	volatile size_t ticks = hpet_regs->counter_value + (ms * (1000000000000 / period));
-
-	while(hpet_regs->counter_value < ticks) {
-		asm ("pause");
-	}
+uint64_t hpet_read_counter() {
+	return hpet_regs->counter_value;
 }
 
-void usleep(size_t us) {
-	uint32_t period = hpet_regs->capabilities >> 32;
+uint64_t hpet_frequency() {
+	uint64_t period = hpet_regs->capabilities >> 32;
 
-	volatile size_t ticks = hpet_regs->counter_value + (us * (1000000000 / period));
-
-	while(hpet_regs->counter_value < ticks) {
-		asm ("pause");
-	}
+	// period is in femtoseconds
+	return 1000000000000000ull / period;
 }
 
-void nsleep(size_t us) {
-	uint32_t period = hpet_regs->capabilities >> 32;
-
-	volatile size_t ticks = hpet_regs->counter_value + (us * (1000000 / period));
+uint64_t hpet_read_ns() {
+	uint64_t period = hpet_regs->capabilities >> 32;
+	uint64_t counter = hpet_regs->counter_value;
 
-	while(hpet_regs->counter_value < ticks) {
-		asm ("pause");
-	}
+	// period is in femtoseconds, split the multiply so it does not overflow
+	return (counter / 1000000) * period + (counter % 1000000) * period / 1000000;
 }
 
 void hpet_init() {
@@ -29,6 +29,7 @@ struct hpet_regs {
 	uint64_t unused4;
 } __attribute__((packed));
 
-void msleep(size_t ms);
-void usleep(size_t us);
+uint64_t hpet_read_counter();
+uint64_t hpet_frequency();
+uint64_t hpet_read_ns();
 void hpet_init();
@@ -2,8 +2,11 @@
 #include <drivers/tty/tty.h>
 #include <int/apic.h>
 #include <int/idt.h>
+#include <sched/softirq.h>
 #include <debug.h>
 
+#define PS2_BUFFER_SIZE 256
+
 static void ps2_enable();
 static void ps2_disable();
 static void ps2_flush_buffer();
@@ -13,6 +16,14 @@ static bool shift_lock;
 static bool ctrl_active;
 static bool extended_map;
 
+// scancodes on their way from the interrupt to the tasklet, both run on the cpu the irq is
+// routed to. the interrupt only moves head and the tasklet only moves tail
+static uint8_t ps2_buffer[PS2_BUFFER_SIZE];
+static size_t ps2_buffer_head;
+static size_t ps2_buffer_tail;
+
+static struct tasklet ps2_tasklet;
+
 static char keymap_plain[] = {
 	'\0', '\0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '0',
 	'-', '=', '\b', '\t', 'q', 'w', 'e', 'r', 't', 'y', 'u', 'i',
@@ -65,8 +76,7 @@ static char *function_table[] = {
 	function_table_raw + 31,
 };
 
-static int ps2_get_character(char *character) {
-	uint8_t scancode = inb(KDB_PS2_DATA);
+static int ps2_get_character(uint8_t scancode, char *character) {
 	bool release = scancode & 0x80;
 
 	if(scancode == 0x2a || scancode == 0x36
@@ -154,27 +164,23 @@ noextend:
 	return -1;
 }
 
-void ps2_handler(struct registers*, void*) {
+// decoding and feeding the tty happens here, out of the interrupt
+static void ps2_tasklet_handler(struct tasklet*) {
+	size_t tail = ps2_buffer_tail;
+	size_t head = __atomic_load_n(&ps2_buffer_head, __ATOMIC_ACQUIRE);
+
 	if(!active_tty) {
-		ps2_flush_buffer();
+		__atomic_store_n(&ps2_buffer_tail, head, __ATOMIC_RELEASE);
 		return;
 	}
 
 	spinlock_irqsave(&active_tty->input_lock);
 
-	for(;;) {
-		uint8_t status = inb(KDB_PS2_STATUS);
-
-		if((status & (1 << 0)) == 0) {
-			break;
-		}
-
-		if(status & (1 << 5)) {
-			continue;
-		}
+	for(; tail != head; tail++) {
+		uint8_t scancode = ps2_buffer[tail % PS2_BUFFER_SIZE];
 
 		char character = '\0';
-		int function = ps2_get_character(&character);
+		int function = ps2_get_character(scancode, &character);
 		tty_handle_signal(active_tty, character);
 
 		if(character != '\0') {
@@ -193,9 +199,41 @@ void ps2_handler(struct registers*, void*) {
 		}
 	}
 
+	__atomic_store_n(&ps2_buffer_tail, tail, __ATOMIC_RELEASE);
+
 	spinrelease_irqsave(&active_tty->input_lock);
 }
 
+// only empties the controller so it can raise the line again
+void ps2_handler(struct registers*, void*) {
+	for(;;) {
+		uint8_t status = inb(KDB_PS2_STATUS);
+
+		if((status & (1 << 0)) == 0) {
+			break;
+		}
+
+		uint8_t scancode = inb(KDB_PS2_DATA);
+
+		// aux port, nobody listens to the mouse
+		if(status & (1 << 5)) {
+			continue;
+		}
+
+		size_t head = ps2_buffer_head;
+
+		// the tasklet is behind by a whole buffer, drop keys rather than overwrite them
+		if(head - __atomic_load_n(&ps2_buffer_tail, __ATOMIC_ACQUIRE) >= PS2_BUFFER_SIZE) {
+			continue;
+		}
+
+		ps2_buffer[head % PS2_BUFFER_SIZE] = scancode;
+		__atomic_store_n(&ps2_buffer_head, head + 1, __ATOMIC_RELEASE);
+	}
+
+	tasklet_schedule(&ps2_tasklet);
+}
+
 static bool ps2_validate() {
 	if(fadt) {
 		if(fadt->iapc_boot_arch & (1 << 1)) {
@@ -239,6 +277,8 @@ void ps2_init() {
 	ps2_disable();
 	ps2_flush_buffer();
 
+	tasklet_init(&ps2_tasklet, ps2_tasklet_handler);
+
 	int ps2_vector = idt_alloc_vector(ps2_handler, NULL);
 	ioapic_set_irq_redirection(xapic_read(XAPIC_ID_REG_OFF), ps2_vector, 1, false);
 
@@ -5,13 +5,17 @@
 #include <time.h>
 #include <debug.h>
 #include <limine.h>
+#include <drivers/hpet.h>
+#include <drivers/clocksource.h>
+#include <errno.h>
 
-#define PIT_FREQ 1000
+#define PIT_FREQ 1193182
+#define PIT_MAX_WAIT_MS 50
 
 struct timespec clock_realtime;
 struct timespec clock_monotonic;
 
-typeof(timer_list) timer_list;
+static int64_t boot_epoch;
 
 static volatile struct limine_boot_time_request limine_boot_time_request = {
 	.id = LIMINE_BOOT_TIME_REQUEST,
@@ -60,46 +64,129 @@ struct timespec timespec_convert_ms(int ms) {
 	return ret;
 }
 
-void pit_handler(struct registers*, void*) {
-	struct timespec interval = { .tv_sec = 0, .tv_nsec = TIMER_HZ / PIT_FREQ };
+struct timespec timespec_convert_ns(uint64_t ns) {
+	struct timespec ret = {
+		.tv_nsec = ns % TIMER_HZ,
+		.tv_sec = ns / TIMER_HZ
+	};
+
+	return ret;
+}
+
+uint64_t timespec_to_ns(struct timespec timespec) {
+	return timespec.tv_sec * TIMER_HZ + timespec.tv_nsec;
+}
+
+uint64_t clock_monotonic_ns() {
+	return clocksource_read_ns();
+}
+
+uint64_t clock_realtime_ns() {
+	return boot_epoch * TIMER_HZ + clock_monotonic_ns();
+}
+
+void clock_update() {
+	uint64_t now = clock_monotonic_ns();
+
+	clock_monotonic = timespec_convert_ns(now);
+	clock_realtime = timespec_convert_ns(boot_epoch * TIMER_HZ + now);
+}
+
+int clock_gettime(clockid_t clockid, struct timespec *timespec) {
+	switch(clockid) {
+		case CLOCK_REALTIME:
+		case CLOCK_REALTIME_COARSE:
+			*timespec = timespec_convert_ns(clock_realtime_ns());
+			break;
+		case CLOCK_MONOTONIC:
+		case CLOCK_MONOTONIC_RAW:
+		case CLOCK_MONOTONIC_COARSE:
+		case CLOCK_BOOTTIME:
+			*timespec = timespec_convert_ns(clock_monotonic_ns());
+			break;
+		default:
+			set_errno(EINVAL);
+			return -1;
+	}
 
-	clock_realtime = timespec_add(clock_realtime, interval);
-	clock_monotonic = timespec_add(clock_monotonic, interval);
+	return 0;
+}
+
+int clock_getres(clockid_t clockid, struct timespec *timespec) {
+	switch(clockid) {
+		case CLOCK_REALTIME:
+		case CLOCK_REALTIME_COARSE:
+		case CLOCK_MONOTONIC:
+		case CLOCK_MONOTONIC_RAW:
+		case CLOCK_MONOTONIC_COARSE:
+		case CLOCK_BOOTTIME:
+			break;
+		default:
+			set_errno(EINVAL);
+			return -1;
+	}
+
+	if(timespec) {
+		*timespec = timespec_convert_ns(clocksource_resolution_ns());
+	}
+
+	return 0;
+}
+
+void pit_wait(size_t ms) {
+	while(ms) {
+		size_t chunk = ms > PIT_MAX_WAIT_MS ? PIT_MAX_WAIT_MS : ms;
+		uint16_t count = PIT_FREQ * chunk / 1000;
 
-	for(size_t i = 0; i < timer_list.length; i++) {
-		struct timer *timer = timer_list.data[i];
+		// channel 2 is gated through port 0x61 and its output can be polled there, no irq needed
+		outb(0x61, (inb(0x61) & ~0x2) | 0x1);
 
-		timer->timespec = timespec_sub(timer->timespec, interval);
+		outb(0x43, (0b10 << 6) | (0b11 << 4)); // channel 2, lobyte/hibyte, interrupt on terminal count
+		outb(0x42, count & 0xff);
+		outb(0x42, count >> 8 & 0xff);
 
-		if(timer->timespec.tv_nsec == 0 && timer->timespec.tv_sec == 0) {
-			for(size_t j = 0; j < timer->triggers.length; j++) {
-				struct waitq_trigger *trigger = timer->triggers.data[j];
-				waitq_trigger_calibrate(trigger, CURRENT_TASK, EVENT_TIMER);
-				waitq_wake(trigger);
-			}
-			
-			VECTOR_REMOVE_BY_INDEX(timer_list, i);
+		uint8_t gate = inb(0x61);
+		outb(0x61, gate & ~0x1);
+		outb(0x61, gate | 0x1);
+
+		while((inb(0x61) & (1 << 5)) == 0) {
+			asm ("pause");
 		}
+
+		ms -= chunk;
 	}
 }
 
 void pit_init() {
-	int divisor = 1193182 / PIT_FREQ;
+	boot_epoch = limine_boot_time_request.response->boot_time;
 
-	if((1193182 % PIT_FREQ) > (PIT_FREQ / 2)) { // round up
-		divisor++;
-	}
+	clock_update();
+}
 
-	outb(0x43, (0b010 << 1) | (0b11 << 4)); // channel 0, lobyte/hibyte, rate generator
-	outb(0x40, divisor & 0xff);
-	outb(0x40, divisor >> 8 & 0xff);
+void syscall_clock_gettime(struct registers *regs) {
+	clockid_t clockid = regs->rdi;
+	struct timespec *timespec = (void*)regs->rsi;
 
-	int vector = idt_alloc_vector(pit_handler, NULL);
+#ifndef SYSCALL_DEBUG
+	print("syscall: [pid %x, tid %x] clock_gettime: clockid {%x}, timespec {%x}\n", this_cpu_read(pid), this_cpu_read(tid), clockid, timespec);
+#endif
+
+	if(timespec == NULL) {
+		set_errno(EFAULT);
+		regs->rax = -1;
+		return;
+	}
+
+	regs->rax = clock_gettime(clockid, timespec);
+}
 
-	ioapic_set_irq_redirection(xapic_read(XAPIC_ID_REG_OFF), vector, 0, false);
+void syscall_clock_getres(struct registers *regs) {
+	clockid_t clockid = regs->rdi;
+	struct timespec *timespec = (void*)regs->rsi;
 
-	int64_t epoch = limine_boot_time_request.response->boot_time;
+#ifndef SYSCALL_DEBUG
+	print("syscall: [pid %x, tid %x] clock_getres: clockid {%x}, timespec {%x}\n", this_cpu_read(pid), this_cpu_read(tid), clockid, timespec);
+#endif
 
-	clock_realtime = (struct timespec) { .tv_sec = epoch, .tv_nsec = 0 };
-	clock_monotonic = (struct timespec) { .tv_sec = epoch, .tv_nsec = 0 };
+	regs->rax = clock_getres(clockid, timespec);
 }
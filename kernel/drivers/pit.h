@@ -1,3 +1,6 @@
 #pragma once
 
+#include <types.h>
+
 void pit_init();
+void pit_wait(size_t ms);
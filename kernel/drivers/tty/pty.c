@@ -122,9 +122,12 @@ static int ptmx_open(struct vfs_node*, struct file_handle *file) {
 	tty_register(makedev(PTS_MAJOR, slave_no), pts_tty);
 	char *pts_name = alloc(MAX_PATH_LENGTH);
 	sprint(pts_name, "/dev/pts/%d", slave_no);
-	vfs_create_node_deep(NULL, NULL, NULL, pts_stat, pts_name);
 
 	spinrelease_irqsave(&pty_lock);
+
+	// the tree lock may sleep, the slave is registered already so the node can come last
+	vfs_create_node_deep(NULL, NULL, NULL, pts_stat, pts_name);
+
 	return 0;
 }
 
@@ -190,7 +193,7 @@ static int ptm_ioctl(struct file_handle *file, uint64_t req, void *arg) {
 	switch(req) {
 		case TIOCGPTN:
 #ifndef SYSCALL_DEBUG
-			print("syscall: [pid %x, tid %x] pty_ioctl: TIOCGPTN\n", CORE_LOCAL->pid, CORE_LOCAL->tid);
+			print("syscall: [pid %x, tid %x] pty_ioctl: TIOCGPTN\n", this_cpu_read(pid), this_cpu_read(tid));
 #endif
 			int *ptn = arg;
 			*ptn = pts->slave_no;
@@ -198,7 +201,7 @@ static int ptm_ioctl(struct file_handle *file, uint64_t req, void *arg) {
 
 		case TIOCGWINSZ: {
 #ifndef SYSCALL_DEBUG
-			print("syscall: [pid %x, tid %x] pty_ioctl: TIOCGWINSZ\n", CORE_LOCAL->pid, CORE_LOCAL->tid);
+			print("syscall: [pid %x, tid %x] pty_ioctl: TIOCGWINSZ\n", this_cpu_read(pid), this_cpu_read(tid));
 #endif
 			memcpy(arg, &pts->winsize, sizeof(struct winsize));
 			return 0;
@@ -206,7 +209,7 @@ static int ptm_ioctl(struct file_handle *file, uint64_t req, void *arg) {
 
 		case TIOCSWINSZ: {
 #ifndef SYSCALL_DEBUG
-			print("syscall: [pid %x, tid %x] pty_ioctl: TIOCGWINSZ\n", CORE_LOCAL->pid, CORE_LOCAL->tid);
+			print("syscall: [pid %x, tid %x] pty_ioctl: TIOCGWINSZ\n", this_cpu_read(pid), this_cpu_read(tid));
 #endif
 			memcpy(&pts->winsize, arg, sizeof(struct winsize));
 			// TODO: inject signal.
@@ -227,7 +230,7 @@ static int pts_ioctl(struct tty *tty, uint64_t req, void *arg) {
 	switch(req) {
 		case TIOCGWINSZ: {
 #ifndef SYSCALL_DEBUG
-			print("syscall: [pid %x, tid %x] pty_ioctl: TIOCGWINSZ\n", CORE_LOCAL->pid, CORE_LOCAL->tid);
+			print("syscall: [pid %x, tid %x] pty_ioctl: TIOCGWINSZ\n", this_cpu_read(pid), this_cpu_read(tid));
 #endif
 			memcpy(arg, &pts->winsize, sizeof(struct winsize));
 			return 0;
@@ -235,7 +238,7 @@ static int pts_ioctl(struct tty *tty, uint64_t req, void *arg) {
 
 		case TIOCSWINSZ: {
 #ifndef SYSCALL_DEBUG
-			print("syscall: [pid %x, tid %x] pty_ioctl: TIOCGWINSZ\n", CORE_LOCAL->pid, CORE_LOCAL->tid);
+			print("syscall: [pid %x, tid %x] pty_ioctl: TIOCGWINSZ\n", this_cpu_read(pid), this_cpu_read(tid));
 #endif
 			memcpy(&pts->winsize, arg, sizeof(struct winsize));
 			// TODO: inject signal.
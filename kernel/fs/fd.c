@@ -139,6 +139,8 @@ int stat_has_access(struct stat *stat, uid_t uid, gid_t gid, int mode) {
 }
 
 int stat_update_time(struct stat *stat, int flags) {
+	clock_update();
+
 	if(flags & STAT_ACCESS) stat->st_atim = clock_realtime;
 	if(flags & STAT_MOD) stat->st_mtim = clock_realtime;
 	if(flags & STAT_STATUS) stat->st_ctim = clock_realtime;
@@ -146,9 +148,61 @@ int stat_update_time(struct stat *stat, int flags) {
 	return 0;
 }
 
+#define FD_ARRAY_MIN 16
+
+// callers either hold fd_lock or sit in an rcu read side section
+struct fd_handle *fd_table_lookup(struct fd_table *table, int fd) {
+	struct fd_array *array = rcu_dereference(table->fd_array);
+
+	if(array == NULL || fd < 0 || (size_t)fd >= array->capacity) {
+		return NULL;
+	}
+
+	return rcu_dereference(array->handles[fd]);
+}
+
+static void fd_array_free(struct rcu_head *head) {
+	free(head);
+}
+
+// the rest of the fd table functions expect fd_lock to be held
+void fd_table_install(struct fd_table *table, struct fd_handle *handle) {
+	struct fd_array *array = table->fd_array;
+	size_t fd = handle->fd_number;
+
+	if(array == NULL || fd >= array->capacity) {
+		size_t capacity = array ? array->capacity : FD_ARRAY_MIN;
+		while(capacity <= fd) capacity *= 2;
+
+		struct fd_array *expanded = alloc(sizeof(struct fd_array) + capacity * sizeof(struct fd_handle*));
+		expanded->capacity = capacity;
+
+		if(array) {
+			memcpy64((uint64_t*)expanded->handles, (uint64_t*)array->handles, array->capacity);
+		}
+
+		rcu_assign_pointer(table->fd_array, expanded);
+
+		if(array) {
+			call_rcu(&array->rcu, fd_array_free);
+		}
+
+		array = expanded;
+	}
+
+	rcu_assign_pointer(array->handles[fd], handle);
+}
+
+void fd_table_remove(struct fd_table *table, int fd) {
+	struct fd_array *array = table->fd_array;
+
+	if(array && fd >= 0 && (size_t)fd < array->capacity) {
+		rcu_assign_pointer(array->handles[fd], NULL);
+	}
+}
+
 static struct fd_handle *fd_translate_unlocked(int index) {
-	struct task *current_task = CURRENT_TASK;
-	return hash_table_search(&current_task->fd_table->fd_list, &index, sizeof(index));
+	return fd_table_lookup(CURRENT_TASK->fd_table, index);
 }
 
 struct fd_handle *fd_translate(int index) {
@@ -157,9 +211,9 @@ struct fd_handle *fd_translate(int index) {
 		return NULL;
 	}
 
-	spinlock_irqsave(&current_task->fd_table->fd_lock);
-	struct fd_handle *handle = fd_translate_unlocked(index);
-	spinrelease_irqsave(&current_task->fd_table->fd_lock);
+	rcu_read_lock();
+	struct fd_handle *handle = fd_table_lookup(current_task->fd_table, index);
+	rcu_read_unlock();
 
 	return handle;
 }
@@ -235,8 +289,9 @@ ssize_t fd_write(int fd, const void *buf, size_t count) {
 	if(ret != -1) {
 		stat_update_time(stat, STAT_MOD | STAT_STATUS);
 
+		// writers on pipes and sockets usually block for the reply next, let the reader have the cpu
 		waitq_trigger_calibrate(fd_handle->file_handle->trigger, CURRENT_TASK, EVENT_POLLIN);
-		waitq_wake(fd_handle->file_handle->trigger);
+		waitq_wake_sync(fd_handle->file_handle->trigger);
 
 		fd_handle->file_handle->position += ret;
 	}
@@ -480,12 +535,18 @@ int fd_openat(int dirfd, const char *path, int flags, mode_t mode) {
 		return -1;
 	}
 
-	hash_table_push(&current_task->fd_table->fd_list, &new_fd_handle->fd_number, new_fd_handle, sizeof(new_fd_handle->fd_number));
+	spinlock_irqsave(&current_task->fd_table->fd_lock);
+	fd_table_install(current_task->fd_table, new_fd_handle);
+	spinrelease_irqsave(&current_task->fd_table->fd_lock);
 
 	return new_fd_handle->fd_number;
 }
 
 
+static void fd_handle_free(struct rcu_head *head) {
+	free((void*)head - offsetof(struct fd_handle, rcu));
+}
+
 static void fd_close_unlocked(struct fd_handle *handle) {
 	struct task *current_task = CURRENT_TASK;
 
@@ -493,9 +554,9 @@ static void fd_close_unlocked(struct fd_handle *handle) {
 		handle->file_handle->ops->close(handle->file_handle->vfs_node, handle->file_handle);
 
 	file_put(handle->file_handle);
-	hash_table_delete(&current_task->fd_table->fd_list, &handle->fd_number, sizeof(handle->fd_number));
+	fd_table_remove(current_task->fd_table, handle->fd_number);
 	bitmap_free(&current_task->fd_table->fd_bitmap, handle->fd_number);
-	free(handle);
+	call_rcu(&handle->rcu, fd_handle_free);
 }
 
 
@@ -610,7 +671,7 @@ int fd_dup(int fd, bool clear_cloexec) {
 		handle->flags |= FD_CLOEXEC;
 
 	file_get(handle->file_handle);
-	hash_table_push(&current_task->fd_table->fd_list, &handle->fd_number, handle, sizeof(handle->fd_number));
+	fd_table_install(current_task->fd_table, handle);
 	spinrelease_irqsave(&current_task->fd_table->fd_lock);
 
 	return handle->fd_number;
@@ -644,7 +705,7 @@ int fd_dup2(int oldfd, int newfd) {
 
 	BIT_SET(current_task->fd_table->fd_bitmap.data, newfd);
 
-	hash_table_push(&current_task->fd_table->fd_list, &new_handle->fd_number, new_handle, sizeof(new_handle->fd_number));
+	fd_table_install(current_task->fd_table, new_handle);
 
 	spinrelease_irqsave(&current_task->fd_table->fd_lock);
 
@@ -738,8 +799,9 @@ int fd_fchownat(int fd, const char *path, uid_t uid, gid_t gid, int flag) {
 int fd_poll(struct pollfd *fds, nfds_t nfds, struct timespec *timespec) {
 	struct waitq waitq = { 0 };
 
+	struct timer *timer = NULL;
 	if(timespec) {
-		waitq_set_timer(&waitq, *timespec);
+		timer = waitq_set_timer(&waitq, *timespec);
 	}
 
 	VECTOR(struct file_handle*) handle_list = { 0 };
@@ -749,6 +811,7 @@ int fd_poll(struct pollfd *fds, nfds_t nfds, struct timespec *timespec) {
 
 		struct fd_handle *fd_handle = fd_translate(pollfd->fd);
 		if(fd_handle == NULL) {
+			waitq_cancel_timer(&waitq, timer);
 			set_errno(EBADF);
 			return -1;
 		}
@@ -769,6 +832,10 @@ int fd_poll(struct pollfd *fds, nfds_t nfds, struct timespec *timespec) {
 	}
 
 	int ret = waitq_wait(&waitq, EVENT_ANY);
+
+	// the waitq lives on this stack, the timer must be gone before we return
+	waitq_cancel_timer(&waitq, timer);
+
 	if(ret == -1) {
 		return -1;
 	}
@@ -796,7 +863,7 @@ void syscall_dup2(struct registers *regs) {
 	int newfd = regs->rsi;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] dup2: oldfd {%x}, newfd {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, oldfd, newfd);
+	print("syscall: [pid %x, tid %x] dup2: oldfd {%x}, newfd {%x}\n", this_cpu_read(pid), this_cpu_read(tid), oldfd, newfd);
 #endif
 
 	regs->rax = fd_dup2(oldfd, newfd);
@@ -806,7 +873,7 @@ void syscall_dup(struct registers *regs) {
 	int fd = regs->rdi;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] dup: fd {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, fd);
+	print("syscall: [pid %x, tid %x] dup: fd {%x}\n", this_cpu_read(pid), this_cpu_read(tid), fd);
 #endif
 
 	regs->rax = fd_dup(fd, true);
@@ -817,7 +884,7 @@ void syscall_stat(struct registers *regs) {
 	void *buf = (void*)regs->rsi;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] stat: fd {%x}, buf {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, fd, (uintptr_t)buf);
+	print("syscall: [pid %x, tid %x] stat: fd {%x}, buf {%x}\n", this_cpu_read(pid), this_cpu_read(tid), fd, (uintptr_t)buf);
 #endif
 
 	regs->rax = fd_stat(fd, buf);
@@ -830,7 +897,7 @@ void syscall_statat(struct registers *regs) {
 	int flags = regs->r10;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] statat: dirfd {%x}, path {%s}, buf {%x}, flags {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, dirfd, path, (uintptr_t)buf, flags);
+	print("syscall: [pid %x, tid %x] statat: dirfd {%x}, path {%s}, buf {%x}, flags {%x}\n", this_cpu_read(pid), this_cpu_read(tid), dirfd, path, (uintptr_t)buf, flags);
 #endif
 
 	regs->rax = fd_statat(dirfd, path, buf, flags);
@@ -842,7 +909,7 @@ void syscall_write(struct registers *regs) {
 	size_t cnt = regs->rdx;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] write: fd {%x}, buf {%x}, cnt {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, fd, (uintptr_t)buf, cnt);
+	print("syscall: [pid %x, tid %x] write: fd {%x}, buf {%x}, cnt {%x}\n", this_cpu_read(pid), this_cpu_read(tid), fd, (uintptr_t)buf, cnt);
 #endif
 
 	regs->rax = fd_write(fd, buf, cnt);
@@ -854,7 +921,7 @@ void syscall_read(struct registers *regs) {
 	size_t cnt = regs->rdx;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] read: fd {%x}, buf {%x}, cnt {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, fd, (uintptr_t)buf, cnt);
+	print("syscall: [pid %x, tid %x] read: fd {%x}, buf {%x}, cnt {%x}\n", this_cpu_read(pid), this_cpu_read(tid), fd, (uintptr_t)buf, cnt);
 #endif
 
 	regs->rax = fd_read(fd, buf, cnt);
@@ -866,7 +933,7 @@ void syscall_seek(struct registers *regs) {
 	int whence = regs->rdx;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] seek: fd {%x}, offset {%x}, whence {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, fd, offset, whence);
+	print("syscall: [pid %x, tid %x] seek: fd {%x}, offset {%x}, whence {%x}\n", this_cpu_read(pid), this_cpu_read(tid), fd, offset, whence);
 #endif
 
 	regs->rax = fd_seek(fd, offset, whence);
@@ -879,7 +946,7 @@ void syscall_openat(struct registers *regs) {
 	mode_t mode = regs->r10;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] open: dirfd {%x}, pathname {%s}, flags {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, dirfd, pathname, flags);
+	print("syscall: [pid %x, tid %x] open: dirfd {%x}, pathname {%s}, flags {%x}\n", this_cpu_read(pid), this_cpu_read(tid), dirfd, pathname, flags);
 #endif
 
 	regs->rax = fd_openat(dirfd, pathname, flags, mode);
@@ -889,7 +956,7 @@ void syscall_close(struct registers *regs) {
 	int fd = regs->rdi;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] close: fd {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, fd);
+	print("syscall: [pid %x, tid %x] close: fd {%x}\n", this_cpu_read(pid), this_cpu_read(tid), fd);
 #endif
 
 	regs->rax = fd_close(fd);
@@ -897,7 +964,7 @@ void syscall_close(struct registers *regs) {
 
 void syscall_fcntl(struct registers *regs) {
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] fcntl: fd {%x}, cmd {%x}, data {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, regs->rdi, regs->rsi, regs->rdx);
+	print("syscall: [pid %x, tid %x] fcntl: fd {%x}, cmd {%x}, data {%x}\n", this_cpu_read(pid), this_cpu_read(tid), regs->rdi, regs->rsi, regs->rdx);
 #endif
 
 	struct fd_handle *fd_handle = fd_translate(regs->rdi);
@@ -955,7 +1022,7 @@ void syscall_readdir(struct registers *regs) {
 	struct dirent *buf = (void*)regs->rsi;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] readdir: fd {%x}, buf {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, fd, (uintptr_t)buf);
+	print("syscall: [pid %x, tid %x] readdir: fd {%x}, buf {%x}\n", this_cpu_read(pid), this_cpu_read(tid), fd, (uintptr_t)buf);
 #endif
 
 	struct fd_handle *dir_handle = fd_translate(fd);
@@ -974,19 +1041,25 @@ void syscall_readdir(struct registers *regs) {
 		return;
 	}
 
-	if((dir->children.length >= dir_handle->file_handle->current_dirent) && dir->children.length != dir_handle->file_handle->dirent_list.length) {
+	rcu_read_lock();
+
+	size_t length = __atomic_load_n(&dir->children.length, __ATOMIC_ACQUIRE);
+	struct vfs_node **children = rcu_dereference(dir->children.data);
+
+	if((length >= dir_handle->file_handle->current_dirent) && length != dir_handle->file_handle->dirent_list.length) {
 		VECTOR_CLEAR(dir_handle->file_handle->dirent_list);
 		dir_handle->file_handle->current_dirent = 0;
 	}
 
 	if(!dir_handle->file_handle->dirent_list.length) {
-		for(size_t i = 0; i < dir->children.length; i++) {
-			struct vfs_node *node = dir->children.data[i];
+		for(size_t i = 0; i < length; i++) {
+			struct vfs_node *node = children[i];
 
 			struct dirent *entry = alloc(sizeof(struct dirent));
 
 			int ret = fd_generate_dirent(dir_handle, node, entry);
 			if(ret == -1) {
+				rcu_read_unlock();
 				regs->rax = -1;
 				return;
 			}
@@ -995,6 +1068,8 @@ void syscall_readdir(struct registers *regs) {
 		}
 	}
 
+	rcu_read_unlock();
+
 	if(dir_handle->file_handle->current_dirent >= dir_handle->file_handle->dirent_list.length) {
 		set_errno(0);
 		regs->rax = -1;
@@ -1012,7 +1087,7 @@ void syscall_getcwd(struct registers *regs) {
 	size_t size = regs->rsi;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] getcwd: buf {%x}, size {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, buf, size);
+	print("syscall: [pid %x, tid %x] getcwd: buf {%x}, size {%x}\n", this_cpu_read(pid), this_cpu_read(tid), buf, size);
 #endif
 
 	const char *path = vfs_absolute_path(*CURRENT_TASK->cwd);
@@ -1031,7 +1106,7 @@ void syscall_chdir(struct registers *regs) {
 	const char *path = (const char*)regs->rdi;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] chdir: path {%s}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, path);
+	print("syscall: [pid %x, tid %x] chdir: path {%s}\n", this_cpu_read(pid), this_cpu_read(tid), path);
 #endif
 
 	struct vfs_node *node;
@@ -1049,7 +1124,7 @@ void syscall_pipe(struct registers *regs) {
 	int *fd_pair = (int*)regs->rdi;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] pipe: fd pair {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, fd_pair);
+	print("syscall: [pid %x, tid %x] pipe: fd pair {%x}\n", this_cpu_read(pid), this_cpu_read(tid), fd_pair);
 #endif
 
 	fd_pair[0] = bitmap_alloc(&CURRENT_TASK->fd_table->fd_bitmap);
@@ -1101,8 +1176,8 @@ void syscall_pipe(struct registers *regs) {
 	stat_update_time(pipe_stat, STAT_ACCESS | STAT_MOD | STAT_STATUS);
 
 	spinlock_irqsave(&CURRENT_TASK->fd_table->fd_lock);
-	hash_table_push(&CURRENT_TASK->fd_table->fd_list, &read_fd_handle->fd_number, read_fd_handle, sizeof(read_fd_handle->fd_number));
-	hash_table_push(&CURRENT_TASK->fd_table->fd_list, &write_fd_handle->fd_number, write_fd_handle, sizeof(write_fd_handle->fd_number));
+	fd_table_install(CURRENT_TASK->fd_table, read_fd_handle);
+	fd_table_install(CURRENT_TASK->fd_table, write_fd_handle);
 	spinrelease_irqsave(&CURRENT_TASK->fd_table->fd_lock);
 
 	regs->rax = 0;
@@ -1115,7 +1190,7 @@ void syscall_faccessat(struct registers *regs) {
 	int flags = regs->r10;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] faccessat: dirfd {%x}, path {%s}, mode {%x}, flags {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, dirfd, path, mode, flags);
+	print("syscall: [pid %x, tid %x] faccessat: dirfd {%x}, path {%s}, mode {%x}, flags {%x}\n", this_cpu_read(pid), this_cpu_read(tid), dirfd, path, mode, flags);
 #endif
 
 	if (!(mode & F_OK) && !(mode & (R_OK | W_OK | X_OK))) {
@@ -1144,7 +1219,7 @@ void syscall_symlinkat(struct registers *regs) {
 	const char *linkpath = (const char*)regs->rdx;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] symlink: target {%s}, newdirfd {%x}, linkpath {%s}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, target, newdirfd, linkpath);
+	print("syscall: [pid %x, tid %x] symlink: target {%s}, newdirfd {%x}, linkpath {%s}\n", this_cpu_read(pid), this_cpu_read(tid), target, newdirfd, linkpath);
 #endif
 
 	struct vfs_node *link_node;
@@ -1189,7 +1264,7 @@ void syscall_ioctl(struct registers *regs) {
 	void *args = (void*)regs->rdx;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] ioctl: fd {%x}, req {%x}, args {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, fd, req, args);
+	print("syscall: [pid %x, tid %x] ioctl: fd {%x}, req {%x}, args {%x}\n", this_cpu_read(pid), this_cpu_read(tid), fd, req, args);
 #endif
 
 	struct fd_handle *fd_handle = fd_translate(fd);
@@ -1212,7 +1287,7 @@ void syscall_umask(struct registers *regs) {
 	mode_t mask = regs->rdi & 0777;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] umask: mask {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, mask);
+	print("syscall: [pid %x, tid %x] umask: mask {%x}\n", this_cpu_read(pid), this_cpu_read(tid), mask);
 #endif
 
 	regs->rax = *CURRENT_TASK->umask;
@@ -1238,7 +1313,7 @@ void syscall_fchmod(struct registers *regs) {
 	mode_t mode = regs->rsi;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] fchmod: fd {%x}, mode {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, fd, mode);
+	print("syscall: [pid %x, tid %x] fchmod: fd {%x}, mode {%x}\n", this_cpu_read(pid), this_cpu_read(tid), fd, mode);
 #endif
 
 	struct fd_handle *handle = fd_translate(fd);
@@ -1258,7 +1333,7 @@ void syscall_fchmodat(struct registers *regs) {
 	int flags = regs->r10;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] fchmodat: fd {%x}, path {%s}, mode {%x}, flags {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, fd, path, mode, flags);
+	print("syscall: [pid %x, tid %x] fchmodat: fd {%x}, path {%s}, mode {%x}, flags {%x}\n", this_cpu_read(pid), this_cpu_read(tid), fd, path, mode, flags);
 #endif
 
 	struct vfs_node *file;
@@ -1280,7 +1355,7 @@ void syscall_fchownat(struct registers *regs) {
 	int flag = regs->r8;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] fchownat: fd {%x}, path {%s}, uid {%x}, gid {%x}, flag {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, fd, path, uid, gid, flag);
+	print("syscall: [pid %x, tid %x] fchownat: fd {%x}, path {%s}, uid {%x}, gid {%x}, flag {%x}\n", this_cpu_read(pid), this_cpu_read(tid), fd, path, uid, gid, flag);
 #endif
 
 	regs->rax = fd_fchownat(fd, path, uid, gid, flag);
@@ -1292,7 +1367,7 @@ void syscall_poll(struct registers *regs) {
 	int timeout = regs->rdx;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] poll: fds {%x}, nfds {%x}, timeout {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, fds, nfds, timeout);
+	print("syscall: [pid %x, tid %x] poll: fds {%x}, nfds {%x}, timeout {%x}\n", this_cpu_read(pid), this_cpu_read(tid), fds, nfds, timeout);
 #endif
 
 	if(timeout == 0) {
@@ -1312,7 +1387,7 @@ void syscall_ppoll(struct registers *regs) {
 	sigset_t *sigmask = (void*)regs->r10;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] ppoll: fds {%x}, nfds {%x}, timespec {%x}, sigmask {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, fds, nfds, timespec, sigmask);
+	print("syscall: [pid %x, tid %x] ppoll: fds {%x}, nfds {%x}, timespec {%x}, sigmask {%x}\n", this_cpu_read(pid), this_cpu_read(tid), fds, nfds, timespec, sigmask);
 #endif
 
 	sigset_t original_mask;
@@ -6,6 +6,7 @@
 #include <lib/cpu.h>
 #include <sched/sched.h>
 #include <sched/queue.h>
+#include <sched/rcu.h>
 #include <bitmap.h>
 #include <lock.h>
 
@@ -19,7 +20,7 @@ struct fd_handle;
 struct pipe;
 
 struct file_handle {
-	struct spinlock lock;
+	struct mutex lock;
 	int refcnt;
 
 	struct vfs_node *vfs_node;
@@ -49,11 +50,20 @@ struct fd_handle {
 	struct file_handle *file_handle;
 	int fd_number;
 	int flags;
+
+	struct rcu_head rcu;
+};
+
+// indexed by descriptor, replaced as a whole when it grows so lookups can go without fd_lock
+struct fd_array {
+	struct rcu_head rcu;
+	size_t capacity;
+	struct fd_handle *handles[];
 };
 
 struct fd_table {
 	struct spinlock fd_lock;
-	struct hash_table fd_list;
+	struct fd_array *fd_array;
 	struct bitmap fd_bitmap;
 	int refcnt;
 };
@@ -99,11 +109,11 @@ static inline void file_init(struct file_handle *handle) {
 }
 
 static inline void file_lock(struct file_handle *handle) {
-	spinlock_irqsave(&handle->lock);
+	mutex_lock(&handle->lock);
 }
 
 static inline void file_unlock(struct file_handle *handle) {
-	spinrelease_irqsave(&handle->lock);
+	mutex_unlock(&handle->lock);
 }
 
 // Use functions below when cloning a file descriptor.
@@ -119,6 +129,9 @@ static inline void file_put(struct file_handle *handle) {
 int stat_has_access(struct stat *stat, uid_t uid, gid_t gid, int mode);
 int stat_update_time(struct stat *stat, int flags);
 struct fd_handle *fd_translate(int index);
+struct fd_handle *fd_table_lookup(struct fd_table *table, int fd);
+void fd_table_install(struct fd_table *table, struct fd_handle *handle);
+void fd_table_remove(struct fd_table *table, int fd);
 ssize_t fd_write(int fd, const void *buf, size_t count);
 ssize_t fd_read(int fd, void *buf, size_t count);
 off_t fd_seek(int fd, off_t offset, int whence);
@@ -127,7 +127,7 @@ static struct fd_handle *create_sockfd(struct socket *socket, struct file_handle
 	stat_update_time(socket_file_handle->stat, STAT_ACCESS | STAT_MOD | STAT_STATUS);
 
 	spinlock_irqsave(&CURRENT_TASK->fd_table->fd_lock);
-	hash_table_push(&CURRENT_TASK->fd_table->fd_list, &socket_fd_handle->fd_number, socket_fd_handle, sizeof(socket_fd_handle->fd_number));
+	fd_table_install(CURRENT_TASK->fd_table, socket_fd_handle);
 	spinrelease_irqsave(&CURRENT_TASK->fd_table->fd_lock);
 
 	return socket_fd_handle;
@@ -139,7 +139,7 @@ void syscall_socket(struct registers *regs) {
 	int protocol = regs->rdx;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] socket: family {%x}, type {%x}, protocol {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, family, type, protocol);
+	print("syscall: [pid %x, tid %x] socket: family {%x}, type {%x}, protocol {%x}\n", this_cpu_read(pid), this_cpu_read(tid), family, type, protocol);
 #endif
 
 	struct socket *socket = socket_create(family, type, protocol);
@@ -170,7 +170,7 @@ void syscall_getsockname(struct registers *regs) {
 	socklen_t *addrlen = (void*)regs->rdx;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] getsockname: sockfd {%x}, addr {%x}, addrlen {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, sockfd, addr, addrlen);
+	print("syscall: [pid %x, tid %x] getsockname: sockfd {%x}, addr {%x}, addrlen {%x}\n", this_cpu_read(pid), this_cpu_read(tid), sockfd, addr, addrlen);
 #endif
 
 	struct fd_handle *fd_handle = search_socket(sockfd);
@@ -189,7 +189,7 @@ void syscall_getpeername(struct registers *regs) {
 	socklen_t *addrlen = (void*)regs->rdx;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] getpeername: sockfd {%x}, addr {%x}, addrlen {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, sockfd, addr, addrlen);
+	print("syscall: [pid %x, tid %x] getpeername: sockfd {%x}, addr {%x}, addrlen {%x}\n", this_cpu_read(pid), this_cpu_read(tid), sockfd, addr, addrlen);
 #endif
 
 	struct fd_handle *fd_handle = search_socket(sockfd);
@@ -207,7 +207,7 @@ void syscall_listen(struct registers *regs) {
 	int backlog = regs->rsi;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] backlog: sockfd {%x}, backlog {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, sockfd, backlog);
+	print("syscall: [pid %x, tid %x] backlog: sockfd {%x}, backlog {%x}\n", this_cpu_read(pid), this_cpu_read(tid), sockfd, backlog);
 #endif
 
 	struct fd_handle *fd_handle = search_socket(sockfd);
@@ -226,7 +226,7 @@ void syscall_accept(struct registers *regs) {
 	socklen_t *addrlen = (void*)regs->rdx;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] accept: sockfd {%x}, addr {%x}, addrlen {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, sockfd, addr, addrlen);
+	print("syscall: [pid %x, tid %x] accept: sockfd {%x}, addr {%x}, addrlen {%x}\n", this_cpu_read(pid), this_cpu_read(tid), sockfd, addr, addrlen);
 #endif
 
 	struct fd_handle *fd_handle = search_socket(sockfd);
@@ -245,7 +245,7 @@ void syscall_bind(struct registers *regs) {
 	socklen_t addrlen = regs->rdx;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] bind: sockfd {%x}, addr {%x}, addrlen {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, sockfd, addr, addrlen);
+	print("syscall: [pid %x, tid %x] bind: sockfd {%x}, addr {%x}, addrlen {%x}\n", this_cpu_read(pid), this_cpu_read(tid), sockfd, addr, addrlen);
 #endif
 
 	struct fd_handle *fd_handle = search_socket(sockfd);
@@ -339,7 +339,7 @@ void syscall_connect(struct registers *regs) {
 	socklen_t addrlen = regs->rdx;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] connect: sockfd {%x}, addr {%x}, addrlen {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, sockfd, addr, addrlen);
+	print("syscall: [pid %x, tid %x] connect: sockfd {%x}, addr {%x}, addrlen {%x}\n", this_cpu_read(pid), this_cpu_read(tid), sockfd, addr, addrlen);
 #endif
 
 	struct fd_handle *fd_handle = search_socket(sockfd);
@@ -484,7 +484,7 @@ static int unix_connect(struct socket *socket, const struct socketaddr *addr, so
 	socket->peer = target_socket;
 
 	if((socket->fd_handle->flags & O_NONBLOCK) != O_NONBLOCK) {
-		waitq_wake(target_socket->trigger);
+		waitq_wake_sync(target_socket->trigger);
 
 		socket->trigger = waitq_alloc(&socket->waitq, EVENT_SOCKET);
 		waitq_add(&socket->waitq, socket->trigger);
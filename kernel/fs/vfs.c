@@ -5,10 +5,43 @@
 #include <time.h>
 #include <fs/ramfs.h>
 #include <sched/sched.h>
+#include <sched/rcu.h>
 
 struct vfs_node *vfs_root;
+struct mutex vfs_tree_lock;
 
-struct vfs_node *vfs_create_node(struct vfs_node *parent, struct file_ops *fops, struct filesystem *filesystem, struct stat *stat, const char *name, int dangle) {
+static struct vfs_node *vfs_lookup_absolute(struct vfs_node *parent, const char *path, bool symfollow);
+
+// lookups walk the children lists under rcu, so a full list is replaced rather than grown in
+// place and the old array is only freed once no reader can still be on it
+static void vfs_add_child(struct vfs_node *parent, struct vfs_node *node) {
+	size_t length = parent->children.length;
+
+	if(length == parent->children.buffer_capacity) {
+		size_t capacity = length ? length * 2 : 4;
+
+		struct vfs_node **data = alloc(capacity * sizeof(struct vfs_node*));
+		struct vfs_node **old = parent->children.data;
+
+		if(old) {
+			memcpy64((uint64_t*)data, (uint64_t*)old, length);
+		}
+
+		rcu_assign_pointer(parent->children.data, data);
+		parent->children.buffer_capacity = capacity;
+
+		if(old) {
+			rcu_free(old);
+		}
+	}
+
+	parent->children.data[length] = node;
+	__atomic_store_n(&parent->children.length, length + 1, __ATOMIC_RELEASE);
+}
+
+// the functions below that are not exported expect vfs_tree_lock to be held by writers,
+// readers only go through vfs_lookup_relative which takes care of itself
+static struct vfs_node *vfs_insert_node(struct vfs_node *parent, struct file_ops *fops, struct filesystem *filesystem, struct stat *stat, const char *name, int dangle) {
 	if(parent == NULL) {
 		parent = vfs_root;
 	}
@@ -22,7 +55,7 @@ struct vfs_node *vfs_create_node(struct vfs_node *parent, struct file_ops *fops,
 	node->parent = parent;
 
 	if(!dangle) {
-		VECTOR_PUSH(parent->children, node);
+		vfs_add_child(parent, node);
 	}
 
 	if(S_ISDIR(stat->st_mode)) {
@@ -46,6 +79,14 @@ struct vfs_node *vfs_create_node(struct vfs_node *parent, struct file_ops *fops,
 	return node;
 }
 
+struct vfs_node *vfs_create_node(struct vfs_node *parent, struct file_ops *fops, struct filesystem *filesystem, struct stat *stat, const char *name, int dangle) {
+	mutex_lock(&vfs_tree_lock);
+	struct vfs_node *node = vfs_insert_node(parent, fops, filesystem, stat, name, dangle);
+	mutex_unlock(&vfs_tree_lock);
+
+	return node;
+}
+
 void vfs_init() {
 	struct stat *root_stat = alloc(sizeof(struct stat));
 	stat_init(root_stat);
@@ -79,36 +120,50 @@ void vfs_init() {
 	VECTOR_PUSH(vfs_root->children, last_directory);
 }
 
-struct vfs_node *vfs_search_relative(struct vfs_node *parent, const char *name, bool symlink) {
+static struct vfs_node *vfs_lookup_relative(struct vfs_node *parent, const char *name, bool symlink) {
 	if(strcmp(name, ".") == 0) {
 		return parent;
 	} else if(strcmp(name, "..") == 0) {
 		return parent->parent;
 	}
 
-	for(size_t i = 0; i < parent->children.length; i++) {
-		struct vfs_node *node = parent->children.data[i];
+	struct vfs_node *node = NULL;
+
+	rcu_read_lock();
+
+	// length first, whatever array goes with it is at least that long
+	size_t length = __atomic_load_n(&parent->children.length, __ATOMIC_ACQUIRE);
+	struct vfs_node **children = rcu_dereference(parent->children.data);
+
+	for(size_t i = 0; i < length; i++) {
+		if(strcmp(children[i]->name, name) == 0) {
+			node = children[i];
+			break;
+		}
+	}
 
-		if(strcmp(node->name, name) == 0) {
-			if(symlink && S_ISLNK(node->stat->st_mode)) {
-				const char *sympath = node->symlink;
+	rcu_read_unlock();
 
-				int relative = *sympath == '/' ? 0 : 1;
-				if(relative) {
-					node = vfs_search_absolute(parent, sympath, true);
-				} else {
-					node = vfs_search_absolute(NULL, sympath, true);
-				}
-			}
+	// nodes are never freed, only the arrays holding them
+	if(node && symlink && S_ISLNK(node->stat->st_mode)) {
+		const char *sympath = node->symlink;
 
-			return node;
+		int relative = *sympath == '/' ? 0 : 1;
+		if(relative) {
+			node = vfs_lookup_absolute(parent, sympath, true);
+		} else {
+			node = vfs_lookup_absolute(NULL, sympath, true);
 		}
 	}
 
-	return NULL;
+	return node;
 }
 
-struct vfs_node *vfs_create_node_deep(struct vfs_node *parent, struct file_ops *fops, struct filesystem *filesystem, struct stat *stat, const char *path) {
+struct vfs_node *vfs_search_relative(struct vfs_node *parent, const char *name, bool symlink) {
+	return vfs_lookup_relative(parent, name, symlink);
+}
+
+static struct vfs_node *vfs_insert_node_deep(struct vfs_node *parent, struct file_ops *fops, struct filesystem *filesystem, struct stat *stat, const char *path) {
 	if(parent == NULL) {
 		parent = vfs_root;
 	}
@@ -131,7 +186,7 @@ struct vfs_node *vfs_create_node_deep(struct vfs_node *parent, struct file_ops *
 
 	size_t i = 0;
 	for(; i < subpath_list.length; i++) {
-		struct vfs_node *node = vfs_search_relative(parent, subpath_list.data[i], true);
+		struct vfs_node *node = vfs_lookup_relative(parent, subpath_list.data[i], true);
 		if(node == NULL) {
 			break;
 		}
@@ -151,16 +206,24 @@ struct vfs_node *vfs_create_node_deep(struct vfs_node *parent, struct file_ops *
 		struct stat *stat = alloc(sizeof(struct stat));
 		stat_init(stat);
 		stat->st_mode = parent->stat->st_mode;
-		parent = vfs_create_node(parent, parent->fops, parent->filesystem, stat, subpath_list.data[i], 0);
+		parent = vfs_insert_node(parent, parent->fops, parent->filesystem, stat, subpath_list.data[i], 0);
 		if(parent->mountpoint) {
 			parent = parent->mountpoint;
 		}
 	}
 
-	return vfs_create_node(parent, fops, filesystem, stat, subpath_list.data[i], 0);
+	return vfs_insert_node(parent, fops, filesystem, stat, subpath_list.data[i], 0);
 }
 
-struct vfs_node *vfs_search_absolute(struct vfs_node *parent, const char *path, bool symfollow) {
+struct vfs_node *vfs_create_node_deep(struct vfs_node *parent, struct file_ops *fops, struct filesystem *filesystem, struct stat *stat, const char *path) {
+	mutex_lock(&vfs_tree_lock);
+	struct vfs_node *node = vfs_insert_node_deep(parent, fops, filesystem, stat, path);
+	mutex_unlock(&vfs_tree_lock);
+
+	return node;
+}
+
+static struct vfs_node *vfs_lookup_absolute(struct vfs_node *parent, const char *path, bool symfollow) {
 	if(parent == NULL) {
 		parent = vfs_root;
 	}
@@ -187,7 +250,7 @@ struct vfs_node *vfs_search_absolute(struct vfs_node *parent, const char *path,
 
 	size_t i;
 	for(i = 0; i < (subpath_list.length - 1); i++) {
-		parent = vfs_search_relative(parent, subpath_list.data[i], true);
+		parent = vfs_lookup_relative(parent, subpath_list.data[i], true);
 		if(parent == NULL) {
 			return NULL;
 		}
@@ -201,7 +264,11 @@ struct vfs_node *vfs_search_absolute(struct vfs_node *parent, const char *path,
 		}
 	}
 
-	return vfs_search_relative(parent, subpath_list.data[i], symfollow);
+	return vfs_lookup_relative(parent, subpath_list.data[i], symfollow);
+}
+
+struct vfs_node *vfs_search_absolute(struct vfs_node *parent, const char *path, bool symfollow) {
+	return vfs_lookup_absolute(parent, path, symfollow);
 }
 
 const char *vfs_absolute_path(struct vfs_node *node) {
@@ -211,6 +278,7 @@ const char *vfs_absolute_path(struct vfs_node *node) {
 
 	VECTOR(struct vfs_node*) node_list = { 0 };
 
+	// parents are set once at creation, the walk up needs no lock
 	while(node) {
 		VECTOR_PUSH(node_list, node);
 		node = node->parent;
@@ -231,7 +299,7 @@ const char *vfs_absolute_path(struct vfs_node *node) {
 	return ++ret;
 }
 
-struct vfs_node *vfs_parent_dir(struct vfs_node *parent, const char *path) {
+static struct vfs_node *vfs_lookup_parent(struct vfs_node *parent, const char *path) {
 	if(parent == NULL) {
 		parent = vfs_root;
 	}
@@ -260,7 +328,7 @@ struct vfs_node *vfs_parent_dir(struct vfs_node *parent, const char *path) {
 
 	size_t i;
 	for(i = 0; i < (subpath_list.length - 1); i++) {
-		parent = vfs_search_relative(parent, subpath_list.data[i], true);
+		parent = vfs_lookup_relative(parent, subpath_list.data[i], true);
 		if(parent == NULL) {
 			return NULL;
 		}
@@ -274,25 +342,35 @@ struct vfs_node *vfs_parent_dir(struct vfs_node *parent, const char *path) {
 		}
 	}
 
-	return vfs_search_relative(parent, subpath_list.data[i], true);
+	return vfs_lookup_relative(parent, subpath_list.data[i], true);
+}
+
+struct vfs_node *vfs_parent_dir(struct vfs_node *parent, const char *path) {
+	return vfs_lookup_parent(parent, path);
 }
 
 int vfs_mount(struct vfs_node *parent, const char *source, const char *target, struct filesystem *filesystem, struct file_ops *fops) {
-	struct vfs_node *source_node = vfs_search_absolute(parent, source, true);
-	struct vfs_node *target_node = vfs_search_absolute(parent, target, true);
+	mutex_lock(&vfs_tree_lock);
+
+	struct vfs_node *source_node = vfs_lookup_absolute(parent, source, true);
+	struct vfs_node *target_node = vfs_lookup_absolute(parent, target, true);
 
 	if(source_node == NULL || target_node == NULL) {
+		mutex_unlock(&vfs_tree_lock);
 		return -1;
 	}
 
 	if(!S_ISDIR(target_node->stat->st_mode)) {
+		mutex_unlock(&vfs_tree_lock);
 		return -1;
 	}
 
 	struct stat *stat = alloc(sizeof(struct stat));
 	stat_init(stat);
 	stat->st_mode = S_IFDIR | S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH;
-	target_node->mountpoint = vfs_create_node(target_node->parent, fops, filesystem, stat, target_node->name, 1);
+	target_node->mountpoint = vfs_insert_node(target_node->parent, fops, filesystem, stat, target_node->name, 1);
+
+	mutex_unlock(&vfs_tree_lock);
 
 	return 0;
 }
@@ -5,6 +5,7 @@
 #include <vector.h>
 #include <hash.h>
 #include <lock.h>
+#include <sched/mutex.h>
 
 #define MAX_PATH_LENGTH 4096
 #define MAX_FILENAME 256
@@ -14,7 +15,7 @@ struct vfs_node;
 struct file_ops;
 
 struct vfs_node {
-	struct spinlock lock;
+	struct mutex lock;
 	const char *name;
 
 	struct file_ops *fops;
@@ -38,6 +39,10 @@ struct filesystem {
 
 extern struct vfs_node *vfs_root;
 
+// serialises changes to the shape of the tree, children lists and mountpoints. lookups run
+// under rcu and never take it. file contents go under the node lock
+extern struct mutex vfs_tree_lock;
+
 struct vfs_node *vfs_create_node_deep(struct vfs_node *parent, struct file_ops *fops, struct filesystem *filesystem, struct stat *stat, const char *str);
 struct vfs_node *vfs_create_node(struct vfs_node *parent, struct file_ops *fops, struct filesystem *filesystem, struct stat *stat, const char *name, int dangle);
 struct vfs_node *vfs_search_absolute(struct vfs_node *parent, const char *path, bool symfollow);
@@ -49,12 +54,12 @@ void vfs_init();
 
 static inline void node_lock(struct vfs_node *node) {
 	if(node) {
-		spinlock_irqsave(&node->lock);
+		mutex_lock(&node->lock);
 	}
 }
 
 static inline void node_unlock(struct vfs_node *node) {
 	if(node) {
-		spinrelease_irqsave(&node->lock);
+		mutex_unlock(&node->lock);
 	}
 }
@@ -1,7 +1,8 @@
 #include <int/apic.h>
 #include <debug.h>
 #include <mm/vmm.h>
-#include <drivers/hpet.h>
+#include <drivers/pit.h>
+#include <lock.h>
 #include <string.h>
 #include <cpu.h>
 
@@ -42,19 +43,61 @@ uint64_t ioapic_read_redirection_table(struct ioapic *ioapic, uint8_t redirectio
 	return data;
 }
 
-void apic_timer_init(uint32_t ms) {
-	xapic_write(XAPIC_TIMER_DIVIDE_CONF_OFF, 0x3); // divide by 16
-	xapic_write(XAPIC_TIMER_INITAL_COUNT_OFF, ~0);
+static uint64_t apic_timer_ticks_per_ms;
+static struct spinlock apic_timer_lock;
+
+void apic_timer_oneshot(uint64_t ns) {
+	if(ns == 0) {
+		xapic_write(XAPIC_TIMER_INITAL_COUNT_OFF, 0);
+		return;
+	}
 
-	msleep(ms);
+	// clamped before the multiply, a far off deadline would otherwise wrap into a short one
+	uint64_t max_ns = 0xffffffffull * 1000000 / apic_timer_ticks_per_ms;
+	if(ns > max_ns) {
+		ns = max_ns;
+	}
 
-	uint32_t ticks = ~0 - xapic_read(XAPIC_TIMER_CURRENT_COUNT_OFF);
+	uint64_t ticks = ns * apic_timer_ticks_per_ms / 1000000;
+
+	if(ticks == 0) {
+		ticks = 1;
+	}
 
-	xapic_write(XAPIC_TIMER_LVT_OFF, 0x20 | (1 << 17));
-	xapic_write(XAPIC_TIMER_DIVIDE_CONF_OFF, 0x3); // divide by 16
 	xapic_write(XAPIC_TIMER_INITAL_COUNT_OFF, ticks);
 }
 
+void apic_timer_init() {
+	spinlock_irqsave(&apic_timer_lock);
+
+	// every core's timer runs off the same bus clock, so calibrate once against the pit
+	if(apic_timer_ticks_per_ms == 0) {
+		xapic_write(XAPIC_TIMER_LVT_OFF, APIC_TIMER_MASKED | 0x20);
+		xapic_write(XAPIC_TIMER_DIVIDE_CONF_OFF, 0x3); // divide by 16
+		xapic_write(XAPIC_TIMER_INITAL_COUNT_OFF, ~0);
+
+		pit_wait(APIC_TIMER_CALIBRATION_MS);
+
+		uint32_t ticks = ~0 - xapic_read(XAPIC_TIMER_CURRENT_COUNT_OFF);
+
+		apic_timer_ticks_per_ms = ticks / APIC_TIMER_CALIBRATION_MS;
+
+		print("apic: timer runs at %d ticks per ms\n", apic_timer_ticks_per_ms);
+	}
+
+	spinrelease_irqsave(&apic_timer_lock);
+
+	xapic_write(XAPIC_TIMER_DIVIDE_CONF_OFF, 0x3); // divide by 16
+	xapic_write(XAPIC_TIMER_LVT_OFF, 0x20); // one shot, rearmed by the scheduler
+
+	apic_timer_oneshot(APIC_TIMER_FIRST_SHOT);
+}
+
+void xapic_send_ipi(uint32_t apic_id, uint8_t vector) {
+	xapic_write(XAPIC_ICR_OFF + 0x10, apic_id << 24);
+	xapic_write(XAPIC_ICR_OFF, vector);
+}
+
 int ioapic_set_irq_redirection(uint32_t lapic_id, uint8_t vector, uint8_t irq, bool mask) {
 	uint64_t flags = 0;
 
@@ -53,6 +53,10 @@
 #define XAPIC_TIMER_CURRENT_COUNT_OFF 0x390
 #define XAPIC_TIMER_DIVIDE_CONF_OFF 0x3E0
 
+#define APIC_TIMER_MASKED (1 << 16)
+#define APIC_TIMER_CALIBRATION_MS 10
+#define APIC_TIMER_FIRST_SHOT 1000000
+
 struct ioapic {
 	uint32_t ioapic_id;
 	uint32_t ioapic_version;
@@ -65,7 +69,9 @@ struct ioapic {
 };
 
 void apic_init();
-void apic_timer_init(uint32_t ms);
+void apic_timer_init();
+void apic_timer_oneshot(uint64_t ns);
+void xapic_send_ipi(uint32_t apic_id, uint8_t vector);
 uint32_t ioapic_read(struct ioapic *ioapic, uint8_t reg);
 void ioapic_write(struct ioapic *ioapic, uint32_t reg, uint32_t data);
 void ioapic_write_redirection_table(struct ioapic *ioapic, uint32_t redirection_entry, uint64_t data);
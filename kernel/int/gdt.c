@@ -108,6 +108,9 @@ void gdt_init() {
 		.offset = (uintptr_t)gdt
 	};
 							
+	// reloading the gs selector clears the base that CORE_LOCAL depends on
+	uint64_t gs_base = rdmsr(MSR_GS_BASE);
+
 	asm volatile (	
 		"lgdtq %0\n\t"
 		"lea 1f(%%rip), %%rax\n\t"
@@ -125,4 +128,6 @@ void gdt_init() {
 		"ltr %%ax\n\t"
 		:: "m"(gdtr) : "rax", "memory"
 	);
+
+	wrmsr(MSR_GS_BASE, gs_base);
 }
@@ -4,6 +4,8 @@
 #include <int/idt.h>
 #include <mm/vmm.h>
 #include <sched/sched.h>
+#include <sched/fpu.h>
+#include <sched/softirq.h>
 #include <lock.h>
 #include <debug.h>
 
@@ -106,6 +108,14 @@ extern void isr_handler_main(struct registers *regs) {
 		}
 	}
 
+	// device not available, a task touched the fpu for the first time since it was switched in
+	if(regs->isr_number == 0x7 && fpu_trap(regs) == 0) {
+		if(regs->cs & 0x3) {
+			swapgs();
+		}
+		return;
+	}
+
 	if(regs->isr_number < 32) {
 		static struct spinlock exception_lock;
 
@@ -118,7 +128,7 @@ extern void isr_handler_main(struct registers *regs) {
 		spinlock_irqsave(&exception_lock);
 
 		print("debug: Kowalski analysis: \"%s\", Error: %x\n", exception_messages[regs->isr_number], regs->error_code);
-		if(CORE_LOCAL) print("debug: pid: %x | tid: %x | apic_id: %x\n", CORE_LOCAL->pid, CORE_LOCAL->tid, CORE_LOCAL->tid, CORE_LOCAL->apic_id);
+		if(CORE_LOCAL) print("debug: pid: %x | tid: %x | apic_id: %x\n", this_cpu_read(pid), this_cpu_read(tid), this_cpu_read(tid), this_cpu_read(apic_id));
 		print("debug: RAX: %x | RBX: %x | RCX: %x | RDX: %x\n", regs->rax, regs->rbx, regs->rcx, regs->rdx);
 		print("debug: RSI: %x | RDI: %x | RBP: %x | RSP: %x\n", regs->rsi, regs->rdi, regs->rbp, regs->rsp);
 		print("debug: r8:  %x | r9:  %x | r10: %x | r11: %x\n", regs->r8, regs->r9, regs->r10, regs->r11);
@@ -138,15 +148,35 @@ extern void isr_handler_main(struct registers *regs) {
 		}
 	}
 
+	// only device interrupts and the tick get this far. handlers do the urgent part and leave
+	// the rest to softirqs, which run below with interrupts back on
+	irqsoff_begin();
+	softirq_irq_enter();
+
+	this_cpu_inc(irq_count);
+	if(regs->isr_number == SCHED_VECTOR) {
+		this_cpu_inc(sched_irq_count);
+	}
+
 	if(interrupt_vectors[regs->isr_number].handler != NULL) {
 		interrupt_vectors[regs->isr_number].handler(regs, interrupt_vectors[regs->isr_number].ptr);
 	}
 
+	xapic_write(XAPIC_EOI_OFF, 0);
+
+	// the only place an interrupt runs its softirqs, after the eoi so other vectors can come in
+	softirq_irq_exit();
+
+	// the tick goes on to pick a task, it only comes back here when the current one keeps the cpu
+	if(regs->isr_number == SCHED_VECTOR) {
+		sched_tick(regs);
+	}
+
+	irqsoff_end();
+
 	if(regs->cs & 0x3) {
 		swapgs();
 	}
-
-	xapic_write(XAPIC_EOI_OFF, 0);
 }
 
 void idt_init() {
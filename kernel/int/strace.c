@@ -71,6 +71,17 @@ extern void syscall_sendto(struct registers*);
 extern void syscall_recvfrom(struct registers*);
 extern void syscall_clone(struct registers*);
 extern void syscall_futex(struct registers*);
+extern void syscall_setpriority(struct registers*);
+extern void syscall_getpriority(struct registers*);
+extern void syscall_sched_setscheduler(struct registers*);
+extern void syscall_sched_getscheduler(struct registers*);
+extern void syscall_sched_getparam(struct registers*);
+extern void syscall_clock_gettime(struct registers*);
+extern void syscall_clock_getres(struct registers*);
+extern void syscall_nanosleep(struct registers*);
+extern void syscall_clock_nanosleep(struct registers*);
+extern void syscall_sched_setaffinity(struct registers*);
+extern void syscall_sched_getaffinity(struct registers*);
 
 static void syscall_set_fs_base(struct registers *regs) {
 	uint64_t addr = regs->rdi;
@@ -78,7 +89,7 @@ static void syscall_set_fs_base(struct registers *regs) {
 	CURRENT_TASK->user_fs_base = addr;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] set_fs_base: addr {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, addr);
+	print("syscall: [pid %x, tid %x] set_fs_base: addr {%x}\n", this_cpu_read(pid), this_cpu_read(tid), addr);
 #endif
 
 	set_user_fs(addr);
@@ -88,7 +99,7 @@ static void syscall_set_fs_base(struct registers *regs) {
 
 static void syscall_get_fs_base(struct registers *regs) {
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] get_fs_base\n", CORE_LOCAL->pid, CORE_LOCAL->tid);
+	print("syscall: [pid %x, tid %x] get_fs_base\n", this_cpu_read(pid), this_cpu_read(tid));
 #endif
 
 	regs->rax = get_user_fs();
@@ -100,7 +111,7 @@ static void syscall_set_gs_base(struct registers *regs) {
 	CURRENT_TASK->user_gs_base = addr;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] set_gs_base: addr {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, addr);
+	print("syscall: [pid %x, tid %x] set_gs_base: addr {%x}\n", this_cpu_read(pid), this_cpu_read(tid), addr);
 #endif
 
 	set_user_gs(addr);
@@ -110,12 +121,61 @@ static void syscall_set_gs_base(struct registers *regs) {
 
 static void syscall_get_gs_base(struct registers *regs) {
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] get_gs_base\n", CORE_LOCAL->pid, CORE_LOCAL->tid);
+	print("syscall: [pid %x, tid %x] get_gs_base\n", this_cpu_read(pid), this_cpu_read(tid));
 #endif
 
 	regs->rax = get_user_gs();
 }
 
+static void syscall_arch_prctl(struct registers *regs) {
+	int code = regs->rdi;
+	uint64_t addr = regs->rsi;
+
+#ifndef SYSCALL_DEBUG
+	print("syscall: [pid %x, tid %x] arch_prctl: code {%x}, addr {%x}\n", this_cpu_read(pid), this_cpu_read(tid), code, addr);
+#endif
+
+	struct task *task = CURRENT_TASK;
+
+	switch(code) {
+		case ARCH_SET_FS:
+		case ARCH_SET_GS:
+			if(addr >= USER_ADDRESS_LIMIT) {
+				set_errno(EPERM);
+				regs->rax = -1;
+				return;
+			}
+
+			if(code == ARCH_SET_FS) {
+				task->user_fs_base = addr;
+				set_user_fs(addr);
+			} else {
+				task->user_gs_base = addr;
+				set_user_gs(addr);
+			}
+
+			break;
+		case ARCH_GET_FS:
+		case ARCH_GET_GS:
+			// the value is the caller's own, where it goes must be too
+			if(addr == 0 || addr > USER_ADDRESS_LIMIT - sizeof(uint64_t)) {
+				set_errno(EFAULT);
+				regs->rax = -1;
+				return;
+			}
+
+			*(uint64_t*)addr = code == ARCH_GET_FS ? get_user_fs() : get_user_gs();
+
+			break;
+		default:
+			set_errno(EINVAL);
+			regs->rax = -1;
+			return;
+	}
+
+	regs->rax = 0;
+}
+
 static void syscall_syslog(struct registers *regs) {
 	const char *str = (void*)regs->rdi;
 	print("%s\n", str);
@@ -188,7 +248,19 @@ static struct syscall_handle syscall_list[] = {
 	{ .handler = syscall_sendto, .name = "sendto" }, // 63
 	{ .handler = syscall_recvfrom, .name = "recvfrom" }, // 64
 	{ .handler = syscall_clone, .name = "clone" }, // 65
-	{ .handler = syscall_futex, .name = "futex" } // 66
+	{ .handler = syscall_futex, .name = "futex" }, // 66
+	{ .handler = syscall_setpriority, .name = "setpriority" }, // 67
+	{ .handler = syscall_getpriority, .name = "getpriority" }, // 68
+	{ .handler = syscall_sched_setscheduler, .name = "sched_setscheduler" }, // 69
+	{ .handler = syscall_sched_getscheduler, .name = "sched_getscheduler" }, // 70
+	{ .handler = syscall_sched_getparam, .name = "sched_getparam" }, // 71
+	{ .handler = syscall_clock_gettime, .name = "clock_gettime" }, // 72
+	{ .handler = syscall_clock_getres, .name = "clock_getres" }, // 73
+	{ .handler = syscall_nanosleep, .name = "nanosleep" }, // 74
+	{ .handler = syscall_clock_nanosleep, .name = "clock_nanosleep" }, // 75
+	{ .handler = syscall_sched_setaffinity, .name = "sched_setaffinity" }, // 76
+	{ .handler = syscall_sched_getaffinity, .name = "sched_getaffinity" }, // 77
+	{ .handler = syscall_arch_prctl, .name = "arch_prctl" } // 78
 };
 
 extern void syscall_handler(struct registers *regs) {
@@ -201,6 +273,9 @@ extern void syscall_handler(struct registers *regs) {
 		return;
 	}
 
+	// syscalls run with interrupts off throughout
+	irqsoff_begin();
+
 	CURRENT_TASK->signal_queue.active = false;
 
 	if(syscall_list[syscall_number].handler != NULL) {
@@ -213,9 +288,13 @@ extern void syscall_handler(struct registers *regs) {
 		set_errno(0);
 	}
 
+	sched_sync_finish();
+
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] %s returning %x with errno %d\n", CORE_LOCAL->pid, CORE_LOCAL->tid, syscall_list[syscall_number].name, regs->rax, get_errno());
+	print("syscall: [pid %x, tid %x] %s returning %x with errno %d\n", this_cpu_read(pid), this_cpu_read(tid), syscall_list[syscall_number].name, regs->rax, get_errno());
 #endif
 
 	CURRENT_TASK->signal_queue.active = true;
+
+	irqsoff_end();
 }
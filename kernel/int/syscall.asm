@@ -5,8 +5,8 @@ extern syscall_handler
 syscall_main:
 	swapgs
 
-	mov qword [gs:8], rsp ; save user stack
-	mov rsp, qword [gs:0] ; restore kernel stack
+	mov qword [gs:16], rsp ; save user stack
+	mov rsp, qword [gs:8] ; restore kernel stack
 
 ;	sti
 
@@ -14,7 +14,7 @@ syscall_main:
 	push r11 ; rflags
 
 	push 0x3b ; ss
-	push qword [gs:8] ; rsp
+	push qword [gs:16] ; rsp
 	push r11 ; rflags
 	push 0x43 ; cs
 	push rcx ; rip
@@ -63,8 +63,8 @@ syscall_main:
 
 	cli
 
-	mov rdx, qword [gs:16] ; errno
-	mov rsp, qword [gs:8] ; user stack
+	mov rdx, qword [gs:24] ; errno
+	mov rsp, qword [gs:16] ; user stack
 
 	swapgs
 
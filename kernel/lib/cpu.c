@@ -1,7 +1,10 @@
 #include <cpu.h>
+#include <sched/fpu.h>
 
 uint64_t HIGH_VMA = 0xffff800000000000;
 
+bool cpu_fsgsbase;
+
 extern void syscall_main();
 
 struct cpuid_state cpuid(size_t leaf, size_t subleaf) {
@@ -14,7 +17,7 @@ struct cpuid_state cpuid(size_t leaf, size_t subleaf) {
 		return ret;
 	}
 
-	asm volatile ("cpuid" : "=a"(ret.rax), "=b"(ret.rbx), "=c"(ret.rcx), "=d"(ret.rbx) : "a"(leaf), "c"(subleaf));
+	asm volatile ("cpuid" : "=a"(ret.rax), "=b"(ret.rbx), "=c"(ret.rcx), "=d"(ret.rdx) : "a"(leaf), "c"(subleaf));
 
 	return ret;
 }
@@ -39,10 +42,19 @@ void init_cpu_features() {
 	cr4 |=	(1 << 7) | // Set PGE (allow for global pages)
 			(1 << 9) | // Enables SSE and fxsave/fxrstor
 			(1 << 10); // Enables unmasked SSE exceptions
+
+	fpu_cpu_init();
+
+	struct cpuid_state cpuid_state = cpuid(7, 0);
+
+	// lets the context switch move fs/gs bases without going through the msrs
+	if(cpuid_state.rbx & CPUID_7_EBX_FSGSBASE) {
+		cr4 |= CR4_FSGSBASE;
+		cpu_fsgsbase = true;
+	}
 											
 	asm volatile ("mov %0, %%cr4" :: "r"(cr4));
 
-	struct cpuid_state cpuid_state = cpuid(7, 0);
 	if(cpuid_state.rcx & (1 << 16)) {
 		HIGH_VMA = 0xff00000000000000;
 	}
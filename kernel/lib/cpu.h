@@ -8,6 +8,7 @@
 #define KERNEL_HIGH_VMA 0xffffffff80000000
 
 extern uint64_t HIGH_VMA;
+extern bool cpu_fsgsbase;
 
 #define MSR_LAPIC_BASE 0x1b
 #define MSR_EFER 0xc0000080
@@ -17,6 +18,17 @@ extern uint64_t HIGH_VMA;
 #define MSR_SFMASK 0xc0000084
 #define PAT_MSR 0x277
 
+#define CR4_FSGSBASE (1 << 16)
+#define CPUID_7_EBX_FSGSBASE (1 << 0)
+
+#define ARCH_SET_GS 0x1001
+#define ARCH_SET_FS 0x1002
+#define ARCH_GET_FS 0x1003
+#define ARCH_GET_GS 0x1004
+
+// first non canonical address of the lower half
+#define USER_ADDRESS_LIMIT 0x800000000000ull
+
 #define MSR_FS_BASE 0xc0000100
 #define MSR_GS_BASE 0xc0000101
 #define KERNEL_GS_BASE 0xc0000102
@@ -32,10 +44,37 @@ extern uint64_t HIGH_VMA;
 #define COM3 0x3e8
 #define COM4 0x2e8
 
+// gs always points at the running cpu's cpu_local in the kernel, the first field points back at itself
 #define CORE_LOCAL ({ \
-	(struct cpu_local*)(rdmsr(MSR_GS_BASE)); \
+	struct cpu_local *ret; \
+	asm volatile ("mov %%gs:0, %0" : "=r"(ret)); \
+	ret; \
+})
+
+#define this_cpu_offset(field) __builtin_offsetof(struct cpu_local, field)
+#define this_cpu_type(field) typeof(((struct cpu_local*)0)->field)
+
+#define this_cpu_read(field) ({ \
+	this_cpu_type(field) ret; \
+	asm volatile ("mov %%gs:%c1, %0" : "=r"(ret) : "i"(this_cpu_offset(field))); \
+	ret; \
+})
+
+#define this_cpu_write(field, value) ({ \
+	asm volatile ("mov %0, %%gs:%c1" :: "r"((this_cpu_type(field))(value)), "i"(this_cpu_offset(field)) : "memory"); \
+})
+
+#define this_cpu_add(field, value) ({ \
+	asm volatile ("add %0, %%gs:%c1" :: "r"((this_cpu_type(field))(value)), "i"(this_cpu_offset(field)) : "memory"); \
 })
 
+#define this_cpu_sub(field, value) ({ \
+	asm volatile ("sub %0, %%gs:%c1" :: "r"((this_cpu_type(field))(value)), "i"(this_cpu_offset(field)) : "memory"); \
+})
+
+#define this_cpu_inc(field) this_cpu_add(field, 1)
+#define this_cpu_dec(field) this_cpu_sub(field, 1)
+
 struct registers {
 	uint64_t r15;
 	uint64_t r14;
@@ -120,19 +159,53 @@ static inline void set_kernel_gs(uintptr_t addr) {
 	wrmsr(MSR_GS_BASE, addr);
 }
 
+// while in the kernel the user gs base sits in KERNEL_GS_BASE, the fsgsbase instructions only reach it
+// from behind a swapgs and nothing may observe the kernel gs missing in between
 static inline void set_user_gs(uintptr_t addr) {
+	if(cpu_fsgsbase) {
+		bool interrupts = get_interrupt_state();
+		asm volatile ("cli\n\tswapgs\n\twrgsbase %0\n\tswapgs" :: "r"(addr) : "memory");
+
+		if(interrupts) {
+			asm volatile ("sti");
+		}
+		return;
+	}
+
 	wrmsr(KERNEL_GS_BASE, addr);
 }
 
 static inline uint64_t get_user_gs() {
+	if(cpu_fsgsbase) {
+		uint64_t addr;
+		bool interrupts = get_interrupt_state();
+		asm volatile ("cli\n\tswapgs\n\trdgsbase %0\n\tswapgs" : "=r"(addr) :: "memory");
+
+		if(interrupts) {
+			asm volatile ("sti");
+		}
+		return addr;
+	}
+
 	return rdmsr(KERNEL_GS_BASE);
 }
 
 static inline void set_user_fs(uint64_t addr) {
+	if(cpu_fsgsbase) {
+		asm volatile ("wrfsbase %0" :: "r"(addr) : "memory");
+		return;
+	}
+
 	wrmsr(MSR_FS_BASE, addr);
 }
 
 static inline uint64_t get_user_fs() {
+	if(cpu_fsgsbase) {
+		uint64_t addr;
+		asm volatile ("rdfsbase %0" : "=r"(addr) :: "memory");
+		return addr;
+	}
+
 	return rdmsr(MSR_FS_BASE);
 }
 
@@ -141,11 +214,11 @@ static inline void invlpg(uint64_t vaddr) {
 }
 
 static inline void set_errno(uint64_t code) {
-	CORE_LOCAL->errno = code;
+	this_cpu_write(errno, code);
 }
 
 static inline uint64_t get_errno() {
-	return CORE_LOCAL->errno;
+	return this_cpu_read(errno);
 }
 
 struct cpuid_state cpuid(size_t leaf, size_t subleaf);
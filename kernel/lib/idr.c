@@ -0,0 +1,281 @@
+#include <idr.h>
+#include <string.h>
+#include <mm/slab.h>
+
+static struct idr_node *idr_node_alloc(int shift) {
+	struct idr_node *node = alloc(sizeof(struct idr_node));
+	memset8((void*)node, 0, sizeof(struct idr_node));
+
+	node->shift = shift;
+	node->free = ~0ull;
+
+	return node;
+}
+
+static int64_t idr_span(struct idr_node *root) {
+	return root ? (int64_t)1 << (root->shift + IDR_BITS) : 0;
+}
+
+static void idr_grow(struct idr *idr, int64_t id) {
+	while(id >= idr_span(idr->root)) {
+		struct idr_node *root = idr->root;
+		struct idr_node *node = idr_node_alloc(root ? root->shift + IDR_BITS : 0);
+
+		if(root) {
+			node->slots[0] = root;
+			if(root->free == 0) {
+				node->free &= ~1ull;
+			}
+		}
+
+		__atomic_store_n(&idr->root, node, __ATOMIC_RELEASE);
+	}
+}
+
+// lowest unused id at or above start, -1 when everything the tree currently spans is taken
+static int64_t idr_node_find_free(struct idr_node *node, int64_t base, int64_t start) {
+	int index = start > base ? (start - base) >> node->shift : 0;
+	uint64_t mask = node->free & (~0ull << index);
+
+	while(mask) {
+		int i = __builtin_ctzll(mask);
+		int64_t child_base = base + ((int64_t)i << node->shift);
+		struct idr_node *child = node->slots[i];
+
+		// an empty subtree is free all the way through
+		if(node->shift == 0 || child == NULL) {
+			return child_base > start ? child_base : start;
+		}
+
+		int64_t id = idr_node_find_free(child, child_base, start);
+		if(id != -1) {
+			return id;
+		}
+
+		mask &= mask - 1;
+	}
+
+	return -1;
+}
+
+static void idr_insert(struct idr *idr, int id, void *ptr) {
+	struct idr_node *path[IDR_MAX_LEVELS];
+	int depth = 0;
+
+	idr_grow(idr, id);
+
+	struct idr_node *node = idr->root;
+
+	while(node->shift) {
+		path[depth++] = node;
+
+		int i = (id >> node->shift) & IDR_MASK;
+		struct idr_node *child = node->slots[i];
+
+		if(child == NULL) {
+			child = idr_node_alloc(node->shift - IDR_BITS);
+			__atomic_store_n(&node->slots[i], child, __ATOMIC_RELEASE);
+		}
+
+		node = child;
+	}
+
+	int i = id & IDR_MASK;
+
+	__atomic_store_n(&node->slots[i], ptr, __ATOMIC_RELEASE);
+	node->free &= ~(1ull << i);
+
+	// a full node makes its slot in the parent full as well
+	while(node->free == 0 && depth) {
+		struct idr_node *parent = path[--depth];
+		parent->free &= ~(1ull << ((id >> parent->shift) & IDR_MASK));
+		node = parent;
+	}
+
+	idr->count++;
+}
+
+static int idr_alloc_range(struct idr *idr, void *ptr, int start, int end) {
+	if(start < 0 || start >= end) {
+		return -1;
+	}
+
+	idr_grow(idr, start);
+
+	int64_t id = idr_node_find_free(idr->root, 0, start);
+	if(id == -1) {
+		id = idr_span(idr->root);
+	}
+
+	if(id >= end) {
+		return -1;
+	}
+
+	idr_insert(idr, id, ptr);
+
+	return id;
+}
+
+int idr_alloc(struct idr *idr, void *ptr, int start, int end) {
+	if(end <= 0) {
+		end = IDR_ID_MAX;
+	}
+
+	spinlock_irqsave(&idr->lock);
+	int id = idr_alloc_range(idr, ptr, start, end);
+	spinrelease_irqsave(&idr->lock);
+
+	return id;
+}
+
+// hands out ids in increasing order and only wraps around once the range is used up, so a
+// freed id is not given out again right away
+int idr_alloc_cyclic(struct idr *idr, void *ptr, int start, int end) {
+	if(end <= 0) {
+		end = IDR_ID_MAX;
+	}
+
+	spinlock_irqsave(&idr->lock);
+
+	int next = idr->next > start ? idr->next : start;
+
+	int id = idr_alloc_range(idr, ptr, next, end);
+	if(id == -1 && next > start) {
+		id = idr_alloc_range(idr, ptr, start, next);
+	}
+
+	if(id != -1) {
+		idr->next = id + 1 < end ? id + 1 : start;
+	}
+
+	spinrelease_irqsave(&idr->lock);
+
+	return id;
+}
+
+void *idr_find(struct idr *idr, int id) {
+	struct idr_node *node = __atomic_load_n(&idr->root, __ATOMIC_ACQUIRE);
+
+	if(id < 0 || id >= idr_span(node)) {
+		return NULL;
+	}
+
+	while(node->shift) {
+		node = __atomic_load_n(&node->slots[(id >> node->shift) & IDR_MASK], __ATOMIC_ACQUIRE);
+		if(node == NULL) {
+			return NULL;
+		}
+	}
+
+	return __atomic_load_n(&node->slots[id & IDR_MASK], __ATOMIC_ACQUIRE);
+}
+
+// returns the leaf holding id and fills in the nodes above it, NULL when id is not in use
+static struct idr_node *idr_walk(struct idr *idr, int id, struct idr_node **path, int *depth) {
+	struct idr_node *node = idr->root;
+
+	*depth = 0;
+
+	if(id < 0 || id >= idr_span(node)) {
+		return NULL;
+	}
+
+	while(node->shift) {
+		path[(*depth)++] = node;
+
+		node = node->slots[(id >> node->shift) & IDR_MASK];
+		if(node == NULL) {
+			return NULL;
+		}
+	}
+
+	if(node->free & (1ull << (id & IDR_MASK))) {
+		return NULL;
+	}
+
+	return node;
+}
+
+void *idr_replace(struct idr *idr, int id, void *ptr) {
+	struct idr_node *path[IDR_MAX_LEVELS];
+	int depth;
+
+	spinlock_irqsave(&idr->lock);
+
+	struct idr_node *node = idr_walk(idr, id, path, &depth);
+	if(node == NULL) {
+		spinrelease_irqsave(&idr->lock);
+		return NULL;
+	}
+
+	void *old = __atomic_exchange_n(&node->slots[id & IDR_MASK], ptr, __ATOMIC_ACQ_REL);
+
+	spinrelease_irqsave(&idr->lock);
+
+	return old;
+}
+
+void *idr_remove(struct idr *idr, int id) {
+	struct idr_node *path[IDR_MAX_LEVELS];
+	int depth;
+
+	spinlock_irqsave(&idr->lock);
+
+	struct idr_node *node = idr_walk(idr, id, path, &depth);
+	if(node == NULL) {
+		spinrelease_irqsave(&idr->lock);
+		return NULL;
+	}
+
+	int i = id & IDR_MASK;
+
+	void *ptr = __atomic_exchange_n(&node->slots[i], NULL, __ATOMIC_ACQ_REL);
+	node->free |= 1ull << i;
+
+	while(depth) {
+		struct idr_node *parent = path[--depth];
+		parent->free |= 1ull << ((id >> parent->shift) & IDR_MASK);
+	}
+
+	idr->count--;
+
+	spinrelease_irqsave(&idr->lock);
+
+	return ptr;
+}
+
+static void *idr_node_next(struct idr_node *node, int64_t base, int64_t start, int *id) {
+	int index = start > base ? (start - base) >> node->shift : 0;
+
+	for(int i = index; i < IDR_SIZE; i++) {
+		int64_t child_base = base + ((int64_t)i << node->shift);
+		void *slot = __atomic_load_n(&node->slots[i], __ATOMIC_ACQUIRE);
+
+		if(slot == NULL) {
+			continue;
+		}
+
+		if(node->shift == 0) {
+			*id = child_base;
+			return slot;
+		}
+
+		void *ptr = idr_node_next(slot, child_base, start, id);
+		if(ptr) {
+			return ptr;
+		}
+	}
+
+	return NULL;
+}
+
+// first entry at or above *id, which is updated to where it was found
+void *idr_get_next(struct idr *idr, int *id) {
+	struct idr_node *root = __atomic_load_n(&idr->root, __ATOMIC_ACQUIRE);
+
+	if(*id < 0 || *id >= idr_span(root)) {
+		return NULL;
+	}
+
+	return idr_node_next(root, 0, *id, id);
+}
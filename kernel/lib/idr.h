@@ -0,0 +1,33 @@
+#pragma once
+
+#include <types.h>
+#include <lock.h>
+
+#define IDR_BITS 6
+#define IDR_SIZE (1 << IDR_BITS)
+#define IDR_MASK (IDR_SIZE - 1)
+
+// six levels of 64 slots cover every non-negative int
+#define IDR_MAX_LEVELS 6
+#define IDR_ID_MAX 0x7fffffff
+
+struct idr_node {
+	int shift;
+	uint64_t free; // a set bit means the slot, or something below it, is unused
+	void *slots[IDR_SIZE];
+};
+
+// lookups walk the tree without the lock, nodes are never freed once they have been published
+struct idr {
+	struct spinlock lock;
+	struct idr_node *root;
+	int next;
+	size_t count;
+};
+
+int idr_alloc(struct idr *idr, void *ptr, int start, int end);
+int idr_alloc_cyclic(struct idr *idr, void *ptr, int start, int end);
+void *idr_find(struct idr *idr, int id);
+void *idr_replace(struct idr *idr, int id, void *ptr);
+void *idr_remove(struct idr *idr, int id);
+void *idr_get_next(struct idr *idr, int *id);
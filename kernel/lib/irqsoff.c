@@ -0,0 +1,150 @@
+#ifdef IRQSOFF_TRACE
+
+#include <irqsoff.h>
+#include <string.h>
+#include <fs/cdev.h>
+#include <fs/vfs.h>
+#include <mm/slab.h>
+#include <lib/cpu.h>
+#include <sched/smp.h>
+#include <debug.h>
+
+#define IRQSOFF_MAJOR 10
+#define IRQSOFF_MINOR 2
+
+// only ever touched by its own cpu with interrupts off
+struct irqsoff_cpu {
+	uint64_t start;
+	uintptr_t start_ip;
+
+	uint64_t max;
+	uintptr_t max_start_ip;
+	uintptr_t max_end_ip;
+
+	uint64_t sections;
+	uint64_t total;
+} __attribute__((aligned(64)));
+
+static struct irqsoff_cpu irqsoff_cpus[CPUSET_MAX];
+
+static inline uint64_t irqsoff_clock() {
+	uint32_t low, high;
+	asm volatile ("rdtsc" : "=a"(low), "=d"(high));
+	return ((uint64_t)high << 32) | low;
+}
+
+// a begin without an end is closed by whichever end comes next, so entries that never return
+// through the same path are still covered
+__attribute__((noinline)) void irqsoff_begin() {
+	struct irqsoff_cpu *cpu = &irqsoff_cpus[this_cpu_read(cpu_number)];
+
+	if(cpu->start) {
+		return;
+	}
+
+	cpu->start_ip = (uintptr_t)__builtin_return_address(0);
+	cpu->start = irqsoff_clock();
+}
+
+__attribute__((noinline)) void irqsoff_end() {
+	struct irqsoff_cpu *cpu = &irqsoff_cpus[this_cpu_read(cpu_number)];
+
+	if(cpu->start == 0) {
+		return;
+	}
+
+	uint64_t elapsed = irqsoff_clock() - cpu->start;
+	cpu->start = 0;
+
+	cpu->sections++;
+	cpu->total += elapsed;
+
+	if(elapsed > cpu->max) {
+		cpu->max = elapsed;
+		cpu->max_start_ip = cpu->start_ip;
+		cpu->max_end_ip = (uintptr_t)__builtin_return_address(0);
+	}
+}
+
+static size_t irqsoff_print_ip(char *text, uintptr_t ip) {
+	struct symbol *symbol = elf64_search_symtable(&kernel_file, ip);
+
+	if(symbol) {
+		return sprint(text, "%s+%x", symbol->name, ip - symbol->address);
+	}
+
+	return sprint(text, "%x", ip);
+}
+
+static ssize_t irqsoff_read(struct file_handle*, void *buf, size_t cnt, off_t offset) {
+	static const char header[] = "# cpu sections avg max (cycles) from to\n";
+
+	size_t size = sizeof(header) + cpu_local_list.length * (2 * MAX_PATH_LENGTH + 4 * 21 + 8);
+	char *text = alloc(size);
+
+	size_t length = sprint(text, "%s", header);
+
+	for(size_t i = 0; i < cpu_local_list.length; i++) {
+		struct irqsoff_cpu *cpu = &irqsoff_cpus[i];
+
+		uint64_t sections = __atomic_load_n(&cpu->sections, __ATOMIC_RELAXED);
+		uint64_t total = __atomic_load_n(&cpu->total, __ATOMIC_RELAXED);
+
+		length += sprint(text + length, "%d %d %d %d ", i, sections, sections ? total / sections : 0,
+			__atomic_load_n(&cpu->max, __ATOMIC_RELAXED));
+		length += irqsoff_print_ip(text + length, __atomic_load_n(&cpu->max_start_ip, __ATOMIC_RELAXED));
+		length += sprint(text + length, " ");
+		length += irqsoff_print_ip(text + length, __atomic_load_n(&cpu->max_end_ip, __ATOMIC_RELAXED));
+		length += sprint(text + length, "\n");
+	}
+
+	if(offset >= length) {
+		free(text);
+		return 0;
+	}
+
+	if(offset + cnt > length) {
+		cnt = length - offset;
+	}
+
+	memcpy8(buf, (uint8_t*)text + offset, cnt);
+	free(text);
+
+	return cnt;
+}
+
+// any write starts the numbers over, an open section on another cpu still lands afterwards
+static ssize_t irqsoff_write(struct file_handle*, const void*, size_t cnt, off_t) {
+	for(size_t i = 0; i < cpu_local_list.length; i++) {
+		struct irqsoff_cpu *cpu = &irqsoff_cpus[i];
+
+		__atomic_store_n(&cpu->max, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&cpu->sections, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&cpu->total, 0, __ATOMIC_RELAXED);
+	}
+
+	return cnt;
+}
+
+static struct file_ops irqsoff_ops = {
+	.read = irqsoff_read,
+	.write = irqsoff_write
+};
+
+void irqsoff_init() {
+	struct cdev *cdev = alloc(sizeof(struct cdev));
+	cdev->fops = &irqsoff_ops;
+	cdev->rdev = makedev(IRQSOFF_MAJOR, IRQSOFF_MINOR);
+	if(cdev_register(cdev) == -1) {
+		print("irqsoff: unable to register device\n");
+		return;
+	}
+
+	struct stat *stat = alloc(sizeof(struct stat));
+	stat_init(stat);
+	stat->st_mode = S_IFCHR | S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+	stat->st_rdev = makedev(IRQSOFF_MAJOR, IRQSOFF_MINOR);
+	vfs_create_node_deep(NULL, NULL, NULL, stat, "/dev/irqsoff");
+}
+
+#endif
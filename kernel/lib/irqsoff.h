@@ -0,0 +1,16 @@
+#pragma once
+
+#ifdef IRQSOFF_TRACE
+
+// called right after interrupts go off and right before they come back on, the longest stretch
+// per cpu and where it started and ended are readable from /dev/irqsoff
+void irqsoff_begin();
+void irqsoff_end();
+void irqsoff_init();
+
+#else
+
+static inline void irqsoff_begin() { }
+static inline void irqsoff_end() { }
+
+#endif
@@ -0,0 +1,62 @@
+#include <irqstat.h>
+#include <string.h>
+#include <fs/cdev.h>
+#include <fs/vfs.h>
+#include <mm/slab.h>
+#include <lib/cpu.h>
+#include <sched/smp.h>
+#include <debug.h>
+
+#define IRQSTAT_MAJOR 10
+#define IRQSTAT_MINOR 3
+
+static ssize_t irqstat_read(struct file_handle*, void *buf, size_t cnt, off_t offset) {
+	static const char header[] = "# cpu interrupts sched\n";
+
+	size_t size = sizeof(header) + cpu_local_list.length * (3 * 21 + 4);
+	char *text = alloc(size);
+
+	size_t length = sprint(text, "%s", header);
+
+	// counted by each cpu for itself, a read only needs a consistent value per field
+	for(size_t i = 0; i < cpu_local_list.length; i++) {
+		struct cpu_local *local = cpu_local_list.data[i];
+
+		length += sprint(text + length, "%d %d %d\n", i, __atomic_load_n(&local->irq_count, __ATOMIC_RELAXED),
+			__atomic_load_n(&local->sched_irq_count, __ATOMIC_RELAXED));
+	}
+
+	if(offset >= length) {
+		free(text);
+		return 0;
+	}
+
+	if(offset + cnt > length) {
+		cnt = length - offset;
+	}
+
+	memcpy8(buf, (uint8_t*)text + offset, cnt);
+	free(text);
+
+	return cnt;
+}
+
+static struct file_ops irqstat_ops = {
+	.read = irqstat_read
+};
+
+void irqstat_init() {
+	struct cdev *cdev = alloc(sizeof(struct cdev));
+	cdev->fops = &irqstat_ops;
+	cdev->rdev = makedev(IRQSTAT_MAJOR, IRQSTAT_MINOR);
+	if(cdev_register(cdev) == -1) {
+		print("irqstat: unable to register device\n");
+		return;
+	}
+
+	struct stat *stat = alloc(sizeof(struct stat));
+	stat_init(stat);
+	stat->st_mode = S_IFCHR | S_IRUSR | S_IRGRP | S_IROTH;
+	stat->st_rdev = makedev(IRQSTAT_MAJOR, IRQSTAT_MINOR);
+	vfs_create_node_deep(NULL, NULL, NULL, stat, "/dev/interrupts");
+}
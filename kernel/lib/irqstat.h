@@ -0,0 +1,5 @@
+#pragma once
+
+// interrupts taken per cpu since boot, and how many of them were the tick or a reschedule ipi,
+// readable from /dev/interrupts
+void irqstat_init();
@@ -0,0 +1,80 @@
+#include <lock.h>
+#include <cpu.h>
+
+struct mcs_node {
+	struct mcs_node *next;
+	int locked;
+	int count;
+};
+
+// one cache line of nodes per cpu, the first node also counts how deep this cpu is nested
+static struct mcs_node mcs_nodes[CPUSET_MAX][SPINLOCK_NESTING] __attribute__((aligned(64)));
+
+static inline uint16_t mcs_encode_tail(int cpu, int index) {
+	return ((cpu + 1) << 2) | index;
+}
+
+static inline struct mcs_node *mcs_decode_tail(uint16_t tail) {
+	return &mcs_nodes[(tail >> 2) - 1][tail & 3];
+}
+
+// only ever entered with interrupts off, a waiter must not move to another cpu while its node
+// is queued. spinlock_irqsave guarantees that, spinlock_irqdef callers already run that way
+void spinlock_slowpath(struct spinlock *spinlock) {
+	int cpu = this_cpu_read(cpu_number);
+	struct mcs_node *node = &mcs_nodes[cpu][0];
+	int index = node->count++;
+
+	// out of nodes, nothing to queue on so fall back to spinning on the lock word
+	if(index >= SPINLOCK_NESTING) {
+		while(!raw_spintrylock(spinlock)) {
+			spin_pause();
+		}
+
+		mcs_nodes[cpu][0].count--;
+		return;
+	}
+
+	node += index;
+	node->next = NULL;
+	node->locked = 0;
+
+	uint16_t tail = mcs_encode_tail(cpu, index);
+	uint16_t prev_tail = __atomic_exchange_n(&spinlock->tail, tail, __ATOMIC_ACQ_REL);
+
+	// wait for everyone ahead of us, they hand over the head of the queue one by one
+	if(prev_tail) {
+		struct mcs_node *prev = mcs_decode_tail(prev_tail);
+		__atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+
+		while(!__atomic_load_n(&node->locked, __ATOMIC_ACQUIRE)) {
+			spin_pause();
+		}
+	}
+
+	// head of the queue, only the owner stands between us and the lock
+	uint32_t val;
+	while((val = __atomic_load_n(&spinlock->val, __ATOMIC_ACQUIRE)) & 0xff) {
+		spin_pause();
+	}
+
+	// nobody queued up behind us, take the lock and empty the queue in one go
+	if((val >> SPINLOCK_TAIL_SHIFT) == tail) {
+		if(__atomic_compare_exchange_n(&spinlock->val, &val, SPINLOCK_LOCKED, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			mcs_nodes[cpu][0].count--;
+			return;
+		}
+	}
+
+	// the tail keeps everyone else off the fast path, so a plain store is enough here
+	__atomic_store_n(&spinlock->locked, SPINLOCK_LOCKED, __ATOMIC_RELAXED);
+
+	struct mcs_node *next;
+	while(!(next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE))) {
+		spin_pause();
+	}
+
+	__atomic_store_n(&next->locked, 1, __ATOMIC_RELEASE);
+
+	mcs_nodes[cpu][0].count--;
+}
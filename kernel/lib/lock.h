@@ -1,42 +1,155 @@
 #pragma once
 
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <irqsoff.h>
+
 struct task;
+struct lock_class;
 
+// queued spinlock: the low byte is the lock itself, the high half names the last cpu waiting
+// for it. waiters line up behind each other and each spins on its own per-cpu node, so a
+// release only touches the cache line of whoever is next
 struct spinlock {
-	char lock;
+	union {
+		uint32_t val;
+		struct {
+			uint8_t locked;
+			uint8_t reserved;
+			uint16_t tail;
+		};
+	};
 	bool interrupts;
 };
 
-static inline void raw_spinlock(void *lock) {
-	while(__atomic_test_and_set(lock, __ATOMIC_ACQUIRE));
+#define SPINLOCK_LOCKED 1
+#define SPINLOCK_TAIL_SHIFT 16
+
+// acquisitions that can be nested on one cpu while waiting, task, irq, nmi and a spare
+#define SPINLOCK_NESTING 4
+
+void spinlock_slowpath(struct spinlock *spinlock);
+
+static inline void spin_pause() {
+	asm volatile ("pause" ::: "memory");
+}
+
+#ifdef LOCKSTAT
+
+// every place a lock is taken from is its own class, the numbers are readable from /dev/lock_stat
+struct lock_class {
+	const char *name;
+	uint64_t acquisitions;
+	uint64_t contended;
+	uint64_t wait_total;
+	uint64_t wait_max;
+	bool registered;
+	struct lock_class *next;
+};
+
+#define LOCKSTAT_STR_(x) #x
+#define LOCKSTAT_STR(x) LOCKSTAT_STR_(x)
+
+#define LOCK_CLASS ({ \
+	static struct lock_class lock_class = { .name = __FILE__ ":" LOCKSTAT_STR(__LINE__) }; \
+	&lock_class; \
+})
+
+void lockstat_acquire(struct lock_class *class);
+void lockstat_contended(struct lock_class *class, uint64_t start);
+void lockstat_init();
+
+static inline uint64_t lockstat_clock() {
+	uint32_t low, high;
+	asm volatile ("rdtsc" : "=a"(low), "=d"(high));
+	return ((uint64_t)high << 32) | low;
+}
+
+#else
+
+#define LOCK_CLASS NULL
+
+static inline void lockstat_acquire(struct lock_class *class) {
+	(void)class;
+}
+
+static inline void lockstat_contended(struct lock_class *class, uint64_t start) {
+	(void)class;
+	(void)start;
 }
 
-static inline void raw_spinrelease(void *lock) {
-	__atomic_clear(lock, __ATOMIC_RELEASE);
+static inline uint64_t lockstat_clock() {
+	return 0;
+}
+
+#endif
+
+static inline bool raw_spintrylock(struct spinlock *spinlock) {
+	uint32_t unlocked = 0;
+	return __atomic_compare_exchange_n(&spinlock->val, &unlocked, SPINLOCK_LOCKED, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static inline void raw_spinlock(struct spinlock *spinlock, struct lock_class *class) {
+	if(__builtin_expect(raw_spintrylock(spinlock), 1)) {
+		lockstat_acquire(class);
+		return;
+	}
+
+	uint64_t start = lockstat_clock();
+	spinlock_slowpath(spinlock);
+	lockstat_contended(class, start);
+}
+
+static inline void raw_spinrelease(struct spinlock *spinlock) {
+	__atomic_store_n(&spinlock->locked, 0, __ATOMIC_RELEASE);
 }
 
 bool get_interrupt_state();
 
-static inline void spinlock_irqdef(struct spinlock *spinlock) {
-	raw_spinlock(&spinlock->lock);
+static inline void spinlock_irqdef_class(struct spinlock *spinlock, struct lock_class *class) {
+	raw_spinlock(spinlock, class);
+}
+
+static inline bool spinlock_try_irqdef_class(struct spinlock *spinlock, struct lock_class *class) {
+	if(raw_spintrylock(spinlock)) {
+		lockstat_acquire(class);
+		return true;
+	}
+
+	return false;
 }
 
 static inline void spinrelease_irqdef(struct spinlock *spinlock) {
-	raw_spinrelease(&spinlock->lock);
+	raw_spinrelease(spinlock);
 }
 
-static inline void spinlock_irqsave(struct spinlock *spinlock) {
-	spinlock->interrupts = get_interrupt_state();
+// the saved state belongs to the holder, it may only be written once the lock is ours
+static inline void spinlock_irqsave_class(struct spinlock *spinlock, struct lock_class *class) {
+	bool interrupts = get_interrupt_state();
 	asm volatile ("cli");
-	raw_spinlock(&spinlock->lock);
+
+	if(interrupts) {
+		irqsoff_begin();
+	}
+
+	raw_spinlock(spinlock, class);
+	spinlock->interrupts = interrupts;
 }
 
 static inline void spinrelease_irqsave(struct spinlock *spinlock) {
-	raw_spinrelease(&spinlock->lock);
+	bool interrupts = spinlock->interrupts;
 
-	if(spinlock->interrupts) {
+	raw_spinrelease(spinlock);
+
+	if(interrupts) {
+		irqsoff_end();
 		asm volatile ("sti");
 	} else {
 		asm volatile ("cli");
 	}
 }
+
+#define spinlock_irqdef(spinlock) spinlock_irqdef_class(spinlock, LOCK_CLASS)
+#define spinlock_try_irqdef(spinlock) spinlock_try_irqdef_class(spinlock, LOCK_CLASS)
+#define spinlock_irqsave(spinlock) spinlock_irqsave_class(spinlock, LOCK_CLASS)
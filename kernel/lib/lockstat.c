@@ -0,0 +1,119 @@
+#ifdef LOCKSTAT
+
+#include <lock.h>
+#include <string.h>
+#include <fs/cdev.h>
+#include <fs/vfs.h>
+#include <mm/slab.h>
+#include <lib/cpu.h>
+#include <errno.h>
+#include <debug.h>
+
+#define LOCKSTAT_MAJOR 10
+
+// a class shows up here the first time it is taken and never leaves
+static struct lock_class *lock_class_list;
+
+static void lockstat_register(struct lock_class *class) {
+	if(__atomic_load_n(&class->registered, __ATOMIC_ACQUIRE) || __atomic_exchange_n(&class->registered, true, __ATOMIC_ACQ_REL)) {
+		return;
+	}
+
+	struct lock_class *head = __atomic_load_n(&lock_class_list, __ATOMIC_RELAXED);
+
+	do {
+		class->next = head;
+	} while(!__atomic_compare_exchange_n(&lock_class_list, &head, class, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+void lockstat_acquire(struct lock_class *class) {
+	lockstat_register(class);
+	__atomic_fetch_add(&class->acquisitions, 1, __ATOMIC_RELAXED);
+}
+
+void lockstat_contended(struct lock_class *class, uint64_t start) {
+	uint64_t wait = lockstat_clock() - start;
+
+	lockstat_acquire(class);
+
+	__atomic_fetch_add(&class->contended, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&class->wait_total, wait, __ATOMIC_RELAXED);
+
+	uint64_t max = __atomic_load_n(&class->wait_max, __ATOMIC_RELAXED);
+	while(wait > max && !__atomic_compare_exchange_n(&class->wait_max, &max, wait, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static ssize_t lockstat_read(struct file_handle*, void *buf, size_t cnt, off_t offset) {
+	static const char header[] = "# class acquisitions contended wait-total wait-max (cycles)\n";
+
+	size_t class_cnt = 0;
+	for(struct lock_class *class = __atomic_load_n(&lock_class_list, __ATOMIC_ACQUIRE); class; class = class->next) {
+		class_cnt++;
+	}
+
+	// four 64 bit numbers in decimal and a name that is a source location
+	size_t size = sizeof(header) + class_cnt * (MAX_PATH_LENGTH + 4 * 21 + 8);
+	char *text = alloc(size);
+
+	size_t length = sprint(text, "%s", header);
+
+	struct lock_class *class = __atomic_load_n(&lock_class_list, __ATOMIC_ACQUIRE);
+	for(size_t i = 0; class && i < class_cnt; class = class->next, i++) {
+		length += sprint(text + length, "%s %d %d %d %d\n",
+			class->name,
+			__atomic_load_n(&class->acquisitions, __ATOMIC_RELAXED),
+			__atomic_load_n(&class->contended, __ATOMIC_RELAXED),
+			__atomic_load_n(&class->wait_total, __ATOMIC_RELAXED),
+			__atomic_load_n(&class->wait_max, __ATOMIC_RELAXED)
+		);
+	}
+
+	if(offset >= length) {
+		free(text);
+		return 0;
+	}
+
+	if(offset + cnt > length) {
+		cnt = length - offset;
+	}
+
+	memcpy8(buf, (uint8_t*)text + offset, cnt);
+	free(text);
+
+	return cnt;
+}
+
+// any write starts the counters over, the classes themselves stay
+static ssize_t lockstat_write(struct file_handle*, const void*, size_t cnt, off_t) {
+	for(struct lock_class *class = __atomic_load_n(&lock_class_list, __ATOMIC_ACQUIRE); class; class = class->next) {
+		__atomic_store_n(&class->acquisitions, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&class->contended, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&class->wait_total, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&class->wait_max, 0, __ATOMIC_RELAXED);
+	}
+
+	return cnt;
+}
+
+static struct file_ops lockstat_ops = {
+	.read = lockstat_read,
+	.write = lockstat_write
+};
+
+void lockstat_init() {
+	struct cdev *cdev = alloc(sizeof(struct cdev));
+	cdev->fops = &lockstat_ops;
+	cdev->rdev = makedev(LOCKSTAT_MAJOR, 0);
+	if(cdev_register(cdev) == -1) {
+		print("lockstat: unable to register device\n");
+		return;
+	}
+
+	struct stat *stat = alloc(sizeof(struct stat));
+	stat_init(stat);
+	stat->st_mode = S_IFCHR | S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+	stat->st_rdev = makedev(LOCKSTAT_MAJOR, 0);
+	vfs_create_node_deep(NULL, NULL, NULL, stat, "/dev/lock_stat");
+}
+
+#endif
@@ -0,0 +1,283 @@
+#include <rbtree.h>
+
+#define RB_IS_BLACK(node) ((node) == NULL || (node)->color == RB_BLACK)
+
+static void rb_rotate_left(struct rb_tree *tree, struct rb_node *node) {
+	struct rb_node *pivot = node->right;
+
+	node->right = pivot->left;
+	if(pivot->left) {
+		pivot->left->parent = node;
+	}
+
+	pivot->parent = node->parent;
+
+	if(node->parent == NULL) {
+		tree->root = pivot;
+	} else if(node == node->parent->left) {
+		node->parent->left = pivot;
+	} else {
+		node->parent->right = pivot;
+	}
+
+	pivot->left = node;
+	node->parent = pivot;
+}
+
+static void rb_rotate_right(struct rb_tree *tree, struct rb_node *node) {
+	struct rb_node *pivot = node->left;
+
+	node->left = pivot->right;
+	if(pivot->right) {
+		pivot->right->parent = node;
+	}
+
+	pivot->parent = node->parent;
+
+	if(node->parent == NULL) {
+		tree->root = pivot;
+	} else if(node == node->parent->right) {
+		node->parent->right = pivot;
+	} else {
+		node->parent->left = pivot;
+	}
+
+	pivot->right = node;
+	node->parent = pivot;
+}
+
+static void rb_transplant(struct rb_tree *tree, struct rb_node *old, struct rb_node *new) {
+	if(old->parent == NULL) {
+		tree->root = new;
+	} else if(old == old->parent->left) {
+		old->parent->left = new;
+	} else {
+		old->parent->right = new;
+	}
+
+	if(new) {
+		new->parent = old->parent;
+	}
+}
+
+static struct rb_node *rb_minimum(struct rb_node *node) {
+	while(node->left) {
+		node = node->left;
+	}
+
+	return node;
+}
+
+struct rb_node *rb_tree_next(struct rb_node *node) {
+	if(node->right) {
+		return rb_minimum(node->right);
+	}
+
+	struct rb_node *parent = node->parent;
+
+	while(parent && node == parent->right) {
+		node = parent;
+		parent = parent->parent;
+	}
+
+	return parent;
+}
+
+void rb_tree_insert(struct rb_tree *tree, struct rb_node *node) {
+	struct rb_node **link = &tree->root;
+	struct rb_node *parent = NULL;
+	bool leftmost = true;
+
+	// equal keys go to the right so insertion order is kept among them
+	while(*link) {
+		parent = *link;
+
+		if(node->key < parent->key) {
+			link = &parent->left;
+		} else {
+			link = &parent->right;
+			leftmost = false;
+		}
+	}
+
+	node->parent = parent;
+	node->left = NULL;
+	node->right = NULL;
+	node->color = RB_RED;
+
+	*link = node;
+
+	if(leftmost) {
+		tree->leftmost = node;
+	}
+
+	tree->node_cnt++;
+
+	while(node->parent && node->parent->color == RB_RED) {
+		parent = node->parent;
+		struct rb_node *grandparent = parent->parent;
+
+		if(parent == grandparent->left) {
+			struct rb_node *uncle = grandparent->right;
+
+			if(uncle && uncle->color == RB_RED) {
+				parent->color = RB_BLACK;
+				uncle->color = RB_BLACK;
+				grandparent->color = RB_RED;
+				node = grandparent;
+				continue;
+			}
+
+			if(node == parent->right) {
+				rb_rotate_left(tree, parent);
+				node = parent;
+				parent = node->parent;
+			}
+
+			parent->color = RB_BLACK;
+			grandparent->color = RB_RED;
+			rb_rotate_right(tree, grandparent);
+		} else {
+			struct rb_node *uncle = grandparent->left;
+
+			if(uncle && uncle->color == RB_RED) {
+				parent->color = RB_BLACK;
+				uncle->color = RB_BLACK;
+				grandparent->color = RB_RED;
+				node = grandparent;
+				continue;
+			}
+
+			if(node == parent->left) {
+				rb_rotate_right(tree, parent);
+				node = parent;
+				parent = node->parent;
+			}
+
+			parent->color = RB_BLACK;
+			grandparent->color = RB_RED;
+			rb_rotate_left(tree, grandparent);
+		}
+	}
+
+	tree->root->color = RB_BLACK;
+}
+
+static void rb_delete_fixup(struct rb_tree *tree, struct rb_node *node, struct rb_node *parent) {
+	while(node != tree->root && RB_IS_BLACK(node)) {
+		if(node == parent->left) {
+			struct rb_node *sibling = parent->right;
+
+			if(sibling->color == RB_RED) {
+				sibling->color = RB_BLACK;
+				parent->color = RB_RED;
+				rb_rotate_left(tree, parent);
+				sibling = parent->right;
+			}
+
+			if(RB_IS_BLACK(sibling->left) && RB_IS_BLACK(sibling->right)) {
+				sibling->color = RB_RED;
+				node = parent;
+				parent = node->parent;
+				continue;
+			}
+
+			if(RB_IS_BLACK(sibling->right)) {
+				sibling->left->color = RB_BLACK;
+				sibling->color = RB_RED;
+				rb_rotate_right(tree, sibling);
+				sibling = parent->right;
+			}
+
+			sibling->color = parent->color;
+			parent->color = RB_BLACK;
+			sibling->right->color = RB_BLACK;
+			rb_rotate_left(tree, parent);
+
+			node = tree->root;
+		} else {
+			struct rb_node *sibling = parent->left;
+
+			if(sibling->color == RB_RED) {
+				sibling->color = RB_BLACK;
+				parent->color = RB_RED;
+				rb_rotate_right(tree, parent);
+				sibling = parent->left;
+			}
+
+			if(RB_IS_BLACK(sibling->left) && RB_IS_BLACK(sibling->right)) {
+				sibling->color = RB_RED;
+				node = parent;
+				parent = node->parent;
+				continue;
+			}
+
+			if(RB_IS_BLACK(sibling->left)) {
+				sibling->right->color = RB_BLACK;
+				sibling->color = RB_RED;
+				rb_rotate_left(tree, sibling);
+				sibling = parent->left;
+			}
+
+			sibling->color = parent->color;
+			parent->color = RB_BLACK;
+			sibling->left->color = RB_BLACK;
+			rb_rotate_right(tree, parent);
+
+			node = tree->root;
+		}
+	}
+
+	if(node) {
+		node->color = RB_BLACK;
+	}
+}
+
+void rb_tree_delete(struct rb_tree *tree, struct rb_node *node) {
+	if(tree->leftmost == node) {
+		tree->leftmost = rb_tree_next(node);
+	}
+
+	struct rb_node *child;
+	struct rb_node *parent;
+	int removed_color = node->color;
+
+	if(node->left == NULL) {
+		child = node->right;
+		parent = node->parent;
+		rb_transplant(tree, node, node->right);
+	} else if(node->right == NULL) {
+		child = node->left;
+		parent = node->parent;
+		rb_transplant(tree, node, node->left);
+	} else {
+		struct rb_node *successor = rb_minimum(node->right);
+
+		removed_color = successor->color;
+		child = successor->right;
+
+		if(successor->parent == node) {
+			parent = successor;
+		} else {
+			parent = successor->parent;
+			rb_transplant(tree, successor, successor->right);
+			successor->right = node->right;
+			successor->right->parent = successor;
+		}
+
+		rb_transplant(tree, node, successor);
+		successor->left = node->left;
+		successor->left->parent = successor;
+		successor->color = node->color;
+	}
+
+	if(removed_color == RB_BLACK) {
+		rb_delete_fixup(tree, child, parent);
+	}
+
+	node->left = NULL;
+	node->right = NULL;
+	node->parent = NULL;
+
+	tree->node_cnt--;
+}
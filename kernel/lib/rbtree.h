@@ -0,0 +1,31 @@
+#pragma once
+
+#include <types.h>
+
+#define RB_RED 0
+#define RB_BLACK 1
+
+struct rb_node {
+	uint64_t key;
+	void *data;
+
+	int color;
+
+	struct rb_node *left;
+	struct rb_node *right;
+	struct rb_node *parent;
+};
+
+struct rb_tree {
+	struct rb_node *root;
+	struct rb_node *leftmost;
+	size_t node_cnt;
+};
+
+void rb_tree_insert(struct rb_tree *tree, struct rb_node *node);
+void rb_tree_delete(struct rb_tree *tree, struct rb_node *node);
+struct rb_node *rb_tree_next(struct rb_node *node);
+
+static inline struct rb_node *rb_tree_first(struct rb_tree *tree) {
+	return tree->leftmost;
+}
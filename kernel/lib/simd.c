@@ -0,0 +1,243 @@
+#include <simd.h>
+#include <sched/fpu.h>
+#include <string.h>
+#include <debug.h>
+#include <cpu.h>
+
+// the kernel is built without vector registers, so the compiler never keeps anything in them
+// across these sections and they do not need to be listed as clobbers
+
+static void copy_page_scalar(void *dest, const void *src) {
+	memcpy64(dest, src, PAGE_SIZE / 8);
+}
+
+static void clear_page_scalar(void *dest) {
+	memset64(dest, 0, PAGE_SIZE / 8);
+}
+
+static void memcpy_bulk_scalar(void *dest, const void *src, size_t n) {
+	memcpy8(dest, src, n);
+}
+
+static void copy_page_sse2(void *dest, const void *src) {
+	if(!kernel_fpu_usable()) {
+		return copy_page_scalar(dest, src);
+	}
+
+	size_t cnt = PAGE_SIZE / 64;
+
+	kernel_fpu_begin();
+
+	asm volatile (
+		"1:\n\t"
+		"movdqa (%1), %%xmm0\n\t"
+		"movdqa 16(%1), %%xmm1\n\t"
+		"movdqa 32(%1), %%xmm2\n\t"
+		"movdqa 48(%1), %%xmm3\n\t"
+		"movdqa %%xmm0, (%0)\n\t"
+		"movdqa %%xmm1, 16(%0)\n\t"
+		"movdqa %%xmm2, 32(%0)\n\t"
+		"movdqa %%xmm3, 48(%0)\n\t"
+		"add $64, %0\n\t"
+		"add $64, %1\n\t"
+		"dec %2\n\t"
+		"jnz 1b\n\t"
+		: "+r"(dest), "+r"(src), "+r"(cnt) :: "memory"
+	);
+
+	kernel_fpu_end();
+}
+
+// freshly zeroed pages are rarely read back right away, stream them past the cache
+static void clear_page_sse2(void *dest) {
+	if(!kernel_fpu_usable()) {
+		return clear_page_scalar(dest);
+	}
+
+	size_t cnt = PAGE_SIZE / 64;
+
+	kernel_fpu_begin();
+
+	asm volatile (
+		"pxor %%xmm0, %%xmm0\n\t"
+		"1:\n\t"
+		"movntdq %%xmm0, (%0)\n\t"
+		"movntdq %%xmm0, 16(%0)\n\t"
+		"movntdq %%xmm0, 32(%0)\n\t"
+		"movntdq %%xmm0, 48(%0)\n\t"
+		"add $64, %0\n\t"
+		"dec %1\n\t"
+		"jnz 1b\n\t"
+		"sfence\n\t"
+		: "+r"(dest), "+r"(cnt) :: "memory"
+	);
+
+	kernel_fpu_end();
+}
+
+static void memcpy_bulk_sse2(void *dest, const void *src, size_t n) {
+	if(n < SIMD_BULK_MIN || !kernel_fpu_usable()) {
+		return memcpy_bulk_scalar(dest, src, n);
+	}
+
+	size_t cnt = n / 64;
+	size_t tail = n % 64;
+
+	kernel_fpu_begin();
+
+	asm volatile (
+		"1:\n\t"
+		"movdqu (%1), %%xmm0\n\t"
+		"movdqu 16(%1), %%xmm1\n\t"
+		"movdqu 32(%1), %%xmm2\n\t"
+		"movdqu 48(%1), %%xmm3\n\t"
+		"movdqu %%xmm0, (%0)\n\t"
+		"movdqu %%xmm1, 16(%0)\n\t"
+		"movdqu %%xmm2, 32(%0)\n\t"
+		"movdqu %%xmm3, 48(%0)\n\t"
+		"add $64, %0\n\t"
+		"add $64, %1\n\t"
+		"dec %2\n\t"
+		"jnz 1b\n\t"
+		: "+r"(dest), "+r"(src), "+r"(cnt) :: "memory"
+	);
+
+	kernel_fpu_end();
+
+	memcpy8(dest, src, tail);
+}
+
+static void copy_page_avx2(void *dest, const void *src) {
+	if(!kernel_fpu_usable()) {
+		return copy_page_scalar(dest, src);
+	}
+
+	size_t cnt = PAGE_SIZE / 128;
+
+	kernel_fpu_begin();
+
+	asm volatile (
+		"1:\n\t"
+		"vmovdqa (%1), %%ymm0\n\t"
+		"vmovdqa 32(%1), %%ymm1\n\t"
+		"vmovdqa 64(%1), %%ymm2\n\t"
+		"vmovdqa 96(%1), %%ymm3\n\t"
+		"vmovdqa %%ymm0, (%0)\n\t"
+		"vmovdqa %%ymm1, 32(%0)\n\t"
+		"vmovdqa %%ymm2, 64(%0)\n\t"
+		"vmovdqa %%ymm3, 96(%0)\n\t"
+		"add $128, %0\n\t"
+		"add $128, %1\n\t"
+		"dec %2\n\t"
+		"jnz 1b\n\t"
+		"vzeroupper\n\t"
+		: "+r"(dest), "+r"(src), "+r"(cnt) :: "memory"
+	);
+
+	kernel_fpu_end();
+}
+
+static void clear_page_avx2(void *dest) {
+	if(!kernel_fpu_usable()) {
+		return clear_page_scalar(dest);
+	}
+
+	size_t cnt = PAGE_SIZE / 128;
+
+	kernel_fpu_begin();
+
+	asm volatile (
+		"vpxor %%ymm0, %%ymm0, %%ymm0\n\t"
+		"1:\n\t"
+		"vmovntdq %%ymm0, (%0)\n\t"
+		"vmovntdq %%ymm0, 32(%0)\n\t"
+		"vmovntdq %%ymm0, 64(%0)\n\t"
+		"vmovntdq %%ymm0, 96(%0)\n\t"
+		"add $128, %0\n\t"
+		"dec %1\n\t"
+		"jnz 1b\n\t"
+		"sfence\n\t"
+		"vzeroupper\n\t"
+		: "+r"(dest), "+r"(cnt) :: "memory"
+	);
+
+	kernel_fpu_end();
+}
+
+static void memcpy_bulk_avx2(void *dest, const void *src, size_t n) {
+	if(n < SIMD_BULK_MIN || !kernel_fpu_usable()) {
+		return memcpy_bulk_scalar(dest, src, n);
+	}
+
+	size_t cnt = n / 128;
+	size_t tail = n % 128;
+
+	kernel_fpu_begin();
+
+	asm volatile (
+		"1:\n\t"
+		"vmovdqu (%1), %%ymm0\n\t"
+		"vmovdqu 32(%1), %%ymm1\n\t"
+		"vmovdqu 64(%1), %%ymm2\n\t"
+		"vmovdqu 96(%1), %%ymm3\n\t"
+		"vmovdqu %%ymm0, (%0)\n\t"
+		"vmovdqu %%ymm1, 32(%0)\n\t"
+		"vmovdqu %%ymm2, 64(%0)\n\t"
+		"vmovdqu %%ymm3, 96(%0)\n\t"
+		"add $128, %0\n\t"
+		"add $128, %1\n\t"
+		"dec %2\n\t"
+		"jnz 1b\n\t"
+		"vzeroupper\n\t"
+		: "+r"(dest), "+r"(src), "+r"(cnt) :: "memory"
+	);
+
+	kernel_fpu_end();
+
+	memcpy8(dest, src, tail);
+}
+
+void (*copy_page)(void *dest, const void *src) = copy_page_scalar;
+void (*clear_page)(void *dest) = clear_page_scalar;
+void (*memcpy_bulk)(void *dest, const void *src, size_t n) = memcpy_bulk_scalar;
+
+// a fault inside a kernel fpu section could end up sleeping on a disk, so every source page is
+// touched before the copy out of it starts
+void memcpy_user_bulk(void *dest, const void *src, size_t n) {
+	while(n) {
+		size_t chunk = PAGE_SIZE - ((uintptr_t)src & (PAGE_SIZE - 1));
+		if(chunk > n) {
+			chunk = n;
+		}
+
+		(void)*(volatile const uint8_t*)src;
+
+		memcpy_bulk(dest, src, chunk);
+
+		dest = (uint8_t*)dest + chunk;
+		src = (const uint8_t*)src + chunk;
+		n -= chunk;
+	}
+}
+
+void simd_init() {
+	struct cpuid_state cpuid_state = cpuid(7, 0);
+
+	if((cpuid_state.rbx & (1 << 5)) && (fpu_xfeatures & XFEATURE_AVX)) {
+		copy_page = copy_page_avx2;
+		clear_page = clear_page_avx2;
+		memcpy_bulk = memcpy_bulk_avx2;
+
+		print("simd: using avx2 page and bulk copies\n");
+		return;
+	}
+
+	// part of the x86_64 baseline, the check is only there to document the requirement
+	if(cpuid(1, 0).rdx & (1 << 26)) {
+		copy_page = copy_page_sse2;
+		clear_page = clear_page_sse2;
+		memcpy_bulk = memcpy_bulk_sse2;
+
+		print("simd: using sse2 page and bulk copies\n");
+	}
+}
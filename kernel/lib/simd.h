@@ -0,0 +1,13 @@
+#pragma once
+
+#include <types.h>
+
+// below this the cost of entering a kernel fpu section outweighs the wider copies
+#define SIMD_BULK_MIN 512
+
+extern void (*copy_page)(void *dest, const void *src);
+extern void (*clear_page)(void *dest);
+extern void (*memcpy_bulk)(void *dest, const void *src, size_t n);
+
+void memcpy_user_bulk(void *dest, const void *src, size_t n);
+void simd_init();
@@ -2,17 +2,54 @@
 
 #include <types.h>
 #include <vector.h>
+#include <lock.h>
 
 #define TIMER_HZ 1000000000
 
+#define CLOCK_REALTIME 0
+#define CLOCK_MONOTONIC 1
+#define CLOCK_MONOTONIC_RAW 4
+#define CLOCK_REALTIME_COARSE 5
+#define CLOCK_MONOTONIC_COARSE 6
+#define CLOCK_BOOTTIME 7
+
+#define TIMER_ABSTIME 1
+
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SIZE (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SIZE - 1)
+#define TIMER_WHEEL_SHIFT 20 // a wheel tick is 2^20ns, roughly a millisecond
+#define TIMER_WHEEL_RANGE (1ull << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS))
+
 struct waitq_trigger;
+struct timer_wheel;
 
 struct timer {
-	struct timespec timespec;
+	uint64_t deadline;
 	VECTOR(struct waitq_trigger*) triggers;
+
+	// runs from the timer interrupt on the owning cpu, after the triggers
+	void (*callback)(struct timer *timer);
+
+	struct timer_wheel *wheel;
+	struct timer *next;
+	struct timer *prev;
+	int level;
+	int index;
+	bool pending;
 };
 
-extern VECTOR(struct timer*) timer_list;
+struct timer_wheel {
+	struct spinlock lock;
+
+	uint64_t clk;
+	size_t pending;
+	struct timer *running;
+
+	uint64_t occupied[TIMER_WHEEL_LEVELS];
+	struct timer *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SIZE];
+};
 
 extern struct timespec clock_realtime;
 extern struct timespec clock_monotonic;
@@ -20,3 +57,20 @@ extern struct timespec clock_monotonic;
 struct timespec timespec_add(struct timespec a, struct timespec b);
 struct timespec timespec_sub(struct timespec a, struct timespec b);
 struct timespec timespec_convert_ms(int ms);
+struct timespec timespec_convert_ns(uint64_t ns);
+uint64_t timespec_to_ns(struct timespec timespec);
+
+uint64_t clock_monotonic_ns();
+uint64_t clock_realtime_ns();
+void clock_update();
+int clock_gettime(clockid_t clockid, struct timespec *timespec);
+int clock_getres(clockid_t clockid, struct timespec *timespec);
+
+void timer_add(struct timer *timer);
+bool timer_cancel(struct timer *timer);
+uint64_t timer_next_deadline();
+void timer_run_expired();
+
+int sleep_until(uint64_t deadline);
+void msleep(size_t ms);
+void usleep(size_t us);
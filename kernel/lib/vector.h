@@ -74,5 +74,6 @@ _ret: \
 
 #define VECTOR_CLEAR(THIS) \
 	free((THIS).data); \
+	(THIS).data = NULL; \
 	(THIS).length = 0; \
 	(THIS).buffer_capacity = 0;
@@ -10,8 +10,14 @@
 #include <int/idt.h>
 #include <sched/smp.h>
 #include <sched/ehfi.h>
+#include <sched/vdso.h>
+#include <sched/rcu.h>
+#include <sched/kthread.h>
+#include <sched/workqueue.h>
+#include <sched/softirq.h>
 #include <acpi/rsdp.h>
 #include <drivers/hpet.h>
+#include <drivers/clocksource.h>
 #include <drivers/pci.h>
 #include <drivers/pit.h>
 #include <drivers/iommu/intel/vtd.h>
@@ -22,9 +28,11 @@
 #include <sched/sched.h>
 #include <time.h>
 #include <hash.h>
+#include <simd.h>
 #include <drivers/tty/self_tty.h>
 #include <drivers/tty/pty.h>
 #include <drivers/keyboard.h>
+#include <irqstat.h>
 
 static volatile struct limine_stack_size_request limine_stack_size_request = {
 	.id = LIMINE_STACK_SIZE_REQUEST,
@@ -52,6 +60,9 @@ static volatile struct limine_kernel_file_request limine_kernel_file_request = {
 	.revision = 0
 };
 
+// stands in for the real cpu_local until boot_aps, a NULL self makes CORE_LOCAL read as NULL
+static struct cpu_local boot_cpu_local;
+
 static ssize_t kernel_file_read(struct elf_file*, void *buffer, off_t offset, size_t cnt) {
 	struct limine_file *file = limine_kernel_file_request.response->kernel_file;
 
@@ -100,8 +111,8 @@ void init_process() {
 
 	VECTOR_PUSH(task->group->process_list, task);
 
-	task->sched_status = TASK_WAITING;
 	task->signal_queue.active = true;
+	sched_requeue(task);
 
 	sched_dequeue(CURRENT_TASK);
 
@@ -112,6 +123,14 @@ void init_process() {
 void pastoral_thread() {
 	print("Greetings from pastorals kernel thread\n");
 
+	// everything below may already hand work off to the per cpu workers
+	kthread_init();
+	workqueue_init();
+	softirq_init();
+
+	// probed from a task so drivers can sleep on the timer wheel instead of spinning
+	pci_init();
+
 	if(initramfs() == -1) {
 		panic("initramfs: unable to initialise");
 	}
@@ -120,6 +139,20 @@ void pastoral_thread() {
 	self_tty_init();
 	pty_init();
 
+	irqstat_init();
+
+#ifdef LOCKSTAT
+	lockstat_init();
+#endif
+
+#ifdef RCU_BENCHMARK
+	rcu_bench_init();
+#endif
+
+#ifdef IRQSOFF_TRACE
+	irqsoff_init();
+#endif
+
 	struct limine_framebuffer **framebuffers = limine_framebuffer_request.response->framebuffers;
 	uint64_t framebuffer_count = limine_framebuffer_request.response->framebuffer_count;
 
@@ -147,11 +180,14 @@ void pastoral_thread() {
 }
 
 void pastoral_entry(void) {
+	wrmsr(MSR_GS_BASE, (uintptr_t)&boot_cpu_local);
+
 	HIGH_VMA = limine_hhdm_request.response->offset;
 
 	print("Pastoral unleashes the real power of the cpu\n");
 
 	init_cpu_features();
+	simd_init();
 
 	pmm_init();
 
@@ -191,12 +227,14 @@ void pastoral_entry(void) {
 	vfs_init();
 
 	hpet_init();
+	clocksource_init();
 	apic_init();
 	boot_aps();
-	pci_init();
+	smp_isolate_cpus(limine_kernel_file_request.response->kernel_file->cmdline);
 	pit_init();
+	vdso_init();
 
-	apic_timer_init(20);
+	apic_timer_init();
 
 	struct pid_namespace *namespace = sched_default_namespace();
 	struct task *kernel_task = alloc(sizeof(struct task));
@@ -214,7 +252,7 @@ void pastoral_entry(void) {
 
 	task_create_session(kernel_task, true);
 
-	kernel_task->sched_status = TASK_WAITING;
+	sched_requeue(kernel_task);
 
 	asm ("sti");
 
@@ -162,7 +162,7 @@ static int mmap_private_pages(struct page_table *page_table, uintptr_t vaddr, in
 	return 0;
 }
 
-void *mmap(struct page_table *page_table, void *addr, size_t length, int prot, int flags, int fd, off_t offset) {
+static void *mmap_map_region(struct page_table *page_table, void *addr, size_t length, int prot, int flags, int fd, off_t offset) {
 	uint64_t base = 0;
 
 	length = ALIGN_UP(length, PAGE_SIZE);
@@ -253,6 +253,14 @@ void *mmap(struct page_table *page_table, void *addr, size_t length, int prot, i
 	return (void*)base;
 }
 
+void *mmap(struct page_table *page_table, void *addr, size_t length, int prot, int flags, int fd, off_t offset) {
+	rwsem_write_lock(&page_table->mmap_lock);
+	void *ret = mmap_map_region(page_table, addr, length, prot, flags, fd, offset);
+	rwsem_write_unlock(&page_table->mmap_lock);
+
+	return ret;
+}
+
 
 // TODO: decrease reference count on the mmaped file
 int munmap(struct page_table *page_table, void *addr, size_t length) {
@@ -268,14 +276,22 @@ int munmap(struct page_table *page_table, void *addr, size_t length) {
 		return -1;
 	}
 
+	rwsem_write_lock(&page_table->mmap_lock);
+
 	struct mmap_region *region = mmap_search_region(page_table, base);
 
 	if(region == NULL) {
+		rwsem_write_unlock(&page_table->mmap_lock);
 		return 0;
 	}
 
+	// whatever lies past this region is unmapped once we are done with it
+	uint64_t rest_base = 0;
+	size_t rest_length = 0;
+
 	if(length > region->limit) {
-		munmap(page_table, (void*)(base + region->limit), length - region->limit);
+		rest_base = base + region->limit;
+		rest_length = length - region->limit;
 		length = region->limit;
 	}
 
@@ -312,6 +328,9 @@ int munmap(struct page_table *page_table, void *addr, size_t length) {
 	BST_GENERIC_INSERT(page_table->mmap_region_root, base, lower_split);
 	BST_GENERIC_INSERT(page_table->mmap_region_root, base, upper_split);
 
+	// the write back below goes through the file, which must not nest inside the region lock
+	rwsem_write_unlock(&page_table->mmap_lock);
+
 	for(size_t i = 0; i < region->limit / PAGE_SIZE; i++) {
 		struct page *page = hash_table_search(CURRENT_TASK->page_table->pages, &base, sizeof(base));
 
@@ -335,6 +354,10 @@ int munmap(struct page_table *page_table, void *addr, size_t length) {
 		base += PAGE_SIZE;
 	}
 
+	if(rest_length) {
+		munmap(page_table, (void*)rest_base, rest_length);
+	}
+
 	return 0;
 }
 
@@ -353,7 +376,7 @@ extern void syscall_mmap(struct registers *regs) {
 	off_t offset = regs->r9;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] mmap: addr {%x}, length {%x}, prot {%x}, flags {%x}, fd {%x}, offset {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, (uintptr_t)addr, length, prot, flags, fd, offset);
+	print("syscall: [pid %x, tid %x] mmap: addr {%x}, length {%x}, prot {%x}, flags {%x}, fd {%x}, offset {%x}\n", this_cpu_read(pid), this_cpu_read(tid), (uintptr_t)addr, length, prot, flags, fd, offset);
 #endif
 
 	regs->rax = (uint64_t)mmap(page_table, addr, length, prot | MMAP_PROT_USER, flags, fd, offset);
@@ -370,7 +393,7 @@ extern void syscall_munmap(struct registers *regs) {
 	size_t length = regs->rsi;
 
 #ifndef SYSCALL_DBEUG
-	print("syscall: [pid %x, tid %x] munmap: addr {%x}, length {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, (uintptr_t)addr, length);
+	print("syscall: [pid %x, tid %x] munmap: addr {%x}, length {%x}\n", this_cpu_read(pid), this_cpu_read(tid), (uintptr_t)addr, length);
 #endif
 
 	regs->rax = munmap(page_table, addr, length);
@@ -3,6 +3,7 @@
 #include <stddef.h>
 #include <cpu.h>
 #include <string.h>
+#include <simd.h>
 #include <limine.h>
 #include <lock.h>
 
@@ -91,6 +92,11 @@ static void pmm_module_free(struct pmm_module *module, uint64_t base, uint64_t c
 		BIT_CLEAR(module->bitmap, i);
 	}
 
+	// allocations only search upwards from last_free, point it at what was just given back
+	if(DIV_ROUNDUP(base, PAGE_SIZE) < module->last_free) {
+		module->last_free = DIV_ROUNDUP(base, PAGE_SIZE);
+	}
+
 	spinrelease_irqsave(&module->lock);
 }
 
@@ -172,7 +178,9 @@ uint64_t pmm_alloc(uint64_t cnt, uint64_t align) {
 			continue;
 		}
 
-		memset64((void*)(alloc + HIGH_VMA), 0, (cnt * PAGE_SIZE) / 8);
+		for(size_t i = 0; i < cnt; i++) {
+			clear_page((void*)(alloc + HIGH_VMA + i * PAGE_SIZE));
+		}
 
 		return alloc;
 	} while(module);
@@ -180,14 +188,57 @@ uint64_t pmm_alloc(uint64_t cnt, uint64_t align) {
 	return -1;
 }
 
-void pmm_free(uint64_t base, uint64_t cnt) {
-	struct pmm_module *module = root_module;
+static bool pmm_module_holds(struct pmm_module *module, uint64_t base, uint64_t cnt) {
+	struct limine_memmap_entry *mmap = module->mmap_entry;
+	return base >= mmap->base && (base + cnt * PAGE_SIZE) <= (mmap->base + module->bitmap_entry_cnt * PAGE_SIZE);
+}
 
-	do {
-		struct limine_memmap_entry *mmap = module->mmap_entry;
-		if(base >= mmap->base && (mmap->base + cnt * PAGE_SIZE) <= (mmap->base + module->bitmap_entry_cnt * PAGE_SIZE)) {
-			return pmm_module_free(module, base - mmap->base, cnt);
+static struct pmm_module *pmm_find_module(uint64_t base, uint64_t cnt) {
+	for(struct pmm_module *module = root_module; module; module = module->next) {
+		if(pmm_module_holds(module, base, cnt)) {
+			return module;
 		}
-		module = module->next;
-	} while(module);
+	}
+
+	return NULL;
+}
+
+void pmm_free(uint64_t base, uint64_t cnt) {
+	struct pmm_module *module = pmm_find_module(base, cnt);
+
+	if(module) {
+		pmm_module_free(module, base - module->mmap_entry->base, cnt);
+	}
+}
+
+void pmm_batch_flush(struct pmm_batch *batch) {
+	if(batch->cnt && batch->module) {
+		pmm_module_free(batch->module, batch->base - batch->module->mmap_entry->base, batch->cnt);
+		batch->freed += batch->cnt;
+	}
+
+	batch->module = NULL;
+	batch->base = 0;
+	batch->cnt = 0;
+}
+
+// one module lookup and one lock round trip per run instead of per frame. frames that are
+// adjacent but sit on either side of a module boundary start a new run
+void pmm_batch_add(struct pmm_batch *batch, uint64_t base, uint64_t cnt) {
+	if(batch->module && base == batch->base + batch->cnt * PAGE_SIZE && pmm_module_holds(batch->module, batch->base, batch->cnt + cnt)) {
+		batch->cnt += cnt;
+		return;
+	}
+
+	if(batch->module && base + cnt * PAGE_SIZE == batch->base && pmm_module_holds(batch->module, base, batch->cnt + cnt)) {
+		batch->base = base;
+		batch->cnt += cnt;
+		return;
+	}
+
+	pmm_batch_flush(batch);
+
+	batch->module = pmm_find_module(base, cnt);
+	batch->base = base;
+	batch->cnt = cnt;
 }
@@ -2,8 +2,21 @@
 
 #include <limine.h>
 
+struct pmm_module;
+
+// consecutive frees of adjacent frames are collected into one run and handed back together,
+// a run never crosses into another module
+struct pmm_batch {
+	struct pmm_module *module;
+	uint64_t base;
+	uint64_t cnt;
+	uint64_t freed;
+};
+
 void pmm_init();
 uint64_t pmm_alloc(uint64_t cnt, uint64_t align);
 void pmm_free(uint64_t base, uint64_t cnt);
+void pmm_batch_add(struct pmm_batch *batch, uint64_t base, uint64_t cnt);
+void pmm_batch_flush(struct pmm_batch *batch);
 
 extern volatile struct limine_memmap_request limine_memmap_request;
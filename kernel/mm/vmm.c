@@ -2,7 +2,9 @@
 #include <mm/pmm.h>
 #include <cpu.h>
 #include <string.h>
+#include <simd.h>
 #include <sched/sched.h>
+#include <sched/vdso.h>
 #include <mm/mmap.h>
 #include <debug.h>
 #include <limine.h>
@@ -364,6 +366,7 @@ void vmm_default_table(struct page_table *page_table) {
 	}
 
 	page_table->mmap_bump_base = MMAP_MAP_MIN_ADDR;
+	page_table->refcnt = 1;
 }
 
 struct mmap_region *vmm_copy_region_tree(struct mmap_region *root) {
@@ -413,85 +416,130 @@ struct page_table *vmm_fork_page_table(struct page_table *page_table) {
 	asm volatile ("mov %%cr3, %0" : "=a"(cr3));
 	asm volatile ("mov %0, %%cr3" :: "r"(cr3) : "memory");
 
+	rwsem_read_lock(&page_table->mmap_lock);
 	new_table->mmap_region_root = vmm_copy_region_tree(page_table->mmap_region_root);
+	rwsem_read_unlock(&page_table->mmap_lock);
+
+	if(page_table->vdso_base) {
+		vdso_map(new_table, page_table->vdso_base);
+	}
 
 	return new_table;
 }
 
-int vmm_file_map(struct page_table *page_table, uintptr_t address) {
-	struct mmap_region *root = page_table->mmap_region_root;
+static void vmm_free_region_tree(struct mmap_region *root) {
 	if(root == NULL) {
-		return -1;
+		return;
 	}
 
-	uint64_t faulting_page = address & ~(0xfff);
-	uint64_t *lowest_level = page_table->lowest_level(page_table, faulting_page);
+	vmm_free_region_tree(root->left);
+	vmm_free_region_tree(root->right);
 
-	while(root) {
-		if(root->base <= address && (root->base + root->limit) >= address) {
-			struct page *page = hash_table_search(page_table->pages, &faulting_page, sizeof(faulting_page));
-			if(page == NULL) {
-				return -1;
-			}
+	free(root);
+}
 
-			invlpg(address);
+// drops this table's hold on a page, its frame only goes once no other table maps it
+static void vmm_release_page(struct page *page, struct pmm_batch *batch) {
+	if(page->flags & VMM_SHARE_FLAG) {
+		(*page->reference)--;
 
-			int ret = page->file->ops->read(page->file, (void*)(page->frame->addr + HIGH_VMA), PAGE_SIZE, page->offset) == -1 ? 0 : 1;
-			if(ret) {
-				*lowest_level = *lowest_level | VMM_FLAGS_P;
-			}
+		// only the first mapping of a file page carries the file, the shared pages of the node
+		// point at that one, so it stays around until the last mapping is gone
+		if(page->file == NULL) {
+			free(page);
+			return;
+		}
 
-			return 0;
+		if(*page->reference > 0) {
+			return;
 		}
 
-		if(root->base > address) {
-			root = root->left;
-		} else {
-			root = root->right;
+		hash_table_delete(&page->file->vfs_node->shared_pages, &page->offset, sizeof(page->offset));
+
+		if(page->file->ops->shared == NULL) {
+			page->file->ops->write(page->file, (void*)(page->frame->addr + HIGH_VMA), PAGE_SIZE, page->offset);
+			pmm_batch_add(batch, page->frame->addr, 1);
 		}
+
+		free(page->frame);
+		free(page->reference);
+		free(page);
+
+		return;
 	}
 
-	return -1;
+	// a forked copy still points at the same frame until one side faults it away
+	if((*page->reference) <= 1) {
+		pmm_batch_add(batch, page->frame->addr, 1);
+		free(page->frame);
+		free(page->reference);
+	} else {
+		(*page->reference)--;
+	}
+
+	free(page);
 }
 
-int vmm_anon_map(struct page_table *page_table, uintptr_t address) {
-	struct mmap_region *root = page_table->mmap_region_root;
-	if(root == NULL) {
-		return -1;
+// every table below the top belongs to this page table alone, the kernel half included. leaves
+// are left to the page metadata since the walk can not tell a vdso or device frame from our own
+static void vmm_free_tables(uint64_t *table, int level, struct pmm_batch *batch) {
+	if(level > 1) {
+		for(size_t i = 0; i < 512; i++) {
+			uint64_t entry = table[i];
+
+			// map_page copies the leaf flags into new tables, so one can be there without the present bit
+			uint64_t paddr = entry & ~(0xfff) & ~(VMM_FLAGS_NX);
+			if(paddr == 0 || (level == 2 && (entry & VMM_FLAGS_PS))) {
+				continue;
+			}
+
+			vmm_free_tables((uint64_t*)(paddr + HIGH_VMA), level - 1, batch);
+		}
 	}
 
-	while(root) {
-		if(root->base <= address && (root->base + root->limit) >= address) {
-			uint64_t flags = VMM_FLAGS_P | VMM_FLAGS_NX;
+	pmm_batch_add(batch, (uintptr_t)table - HIGH_VMA, 1);
+}
 
-			if(root->prot & MMAP_PROT_WRITE) flags |= VMM_FLAGS_RW;
-			if(root->prot & MMAP_PROT_USER) flags |= VMM_FLAGS_US;
-			if(root->prot & MMAP_PROT_EXEC) flags &= ~(VMM_FLAGS_NX);
-			if(root->prot & MMAP_PROT_NONE) flags &= ~(VMM_FLAGS_P);
+// must not be the loaded table on any cpu. the frames are added to the batch, flushing it is up
+// to the caller so whatever else it frees can join the same runs
+void vmm_destroy_page_table(struct page_table *page_table, struct pmm_batch *batch) {
+	struct hash_table *pages = page_table->pages;
 
-			size_t misalignment = address & (PAGE_SIZE - 1);
+	for(size_t i = 0; i < pages->capacity; i++) {
+		struct page *page = pages->data[i];
 
-			struct frame *frame = alloc(sizeof(struct frame));
-			frame->addr = pmm_alloc(1, 1);
+		if(page) {
+			vmm_release_page(page, batch);
+		}
+	}
 
-			uint64_t vaddr = address - misalignment;
+	if(pages->capacity) {
+		pmm_batch_add(batch, (uintptr_t)pages->keys - HIGH_VMA, DIV_ROUNDUP(pages->capacity * sizeof(void*), PAGE_SIZE));
+		pmm_batch_add(batch, (uintptr_t)pages->data - HIGH_VMA, DIV_ROUNDUP(pages->capacity * sizeof(void*), PAGE_SIZE));
+	}
 
-			invlpg(address);
+	free(pages);
 
-			struct page *new_page = alloc(sizeof(struct page));
-			*new_page = (struct page) {
-				.vaddr = vaddr,
-				.frame = frame,
-				.size = PAGE_SIZE,
-				.flags = flags,
-				.pml_entry = page_table->map_page(page_table, vaddr, frame->addr, flags),
-				.reference = alloc(sizeof(int))
-			};
+	vmm_free_region_tree(page_table->mmap_region_root);
+
+	vmm_free_tables(page_table->pml_high, page_table->map_page == pml5_map_page ? 5 : 4, batch);
+
+	page_table->pages = NULL;
+	page_table->mmap_region_root = NULL;
+	page_table->pml_high = NULL;
+}
 
-			*(new_page->reference) = 1;
+// the region is copied out so the lock is not held across the file read or page allocation,
+// those may take node locks that are themselves held around faulting user copies
+static int vmm_find_region(struct page_table *page_table, uintptr_t address, struct mmap_region *region) {
+	rwsem_read_lock(&page_table->mmap_lock);
 
-			hash_table_push(page_table->pages, &new_page->vaddr, new_page, sizeof(new_page->vaddr));
+	struct mmap_region *root = page_table->mmap_region_root;
 
+	while(root) {
+		if(root->base <= address && (root->base + root->limit) >= address) {
+			*region = *root;
+			rwsem_read_unlock(&page_table->mmap_lock);
 			return 0;
 		}
 
@@ -502,9 +550,74 @@ int vmm_anon_map(struct page_table *page_table, uintptr_t address) {
 		}
 	}
 
+	rwsem_read_unlock(&page_table->mmap_lock);
+
 	return -1;
 }
 
+int vmm_file_map(struct page_table *page_table, uintptr_t address) {
+	struct mmap_region region;
+	if(vmm_find_region(page_table, address, &region) == -1) {
+		return -1;
+	}
+
+	uint64_t faulting_page = address & ~(0xfff);
+	uint64_t *lowest_level = page_table->lowest_level(page_table, faulting_page);
+
+	struct page *page = hash_table_search(page_table->pages, &faulting_page, sizeof(faulting_page));
+	if(page == NULL) {
+		return -1;
+	}
+
+	invlpg(address);
+
+	int ret = page->file->ops->read(page->file, (void*)(page->frame->addr + HIGH_VMA), PAGE_SIZE, page->offset) == -1 ? 0 : 1;
+	if(ret) {
+		*lowest_level = *lowest_level | VMM_FLAGS_P;
+	}
+
+	return 0;
+}
+
+int vmm_anon_map(struct page_table *page_table, uintptr_t address) {
+	struct mmap_region region;
+	if(vmm_find_region(page_table, address, &region) == -1) {
+		return -1;
+	}
+
+	uint64_t flags = VMM_FLAGS_P | VMM_FLAGS_NX;
+
+	if(region.prot & MMAP_PROT_WRITE) flags |= VMM_FLAGS_RW;
+	if(region.prot & MMAP_PROT_USER) flags |= VMM_FLAGS_US;
+	if(region.prot & MMAP_PROT_EXEC) flags &= ~(VMM_FLAGS_NX);
+	if(region.prot & MMAP_PROT_NONE) flags &= ~(VMM_FLAGS_P);
+
+	size_t misalignment = address & (PAGE_SIZE - 1);
+
+	struct frame *frame = alloc(sizeof(struct frame));
+	frame->addr = pmm_alloc(1, 1);
+
+	uint64_t vaddr = address - misalignment;
+
+	invlpg(address);
+
+	struct page *new_page = alloc(sizeof(struct page));
+	*new_page = (struct page) {
+		.vaddr = vaddr,
+		.frame = frame,
+		.size = PAGE_SIZE,
+		.flags = flags,
+		.pml_entry = page_table->map_page(page_table, vaddr, frame->addr, flags),
+		.reference = alloc(sizeof(int))
+	};
+
+	*(new_page->reference) = 1;
+
+	hash_table_push(page_table->pages, &new_page->vaddr, new_page, sizeof(new_page->vaddr));
+
+	return 0;
+}
+
 int vmm_pf_handler(struct registers *regs) {
 	struct task *task = CURRENT_TASK;
 	if(task == NULL) {
@@ -539,7 +652,7 @@ int vmm_pf_handler(struct registers *regs) {
 		} else {
 			page->frame = alloc(sizeof(struct frame));
 			new_frame = pmm_alloc(1, 1);
-			memcpy64((uint64_t*)(new_frame + HIGH_VMA), (uint64_t*)(original_frame + HIGH_VMA), PAGE_SIZE / 8);
+			copy_page((void*)(new_frame + HIGH_VMA), (void*)(original_frame + HIGH_VMA));
 		}
 
 		(*page->reference)--;
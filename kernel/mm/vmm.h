@@ -3,6 +3,7 @@
 #include <types.h>
 #include <vector.h>
 #include <lock.h>
+#include <sched/mutex.h>
 
 #define VMM_FLAGS_P (1 << 0)
 #define VMM_FLAGS_RW (1 << 1)
@@ -26,11 +27,10 @@
 #define VMM_FILE_FLAG (1 << 10)
 #define VMM_SHARE_FLAG (1 << 11)
 
-struct futex;
+struct pmm_batch;
 
 struct frame {
 	uint64_t addr;
-	VECTOR(struct futex*) locks;
 };
 
 struct page {
@@ -65,13 +65,18 @@ struct page_table {
 	size_t (*unmap_page)(struct page_table *page_table, uintptr_t vaddr);
 	uint64_t *(*lowest_level)(struct page_table *page_table, uintptr_t vaddr);
 
+	// guards the region tree, page faults only read it
+	struct rwsem mmap_lock;
 	struct mmap_region *mmap_region_root;
 	uint64_t mmap_bump_base;
 
+	uintptr_t vdso_base;
+
 	struct hash_table *pages;
 
 	uint64_t *pml_high;
 
+	// one for every task running on it, the last one out destroys it
 	int refcnt;
 	struct spinlock lock;
 };
@@ -83,5 +88,6 @@ void vmm_init_page_table(struct page_table *page_table);
 void vmm_map_range(struct page_table *page_table, uintptr_t vaddr, uint64_t cnt, uint64_t flags);
 void vmm_unmap_range(struct page_table *page_table, uintptr_t vaddr, uint64_t cnt);
 void vmm_default_table(struct page_table *page_table);
+void vmm_destroy_page_table(struct page_table *page_table, struct pmm_batch *batch);
 
 struct page_table *vmm_fork_page_table(struct page_table *page_table);
@@ -0,0 +1,311 @@
+#include <sched/fpu.h>
+#include <sched/sched.h>
+#include <mm/pmm.h>
+#include <string.h>
+#include <debug.h>
+#include <cpu.h>
+
+int fpu_mode;
+size_t fpu_state_size;
+uint64_t fpu_xfeatures;
+
+static inline void clts() {
+	asm volatile ("clts");
+}
+
+static inline void stts() {
+	uint64_t cr0;
+	asm volatile ("mov %%cr0, %0" : "=r"(cr0));
+	asm volatile ("mov %0, %%cr0" :: "r"(cr0 | CR0_TS));
+}
+
+static inline void xsetbv(uint32_t index, uint64_t value) {
+	asm volatile ("xsetbv" :: "c"(index), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+static void fpu_save(void *state) {
+	uint32_t low = fpu_xfeatures;
+	uint32_t high = fpu_xfeatures >> 32;
+
+	switch(fpu_mode) {
+		case FPU_MODE_XSAVES:
+			asm volatile ("xsaves64 (%0)" :: "r"(state), "a"(low), "d"(high) : "memory");
+			break;
+		case FPU_MODE_XSAVEOPT:
+			asm volatile ("xsaveopt64 (%0)" :: "r"(state), "a"(low), "d"(high) : "memory");
+			break;
+		case FPU_MODE_XSAVE:
+			asm volatile ("xsave64 (%0)" :: "r"(state), "a"(low), "d"(high) : "memory");
+			break;
+		default:
+			asm volatile ("fxsave64 (%0)" :: "r"(state) : "memory");
+	}
+}
+
+static void fpu_restore(void *state) {
+	uint32_t low = fpu_xfeatures;
+	uint32_t high = fpu_xfeatures >> 32;
+
+	switch(fpu_mode) {
+		case FPU_MODE_XSAVES:
+			asm volatile ("xrstors64 (%0)" :: "r"(state), "a"(low), "d"(high) : "memory");
+			break;
+		case FPU_MODE_XSAVEOPT:
+		case FPU_MODE_XSAVE:
+			asm volatile ("xrstor64 (%0)" :: "r"(state), "a"(low), "d"(high) : "memory");
+			break;
+		default:
+			asm volatile ("fxrstor64 (%0)" :: "r"(state) : "memory");
+	}
+}
+
+static void *fpu_state_alloc() {
+	uint8_t *state = (void*)(pmm_alloc(DIV_ROUNDUP(fpu_state_size, PAGE_SIZE), 1) + HIGH_VMA);
+	memset8(state, 0, fpu_state_size);
+
+	// an empty xstate_bv restores every component to its init state, only the legacy
+	// control words are taken from the image
+	*(uint16_t*)(state + 0) = FPU_DEFAULT_FCW;
+	*(uint32_t*)(state + 24) = FPU_DEFAULT_MXCSR;
+
+	// xrstors only takes the compacted format
+	if(fpu_mode == FPU_MODE_XSAVES) {
+		*(uint64_t*)(state + 520) = (1ull << 63) | fpu_xfeatures;
+	}
+
+	return state;
+}
+
+void fpu_cpu_init() {
+	uint64_t cr0;
+	asm volatile ("mov %%cr0, %0" : "=r"(cr0));
+
+	// nothing is loaded yet, the first user to touch the fpu traps and gets its state in
+	cr0 &= ~CR0_EM;
+	cr0 |= CR0_MP | CR0_NE | CR0_TS;
+
+	asm volatile ("mov %0, %%cr0" :: "r"(cr0));
+
+	struct cpuid_state cpuid_state = cpuid(1, 0);
+
+	if((cpuid_state.rcx & (1 << 26)) == 0) {
+		fpu_mode = FPU_MODE_FXSAVE;
+		fpu_state_size = 512;
+		fpu_xfeatures = XFEATURE_X87 | XFEATURE_SSE;
+		return;
+	}
+
+	uint64_t cr4;
+	asm volatile ("mov %%cr4, %0" : "=r"(cr4));
+	asm volatile ("mov %0, %%cr4" :: "r"(cr4 | CR4_OSXSAVE));
+
+	cpuid_state = cpuid(0xd, 0);
+
+	uint64_t supported = cpuid_state.rax | (cpuid_state.rdx << 32);
+	uint64_t xfeatures = supported & (XFEATURE_X87 | XFEATURE_SSE | XFEATURE_AVX);
+
+	// avx512 state is all or nothing
+	if((supported & XFEATURE_AVX512) == XFEATURE_AVX512) {
+		xfeatures |= XFEATURE_AVX512;
+	}
+
+	xsetbv(0, xfeatures);
+
+	fpu_xfeatures = xfeatures;
+
+	struct cpuid_state extensions = cpuid(0xd, 1);
+
+	if(extensions.rax & (1 << 3)) {
+		// no supervisor state is managed, xsaves is only used for its compaction and optimisations
+		wrmsr(MSR_IA32_XSS, 0);
+
+		fpu_mode = FPU_MODE_XSAVES;
+		fpu_state_size = cpuid(0xd, 1).rbx;
+	} else {
+		fpu_mode = (extensions.rax & (1 << 0)) ? FPU_MODE_XSAVEOPT : FPU_MODE_XSAVE;
+
+		// ebx reflects the features enabled in xcr0, re-read it now that they are
+		fpu_state_size = cpuid(0xd, 0).rbx;
+	}
+}
+
+// called from put_prev, state that was live on this cpu is written back so the task is free to
+// run anywhere, the registers stay loaded in case it comes straight back
+void fpu_switch_out(struct task *task) {
+	if(this_cpu_read(fpu_active) && this_cpu_read(fpu_owner) == task) {
+		fpu_save(task->fpu_state);
+	} else {
+		// a whole slice went by without the fpu, start over on lazy restores
+		task->fpu_counter = 0;
+	}
+}
+
+void fpu_switch_in(struct task *task) {
+	int cpu = this_cpu_read(cpu_number);
+	bool active = this_cpu_read(fpu_active);
+
+	if(task->fpu_state) {
+		// nobody else loaded their state here since, the registers are still ours
+		if(this_cpu_read(fpu_owner) == task && task->fpu_cpu == cpu) {
+			if(!active) {
+				clts();
+				this_cpu_write(fpu_active, true);
+			}
+			return;
+		}
+
+		// the counter wraps around, which drops a busy task back to lazy for a slice
+		if(task->fpu_counter > FPU_EAGER_THRESHOLD) {
+			if(!active) {
+				clts();
+			}
+
+			fpu_restore(task->fpu_state);
+
+			task->fpu_cpu = cpu;
+			task->fpu_counter++;
+
+			this_cpu_write(fpu_owner, task);
+			this_cpu_write(fpu_active, true);
+			return;
+		}
+	}
+
+	if(active) {
+		stts();
+		this_cpu_write(fpu_active, false);
+	}
+}
+
+// called on the way into idle, put_prev already wrote back the state of whoever ran last. the owner
+// may run or exit anywhere while this cpu sleeps, so it stops claiming the registers
+void fpu_idle() {
+	if(this_cpu_read(fpu_active)) {
+		stts();
+		this_cpu_write(fpu_active, false);
+	}
+
+	this_cpu_write(fpu_owner, NULL);
+}
+
+int fpu_trap(struct registers *regs) {
+	// kernel simd code only runs inside kernel_fpu sections, which clear TS up front
+	if((regs->cs & 0x3) == 0) {
+		return -1;
+	}
+
+	struct task *task = CURRENT_TASK;
+	if(task == NULL) {
+		return -1;
+	}
+
+	// the allocation zeroes pages through a kernel_fpu section, which sets TS again on its way out
+	if(task->fpu_state == NULL) {
+		task->fpu_state = fpu_state_alloc();
+	}
+
+	clts();
+
+	// whoever owned the registers before saved them when they were switched out
+	fpu_restore(task->fpu_state);
+
+	task->fpu_cpu = this_cpu_read(cpu_number);
+	task->fpu_counter++;
+
+	this_cpu_write(fpu_owner, task);
+	this_cpu_write(fpu_active, true);
+
+	return 0;
+}
+
+void fpu_fork(struct task *parent, struct task *child) {
+	child->fpu_state = NULL;
+	child->fpu_counter = 0;
+
+	if(parent->fpu_state == NULL) {
+		return;
+	}
+
+	bool interrupts = get_interrupt_state();
+	asm volatile ("cli");
+
+	// the parent's latest state may still only be in the registers
+	if(this_cpu_read(fpu_active) && this_cpu_read(fpu_owner) == parent) {
+		fpu_save(parent->fpu_state);
+	}
+
+	if(interrupts) {
+		asm volatile ("sti");
+	}
+
+	child->fpu_state = fpu_state_alloc();
+	memcpy8(child->fpu_state, parent->fpu_state, fpu_state_size);
+}
+
+// called on the running task, but the cpu it last loaded its state on may be another one and still
+// name it as the owner
+void fpu_release(struct task *task) {
+	bool interrupts = get_interrupt_state();
+	asm volatile ("cli");
+
+	if(this_cpu_read(fpu_owner) == task) {
+		this_cpu_write(fpu_owner, NULL);
+
+		if(this_cpu_read(fpu_active)) {
+			stts();
+			this_cpu_write(fpu_active, false);
+		}
+	} else if(task->fpu_state && task->fpu_cpu < (int)cpu_local_list.length) {
+		// the registers there are left alone, with no owner nobody saves them anywhere
+		struct task *expected = task;
+		struct cpu_local *local = cpu_local_list.data[task->fpu_cpu];
+		__atomic_compare_exchange_n(&local->fpu_owner, &expected, NULL, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+	}
+
+	if(interrupts) {
+		asm volatile ("sti");
+	}
+
+	if(task->fpu_state) {
+		pmm_free((uintptr_t)task->fpu_state - HIGH_VMA, DIV_ROUNDUP(fpu_state_size, PAGE_SIZE));
+		task->fpu_state = NULL;
+	}
+}
+
+bool kernel_fpu_usable() {
+	return fpu_state_size && !this_cpu_read(in_kernel_fpu);
+}
+
+// interrupts stay off for the whole section, so nothing can get scheduled in and nothing can
+// nest another section on this cpu, callers keep their sections short and never fault in them
+void kernel_fpu_begin() {
+	bool interrupts = get_interrupt_state();
+	asm volatile ("cli");
+
+	this_cpu_write(kernel_fpu_interrupts, interrupts);
+	this_cpu_write(in_kernel_fpu, true);
+
+	if(this_cpu_read(fpu_active)) {
+		struct task *owner = this_cpu_read(fpu_owner);
+
+		// the owner picks its state back up through the usual trap once it touches the fpu again
+		if(owner) {
+			fpu_save(owner->fpu_state);
+		}
+	} else {
+		clts();
+	}
+
+	this_cpu_write(fpu_owner, NULL);
+}
+
+void kernel_fpu_end() {
+	stts();
+
+	this_cpu_write(fpu_active, false);
+	this_cpu_write(in_kernel_fpu, false);
+
+	if(this_cpu_read(kernel_fpu_interrupts)) {
+		asm volatile ("sti");
+	}
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <types.h>
+#include <cpu.h>
+
+struct task;
+
+#define FPU_MODE_FXSAVE 0
+#define FPU_MODE_XSAVE 1
+#define FPU_MODE_XSAVEOPT 2
+#define FPU_MODE_XSAVES 3
+
+#define XFEATURE_X87 (1 << 0)
+#define XFEATURE_SSE (1 << 1)
+#define XFEATURE_AVX (1 << 2)
+#define XFEATURE_OPMASK (1 << 5)
+#define XFEATURE_ZMM_HI256 (1 << 6)
+#define XFEATURE_HI16_ZMM (1 << 7)
+#define XFEATURE_AVX512 (XFEATURE_OPMASK | XFEATURE_ZMM_HI256 | XFEATURE_HI16_ZMM)
+
+#define MSR_IA32_XSS 0xda0
+
+#define CR0_MP (1 << 1)
+#define CR0_EM (1 << 2)
+#define CR0_TS (1 << 3)
+#define CR0_NE (1 << 5)
+#define CR4_OSXSAVE (1 << 18)
+
+// consecutive slices with the fpu in use before a task gets its state loaded up front
+#define FPU_EAGER_THRESHOLD 5
+
+#define FPU_DEFAULT_FCW 0x37f
+#define FPU_DEFAULT_MXCSR 0x1f80
+
+extern int fpu_mode;
+extern size_t fpu_state_size;
+extern uint64_t fpu_xfeatures;
+
+void fpu_cpu_init();
+void fpu_switch_out(struct task *task);
+void fpu_switch_in(struct task *task);
+void fpu_fork(struct task *parent, struct task *child);
+void fpu_release(struct task *task);
+void fpu_idle();
+int fpu_trap(struct registers *regs);
+
+bool kernel_fpu_usable();
+void kernel_fpu_begin();
+void kernel_fpu_end();
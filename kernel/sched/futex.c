@@ -1,16 +1,48 @@
 #include <sched/futex.h>
 #include <sched/sched.h>
+#include <mm/vmm.h>
 #include <debug.h>
 #include <errno.h>
+#include <time.h>
 
-static struct hash_table futex_list;
+static struct futex_bucket futex_buckets[FUTEX_HASH_SIZE];
 
-int futex(uintptr_t uaddr, int ops, int expected, const struct timespec *timeout) {
+static struct futex_bucket *futex_hash(struct futex_key *key) {
+	uint64_t hash = (key->address >> 2) ^ (uintptr_t)key->page_table;
+	hash *= 0x9e3779b97f4a7c15ull;
+
+	return &futex_buckets[hash >> (64 - 8)];
+}
+
+static bool futex_key_equal(struct futex_key *a, struct futex_key *b) {
+	return a->address == b->address && a->page_table == b->page_table;
+}
+
+// resolves the futex word to its key and a kernel pointer it can be read through
+static int futex_get_key(uintptr_t uaddr, bool private, struct futex_key *key, uint32_t **word) {
 	struct task *task = CURRENT_TASK;
 	if(task == NULL) {
 		panic("");
 	}
 
+	// the private path reads the word straight through the user address
+	if((uaddr & 3) || uaddr == 0 || uaddr > USER_ADDRESS_LIMIT - sizeof(uint32_t)) {
+		set_errno(EFAULT);
+		return -1;
+	}
+
+	// a private word is only ever touched through this address space, skip the page lookup
+	if(private) {
+		// fault it in now, it is read again with the bucket lock held
+		(void)*(volatile uint32_t*)uaddr;
+
+		key->address = uaddr;
+		key->page_table = task->page_table;
+		*word = (uint32_t*)uaddr;
+
+		return 0;
+	}
+
 	uint64_t uaddr_page = uaddr & ~(0xfff);
 	struct page *page = hash_table_search(task->page_table->pages, &uaddr_page, sizeof(uaddr_page));
 	if(page == NULL) {
@@ -18,62 +50,329 @@ int futex(uintptr_t uaddr, int ops, int expected, const struct timespec *timeout
 		return -1;
 	}
 
-	uint64_t futex_paddr = page->frame->addr + (uaddr & (0xfff));
+	key->address = page->frame->addr + (uaddr & (0xfff));
+	key->page_table = NULL;
+	*word = (uint32_t*)(key->address + HIGH_VMA);
 
-	switch(ops) {
-		case FUTEX_WAIT: {
-			if(*(uint32_t*)uaddr != expected) {
-				set_errno(EAGAIN);
-				return -1;
-			}
+	return 0;
+}
 
-			struct futex *futex = hash_table_search(&futex_list, &futex_paddr, sizeof(futex_paddr));
-			if(futex == NULL) {
-				futex = alloc(sizeof(struct futex));
+static void futex_queue(struct futex_bucket *bucket, struct futex_waiter *waiter) {
+	waiter->bucket = bucket;
+	waiter->next = NULL;
+	waiter->prev = bucket->tail;
 
-				futex->paddr = futex_paddr;
+	if(bucket->tail) {
+		bucket->tail->next = waiter;
+	} else {
+		bucket->head = waiter;
+	}
 
-				hash_table_push(&futex_list, &futex->paddr, futex, sizeof(futex->paddr));
-				VECTOR_PUSH(page->frame->locks, futex);
-			}
+	bucket->tail = waiter;
+}
+
+static void futex_unqueue(struct futex_bucket *bucket, struct futex_waiter *waiter) {
+	if(waiter->prev) {
+		waiter->prev->next = waiter->next;
+	} else {
+		bucket->head = waiter->next;
+	}
 
-			futex->expected = expected;
-			futex->operation = ops;
-			futex->paddr = futex_paddr;
+	if(waiter->next) {
+		waiter->next->prev = waiter->prev;
+	} else {
+		bucket->tail = waiter->prev;
+	}
 
-			if(timeout) {
-				waitq_set_timer(&futex->waitq, *timeout);
-			}
+	waiter->next = NULL;
+	waiter->prev = NULL;
+}
 
-			futex->trigger = waitq_alloc(&futex->waitq, EVENT_LOCK);
-			waitq_add(&futex->waitq, futex->trigger);
+// called with the bucket lock held, the waiter may return as soon as it is released
+static void futex_wake_waiter(struct futex_bucket *bucket, struct futex_waiter *waiter) {
+	futex_unqueue(bucket, waiter);
 
-			waitq_wait(&futex->waitq, EVENT_LOCK);
-			waitq_release(&futex->waitq, EVENT_LOCK);
+	waitq_wake(&waiter->trigger);
+	__atomic_store_n(&waiter->woken, true, __ATOMIC_RELEASE);
+}
 
-			waitq_remove(&futex->waitq, futex->trigger);
+// requeue moves waiters between buckets, so chase the waiter until its bucket holds still
+static struct futex_bucket *futex_lock_waiter(struct futex_waiter *waiter) {
+	for(;;) {
+		struct futex_bucket *bucket = __atomic_load_n(&waiter->bucket, __ATOMIC_ACQUIRE);
 
-			break;
+		spinlock_irqsave(&bucket->lock);
+
+		if(bucket == __atomic_load_n(&waiter->bucket, __ATOMIC_RELAXED)) {
+			return bucket;
 		}
-		case FUTEX_WAKE: {
-			struct futex *futex = hash_table_search(&futex_list, &futex_paddr, sizeof(futex_paddr));
-			if(futex == NULL) {
-				set_errno(EINVAL);
-				return -1;
+
+		spinrelease_irqsave(&bucket->lock);
+	}
+}
+
+// two buckets are always taken in address order
+static void futex_lock_pair(struct futex_bucket *a, struct futex_bucket *b) {
+	if(a == b) {
+		spinlock_irqsave(&a->lock);
+	} else if(a < b) {
+		spinlock_irqsave(&a->lock);
+		spinlock_irqsave(&b->lock);
+	} else {
+		spinlock_irqsave(&b->lock);
+		spinlock_irqsave(&a->lock);
+	}
+}
+
+// the lock taken first holds the caller's interrupt state, releasing it restores that state so
+// it always goes last
+static void futex_unlock_pair(struct futex_bucket *a, struct futex_bucket *b) {
+	if(a == b) {
+		spinrelease_irqsave(&a->lock);
+	} else if(a < b) {
+		spinrelease_irqsave(&b->lock);
+		spinrelease_irqsave(&a->lock);
+	} else {
+		spinrelease_irqsave(&a->lock);
+		spinrelease_irqsave(&b->lock);
+	}
+}
+
+static int futex_wait(uintptr_t uaddr, bool private, uint32_t val, const struct timespec *timeout, bool absolute, bool realtime, uint32_t bitset) {
+	if(bitset == 0) {
+		set_errno(EINVAL);
+		return -1;
+	}
+
+	struct task *task = CURRENT_TASK;
+
+	struct futex_waiter waiter = { 0 };
+	uint32_t *word;
+
+	if(futex_get_key(uaddr, private, &waiter.key, &word) == -1) {
+		return -1;
+	}
+
+	waiter.bitset = bitset;
+	waiter.trigger.waitq = &waiter.waitq;
+	waiter.trigger.type = EVENT_LOCK;
+
+	struct futex_bucket *bucket = futex_hash(&waiter.key);
+
+	spinlock_irqsave(&bucket->lock);
+
+	// queue before looking at the word, pairs with the fence in futex_wake. a waker that
+	// changed the word first either makes us bail here or finds us on the list
+	futex_queue(bucket, &waiter);
+	task->futex_waiter = &waiter;
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if(__atomic_load_n(word, __ATOMIC_RELAXED) != val) {
+		futex_unqueue(bucket, &waiter);
+		task->futex_waiter = NULL;
+		spinrelease_irqsave(&bucket->lock);
+		set_errno(EAGAIN);
+		return -1;
+	}
+
+	spinrelease_irqsave(&bucket->lock);
+
+	struct timer *timer = NULL;
+	if(timeout) {
+		if(absolute) {
+			uint64_t deadline = timespec_to_ns(*timeout);
+			if(realtime) {
+				uint64_t now = clock_realtime_ns();
+				deadline = clock_monotonic_ns() + (deadline > now ? deadline - now : 0);
 			}
 
-			hash_table_delete(&futex_list, &futex_paddr, sizeof(futex_paddr));
+			timer = waitq_set_deadline(&waiter.waitq, deadline);
+		} else {
+			timer = waitq_set_timer(&waiter.waitq, *timeout);
+		}
+	}
+
+	int ret = 0;
 
-			waitq_wake(futex->trigger);
+	task->sleep_timer = timer;
 
+	while(!__atomic_load_n(&waiter.woken, __ATOMIC_ACQUIRE)) {
+		ret = waitq_wait(&waiter.waitq, EVENT_LOCK | EVENT_TIMER);
+		if(ret == -1 || (ret & EVENT_TIMER)) {
 			break;
 		}
+	}
+
+	task->sleep_timer = NULL;
+
+	waitq_cancel_timer(&waiter.waitq, timer);
+
+	// a wake that raced with the timeout or signal wins, the waker is done with us once we
+	// hold the lock
+	bucket = futex_lock_waiter(&waiter);
+
+	bool woken = __atomic_load_n(&waiter.woken, __ATOMIC_ACQUIRE);
+	if(!woken) {
+		futex_unqueue(bucket, &waiter);
+	}
+
+	task->futex_waiter = NULL;
+
+	spinrelease_irqsave(&bucket->lock);
+
+	// the waitq goes away with this frame
+	VECTOR_CLEAR(waiter.waitq.tasks);
+	VECTOR_CLEAR(waiter.waitq.triggers);
+
+	if(woken) {
+		return 0;
+	}
+
+	if(ret == -1) {
+		return -1;
+	}
+
+	set_errno(ETIMEDOUT);
+	return -1;
+}
+
+// the sleeper is never coming back for its waiter, take it off the bucket in its place. a waker
+// that got to it first is done with it once we hold the lock
+void futex_cancel(struct futex_waiter *waiter) {
+	struct futex_bucket *bucket = futex_lock_waiter(waiter);
+
+	if(!__atomic_load_n(&waiter->woken, __ATOMIC_ACQUIRE)) {
+		futex_unqueue(bucket, waiter);
+	}
+
+	spinrelease_irqsave(&bucket->lock);
+
+	VECTOR_CLEAR(waiter->waitq.tasks);
+	VECTOR_CLEAR(waiter->waitq.triggers);
+}
+
+static int futex_wake(uintptr_t uaddr, bool private, int count, uint32_t bitset) {
+	if(bitset == 0) {
+		set_errno(EINVAL);
+		return -1;
+	}
+
+	struct futex_key key;
+	uint32_t *word;
+
+	if(futex_get_key(uaddr, private, &key, &word) == -1) {
+		return -1;
+	}
+
+	struct futex_bucket *bucket = futex_hash(&key);
+
+	// nobody waiting, no need to touch the lock
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&bucket->head, __ATOMIC_RELAXED) == NULL) {
+		return 0;
+	}
+
+	int woken = 0;
+
+	spinlock_irqsave(&bucket->lock);
+
+	struct futex_waiter *waiter = bucket->head;
+	while(waiter && woken < count) {
+		struct futex_waiter *next = waiter->next;
+
+		if(futex_key_equal(&waiter->key, &key) && (waiter->bitset & bitset)) {
+			futex_wake_waiter(bucket, waiter);
+			woken++;
+		}
+
+		waiter = next;
+	}
+
+	spinrelease_irqsave(&bucket->lock);
+
+	return woken;
+}
+
+static int futex_requeue(uintptr_t uaddr, bool private, int wake_count, int requeue_count, uintptr_t uaddr2, bool compare, uint32_t val3) {
+	if(wake_count < 0 || requeue_count < 0) {
+		set_errno(EINVAL);
+		return -1;
+	}
+
+	struct futex_key key, key2;
+	uint32_t *word, *word2;
+
+	if(futex_get_key(uaddr, private, &key, &word) == -1 || futex_get_key(uaddr2, private, &key2, &word2) == -1) {
+		return -1;
+	}
+
+	struct futex_bucket *bucket = futex_hash(&key);
+	struct futex_bucket *bucket2 = futex_hash(&key2);
+
+	futex_lock_pair(bucket, bucket2);
+
+	if(compare && __atomic_load_n(word, __ATOMIC_RELAXED) != val3) {
+		futex_unlock_pair(bucket, bucket2);
+		set_errno(EAGAIN);
+		return -1;
+	}
+
+	int woken = 0;
+	int requeued = 0;
+
+	struct futex_waiter *waiter = bucket->head;
+	while(waiter && (woken < wake_count || requeued < requeue_count)) {
+		struct futex_waiter *next = waiter->next;
+
+		if(futex_key_equal(&waiter->key, &key)) {
+			if(woken < wake_count) {
+				futex_wake_waiter(bucket, waiter);
+				woken++;
+			} else {
+				// the rest go back to sleep on the second word without ever running
+				waiter->key = key2;
+
+				if(bucket != bucket2) {
+					futex_unqueue(bucket, waiter);
+					futex_queue(bucket2, waiter);
+				}
+
+				requeued++;
+			}
+		}
+
+		waiter = next;
+	}
+
+	futex_unlock_pair(bucket, bucket2);
+
+	return compare ? woken + requeued : woken;
+}
+
+int futex(uintptr_t uaddr, int op, uint32_t val, const struct timespec *timeout, uintptr_t uaddr2, uint32_t val3) {
+	bool private = op & FUTEX_PRIVATE_FLAG;
+	bool realtime = op & FUTEX_CLOCK_REALTIME;
+
+	// requeue takes a count where the timeout would be
+	int val2 = (int)(uintptr_t)timeout;
+
+	switch(op & FUTEX_CMD_MASK) {
+		case FUTEX_WAIT:
+			return futex_wait(uaddr, private, val, timeout, false, false, FUTEX_BITSET_MATCH_ANY);
+		case FUTEX_WAIT_BITSET:
+			return futex_wait(uaddr, private, val, timeout, true, realtime, val3);
+		case FUTEX_WAKE:
+			return futex_wake(uaddr, private, val, FUTEX_BITSET_MATCH_ANY);
+		case FUTEX_WAKE_BITSET:
+			return futex_wake(uaddr, private, val, val3);
+		case FUTEX_REQUEUE:
+			return futex_requeue(uaddr, private, val, val2, uaddr2, false, 0);
+		case FUTEX_CMP_REQUEUE:
+			return futex_requeue(uaddr, private, val, val2, uaddr2, true, val3);
 		default:
 			set_errno(EINVAL);
 			return -1;
 	}
-
-	return 0;
 }
 
 void syscall_futex(struct registers *regs) {
@@ -81,11 +380,12 @@ void syscall_futex(struct registers *regs) {
 	int op = regs->rsi;
 	uint32_t val = regs->rdx; 
 	const struct timespec *timeout = (void*)regs->r10;
+	uint32_t *uaddr2 = (void*)regs->r8;
+	uint32_t val3 = regs->r9;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] futex: uaddr {%x}, op {%x}, val {%x}, timeout {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, uaddr, op, val, timeout);
+	print("syscall: [pid %x, tid %x] futex: uaddr {%x}, op {%x}, val {%x}, timeout {%x}, uaddr2 {%x}, val3 {%x}\n", this_cpu_read(pid), this_cpu_read(tid), uaddr, op, val, timeout, uaddr2, val3);
 #endif
 
-	regs->rax = futex((uintptr_t)uaddr, op, val, timeout);
-	//regs->rax = 0;
+	regs->rax = futex((uintptr_t)uaddr, op, val, timeout, (uintptr_t)uaddr2, val3);
 }
@@ -6,12 +6,49 @@
 
 #define FUTEX_WAIT 0
 #define FUTEX_WAKE 1
+#define FUTEX_REQUEUE 3
+#define FUTEX_CMP_REQUEUE 4
+#define FUTEX_WAIT_BITSET 9
+#define FUTEX_WAKE_BITSET 10
+
+#define FUTEX_PRIVATE_FLAG 128
+#define FUTEX_CLOCK_REALTIME 256
+#define FUTEX_CMD_MASK ~(FUTEX_PRIVATE_FLAG | FUTEX_CLOCK_REALTIME)
+
+#define FUTEX_BITSET_MATCH_ANY 0xffffffff
+
+#define FUTEX_HASH_SIZE 256
+
+struct page_table;
+struct futex_bucket;
+
+// private futexes are told apart by address space and virtual address, anything else by
+// the physical address so that every mapping of the word meets in the same place
+struct futex_key {
+	uint64_t address;
+	struct page_table *page_table;
+};
+
+// lives on the waiter's stack for as long as it sleeps
+struct futex_waiter {
+	struct futex_key key;
+	uint32_t bitset;
+
+	struct futex_bucket *bucket;
+	struct futex_waiter *next;
+	struct futex_waiter *prev;
 
-struct futex {
-	struct spinlock lock;
 	struct waitq waitq;
-	struct waitq_trigger *trigger;
-	uint64_t paddr;
-	int expected;
-	int operation;
+	struct waitq_trigger trigger;
+	bool woken;
 };
+
+struct futex_bucket {
+	struct spinlock lock;
+
+	struct futex_waiter *head;
+	struct futex_waiter *tail;
+};
+
+void futex_cancel(struct futex_waiter *waiter);
+int futex(uintptr_t uaddr, int op, uint32_t val, const struct timespec *timeout, uintptr_t uaddr2, uint32_t val3);
@@ -0,0 +1,84 @@
+#include <sched/kthread.h>
+#include <sched/fpu.h>
+#include <debug.h>
+#include <cpu.h>
+
+static struct pid_namespace *kthread_namespace;
+
+void kthread_init() {
+	kthread_namespace = sched_default_namespace();
+}
+
+static void kthread_entry(void (*func)(void *arg), void *arg) {
+	func(arg);
+	kthread_exit();
+}
+
+// the thread is not runnable until kthread_start, so it can still be bound
+struct task *kthread_create(void (*func)(void *arg), void *arg) {
+	if(kthread_namespace == NULL) {
+		panic("");
+	}
+
+	struct task *task = alloc(sizeof(struct task));
+	sched_default_task(task, kthread_namespace, 0);
+
+	task->parent = NULL;
+	task->cwd = NULL;
+
+	task->regs.cs = 0x28;
+	task->regs.ss = 0x30;
+	task->regs.rip = (uintptr_t)kthread_entry;
+	task->regs.rdi = (uintptr_t)func;
+	task->regs.rsi = (uintptr_t)arg;
+	task->regs.rflags = 0x202;
+
+	// entered like a call, the slot below the top stands in for the return address
+	task->regs.rsp = task->kernel_stack.sp - 8;
+
+	return task;
+}
+
+int kthread_bind(struct task *task, int cpu) {
+	struct cpuset mask;
+	cpuset_zero(&mask);
+	cpuset_set(&mask, cpu);
+
+	return sched_set_affinity(task, &mask);
+}
+
+void kthread_start(struct task *task) {
+	task->sched_status = TASK_WAITING;
+	sched_enqueue(task);
+}
+
+struct task *kthread_run(void (*func)(void *arg), void *arg) {
+	struct task *task = kthread_create(func, arg);
+	kthread_start(task);
+
+	return task;
+}
+
+void kthread_exit() {
+	struct task *task = CURRENT_TASK;
+	if(task == NULL) {
+		panic("");
+	}
+
+	asm volatile ("cli");
+
+	fpu_release(task);
+
+	task->sched_status = TASK_YIELD;
+	idr_remove(&task->thread_group->pids, task->id.tid);
+	idr_remove(&task->namespace->pids, task->id.pid);
+	sched_remove(task);
+
+	this_cpu_write(pid, -1);
+	this_cpu_write(tid, -1);
+	this_cpu_write(current_task, NULL);
+
+	vmm_init_page_table(&kernel_mappings);
+
+	sched_yield();
+}
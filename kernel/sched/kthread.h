@@ -0,0 +1,13 @@
+#pragma once
+
+#include <sched/sched.h>
+
+// ring 0 tasks in a namespace of their own, they share the kernel half of every address space
+// and never see a signal
+
+void kthread_init();
+struct task *kthread_create(void (*func)(void *arg), void *arg);
+struct task *kthread_run(void (*func)(void *arg), void *arg);
+int kthread_bind(struct task *task, int cpu);
+void kthread_start(struct task *task);
+void kthread_exit();
@@ -0,0 +1,192 @@
+#include <sched/mutex.h>
+#include <sched/sched.h>
+#include <cpu.h>
+#include <debug.h>
+#include <time.h>
+
+typedef bool (*lock_try_fn)(void *lock);
+
+// keep trying for as long as whoever holds the lock is running, a sleeping owner or a
+// crowd of readers we can not see is not worth burning the cpu on
+static bool lock_spin(struct task **owner, lock_try_fn trylock, void *lock) {
+	for(int i = 0; i < MUTEX_SPIN_MAX; i++) {
+		if(trylock(lock)) {
+			return true;
+		}
+
+		struct task *task = __atomic_load_n(owner, __ATOMIC_RELAXED);
+		if(task == NULL || task == MUTEX_OWNER_ANONYMOUS || !__atomic_load_n(&task->on_cpu, __ATOMIC_RELAXED)) {
+			return false;
+		}
+
+		spin_pause();
+	}
+
+	return false;
+}
+
+// spinning only ends if the owner gets to run. one that sleeps while we hold the cpu with
+// interrupts off never will on a single cpu, and elsewhere not being back on a cpu within
+// MUTEX_NOSLEEP_TIMEOUT is taken as the same deadlock. better a panic naming it than a hang
+static void lock_wait_nosleep(struct task **owner, lock_try_fn trylock, void *lock) {
+	uint64_t off_cpu = 0;
+
+	while(!trylock(lock)) {
+		struct task *task = __atomic_load_n(owner, __ATOMIC_RELAXED);
+
+		// anonymous owners and readers can not be watched, those are simply waited out
+		if(task == NULL || task == MUTEX_OWNER_ANONYMOUS || __atomic_load_n(&task->on_cpu, __ATOMIC_RELAXED)) {
+			off_cpu = 0;
+		} else if(cpu_local_list.length == 1) {
+			panic("mutex: nosleep wait on a sleeping owner");
+		} else if(off_cpu == 0) {
+			off_cpu = clock_monotonic_ns();
+		} else if(clock_monotonic_ns() - off_cpu > MUTEX_NOSLEEP_TIMEOUT) {
+			panic("mutex: nosleep wait on a sleeping owner");
+		}
+
+		spin_pause();
+	}
+}
+
+static void lock_wait(struct lock_waiters *waiters, struct task **owner, lock_try_fn trylock, void *lock) {
+	if(lock_spin(owner, trylock, lock)) {
+		return;
+	}
+
+	// nothing to put to sleep yet, or the caller sits on something the sleep itself needs
+	if(CURRENT_TASK == NULL || this_cpu_read(nosleep)) {
+		lock_wait_nosleep(owner, trylock, lock);
+		return;
+	}
+
+	waiters->trigger.waitq = &waiters->waitq;
+	waiters->trigger.type = EVENT_LOCK;
+
+	// pairs with the release in the unlock paths, either they see us or we see the lock free
+	__atomic_fetch_add(&waiters->count, 1, __ATOMIC_SEQ_CST);
+
+	for(;;) {
+		// forget older releases, any release from here on makes the wait fall through
+		spinlock_irqsave(&waiters->waitq.lock);
+		waitq_release(&waiters->waitq, EVENT_LOCK);
+		spinrelease_irqsave(&waiters->waitq.lock);
+
+		if(trylock(lock)) {
+			break;
+		}
+
+		// a signal only cuts the sleep short, the lock is still wanted
+		waitq_wait(&waiters->waitq, EVENT_LOCK);
+
+		if(lock_spin(owner, trylock, lock)) {
+			break;
+		}
+	}
+
+	__atomic_fetch_sub(&waiters->count, 1, __ATOMIC_RELAXED);
+}
+
+static void lock_wake(struct lock_waiters *waiters) {
+	if(__atomic_load_n(&waiters->count, __ATOMIC_SEQ_CST)) {
+		waitq_wake(&waiters->trigger);
+	}
+}
+
+static struct task *mutex_owner() {
+	struct task *task = CURRENT_TASK;
+	return task ? task : MUTEX_OWNER_ANONYMOUS;
+}
+
+bool mutex_trylock(struct mutex *mutex) {
+	struct task *unlocked = NULL;
+	return __atomic_compare_exchange_n(&mutex->owner, &unlocked, mutex_owner(), false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static bool mutex_try(void *lock) {
+	return mutex_trylock(lock);
+}
+
+void mutex_lock(struct mutex *mutex) {
+	if(__builtin_expect(mutex_trylock(mutex), 1)) {
+		return;
+	}
+
+	lock_wait(&mutex->waiters, &mutex->owner, mutex_try, mutex);
+}
+
+void mutex_unlock(struct mutex *mutex) {
+	__atomic_store_n(&mutex->owner, NULL, __ATOMIC_SEQ_CST);
+	lock_wake(&mutex->waiters);
+}
+
+bool rwsem_read_trylock(struct rwsem *rwsem) {
+	int count = __atomic_load_n(&rwsem->count, __ATOMIC_RELAXED);
+
+	while(count >= 0 && !__atomic_load_n(&rwsem->writers_waiting, __ATOMIC_RELAXED)) {
+		if(__atomic_compare_exchange_n(&rwsem->count, &count, count + 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static bool rwsem_read_try(void *lock) {
+	return rwsem_read_trylock(lock);
+}
+
+void rwsem_read_lock(struct rwsem *rwsem) {
+	if(__builtin_expect(rwsem_read_trylock(rwsem), 1)) {
+		return;
+	}
+
+	lock_wait(&rwsem->waiters, &rwsem->owner, rwsem_read_try, rwsem);
+}
+
+void rwsem_read_unlock(struct rwsem *rwsem) {
+	if(__atomic_sub_fetch(&rwsem->count, 1, __ATOMIC_SEQ_CST) == 0) {
+		lock_wake(&rwsem->waiters);
+	}
+}
+
+bool rwsem_write_trylock(struct rwsem *rwsem) {
+	int unlocked = 0;
+
+	if(__atomic_compare_exchange_n(&rwsem->count, &unlocked, -1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+		__atomic_store_n(&rwsem->owner, mutex_owner(), __ATOMIC_RELAXED);
+		return true;
+	}
+
+	return false;
+}
+
+static bool rwsem_write_try(void *lock) {
+	return rwsem_write_trylock(lock);
+}
+
+void rwsem_write_lock(struct rwsem *rwsem) {
+	if(__builtin_expect(rwsem_write_trylock(rwsem), 1)) {
+		return;
+	}
+
+	__atomic_fetch_add(&rwsem->writers_waiting, 1, __ATOMIC_SEQ_CST);
+	lock_wait(&rwsem->waiters, &rwsem->owner, rwsem_write_try, rwsem);
+	__atomic_fetch_sub(&rwsem->writers_waiting, 1, __ATOMIC_SEQ_CST);
+}
+
+void rwsem_write_unlock(struct rwsem *rwsem) {
+	__atomic_store_n(&rwsem->owner, NULL, __ATOMIC_RELAXED);
+	__atomic_store_n(&rwsem->count, 0, __ATOMIC_SEQ_CST);
+	lock_wake(&rwsem->waiters);
+}
+
+// for sections that hold a spinlock or wear another task's identity, a contended sleeping
+// lock taken in there is spun on instead
+void mutex_nosleep_begin() {
+	this_cpu_inc(nosleep);
+}
+
+void mutex_nosleep_end() {
+	this_cpu_dec(nosleep);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <sched/queue.h>
+
+struct task;
+
+// everything a sleeping lock needs to park its waiters, zeroed means nobody ever waited
+struct lock_waiters {
+	int count;
+	struct waitq waitq;
+	struct waitq_trigger trigger;
+};
+
+// owner doubles as the lock word, locked means not NULL
+struct mutex {
+	struct task *owner;
+	struct lock_waiters waiters;
+};
+
+// count is the number of readers or -1 for a writer, waiting writers keep new readers out
+struct rwsem {
+	int count;
+	int writers_waiting;
+	struct task *owner;
+	struct lock_waiters waiters;
+};
+
+// owner used for locks taken before there is a task to name
+#define MUTEX_OWNER_ANONYMOUS ((struct task*)1)
+
+// pause iterations a waiter spins on a running owner before it gives up the cpu
+#define MUTEX_SPIN_MAX 0x1000
+
+// how long a waiter that may not sleep spins on an owner that is off the cpu before calling it a deadlock
+#define MUTEX_NOSLEEP_TIMEOUT 1000000000
+
+void mutex_lock(struct mutex *mutex);
+bool mutex_trylock(struct mutex *mutex);
+void mutex_unlock(struct mutex *mutex);
+
+void rwsem_read_lock(struct rwsem *rwsem);
+bool rwsem_read_trylock(struct rwsem *rwsem);
+void rwsem_read_unlock(struct rwsem *rwsem);
+
+void rwsem_write_lock(struct rwsem *rwsem);
+bool rwsem_write_trylock(struct rwsem *rwsem);
+void rwsem_write_unlock(struct rwsem *rwsem);
+
+void mutex_nosleep_begin();
+void mutex_nosleep_end();
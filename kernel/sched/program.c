@@ -1,5 +1,6 @@
 #include <sched/program.h>
 #include <sched/sched.h>
+#include <sched/vdso.h>
 #include <fs/fd.h>
 #include <string.h>
 #include <debug.h>
@@ -48,13 +49,14 @@ static uint64_t *program_place_args(struct program *program, uint64_t *location)
 }
 
 static uint64_t *program_place_aux(struct program *program, uint64_t *location) {
-	location -= 10;
+	location -= 12;
 
 	location[0] = ELF_AT_PHNUM; location[1] = program->file.aux.at_phnum;
 	location[2] = ELF_AT_PHENT; location[3] = program->file.aux.at_phent;
 	location[4] = ELF_AT_PHDR;  location[5] = program->file.aux.at_phdr;
 	location[6] = ELF_AT_ENTRY; location[7] = program->file.aux.at_entry;
-	location[8] = 0; location[9] = 0;
+	location[8] = ELF_AT_SYSINFO_EHDR; location[9] = program->vdso;
+	location[10] = 0; location[11] = 0;
 
 	return location;
 }
@@ -146,6 +148,10 @@ int program_load(struct program *program, const char *path) {
 		fd_close(fd);
 	}
 
+	// the image starts one page above the time data page
+	uintptr_t vdso_base = vdso_map(program->file.page_table, 0);
+	program->vdso = vdso_base ? vdso_base + PAGE_SIZE : 0;
+
 	program->file_path = alloc(strlen(path) + 1);
 	strcpy(program->file_path, path);
 
@@ -23,6 +23,7 @@ struct program {
 	} parameters;
 
 	uint64_t entry;
+	uintptr_t vdso;
 	bool loaded;
 };
 
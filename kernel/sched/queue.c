@@ -6,38 +6,49 @@
 int waitq_wait(struct waitq *waitq, int type) {
 	struct task *task = CURRENT_TASK;
 
-	spinlock_irqsave(&waitq->lock);
-
-	if(waitq->status & type) {
-		/*int ret;
-		bsfl((waitq->status & type), &ret);
-		spinrelease_irqsave(&waitq->lock);
-		return ret;*/
-		return waitq->status & type;
-	}
+	for(;;) {
+		spinlock_irqsave(&waitq->lock);
+
+		if(waitq->status & type) {
+			/*int ret;
+			bsfl((waitq->status & type), &ret);
+			spinrelease_irqsave(&waitq->lock);
+			return ret;*/
+			spinrelease_irqsave(&waitq->lock);
+			return waitq->status & type;
+		}
 
-	VECTOR_PUSH(waitq->tasks, task);
+		VECTOR_PUSH(waitq->tasks, task);
 
-	spinrelease_irqsave(&waitq->lock);
+		task->blocking = true;
+		task->blocked_on = waitq;
+		task->signal_queue.active = true;
 
-	for(;;) {
-		sched_dequeue(task);
+		// the waker clears blocking under the waitq lock, so a wakeup can not slip
+		// in between marking ourselves blocked and giving up the cpu
+		while(task->blocking) {
+			sched_dequeue(task);
+			spinrelease_irqsave(&waitq->lock);
 
-		task->signal_queue.active = true;
+			sched_switch();
 
-		task->blocking = true;
-		asm volatile ("sti");
-		while(task->blocking);
-		task->blocking = false;
+			spinlock_irqsave(&waitq->lock);
+		}
 
+		task->blocked_on = NULL;
 		task->signal_queue.active = false;
 
 		if(task->signal_release_block) {
+			VECTOR_REMOVE_BY_VALUE(waitq->tasks, task);
+			spinrelease_irqsave(&waitq->lock);
+
 			task->signal_release_block = false;
 			set_errno(EINTR);
 			return -1;
 		}
 
+		spinrelease_irqsave(&waitq->lock);
+
 		struct waitq_trigger *trigger = (void*)task->last_trigger;
 		if(trigger == NULL) {
 			continue;
@@ -53,21 +64,49 @@ int waitq_wait(struct waitq *waitq, int type) {
 	return -1;
 }
 
-int waitq_set_timer(struct waitq *waitq, struct timespec timespec) {
+struct timer *waitq_set_deadline(struct waitq *waitq, uint64_t deadline) {
 	struct waitq_trigger *timer_trigger = waitq_alloc(waitq, EVENT_TIMER);
 
-	waitq->timespec = timespec;
 	waitq->timer_trigger = timer_trigger;
 
 	struct timer *timer = alloc(sizeof(struct timer));
-	timer->timespec = timespec;
+	timer->deadline = deadline;
 
 	waitq_add(waitq, timer_trigger);
 
 	VECTOR_PUSH(timer->triggers, (void*)timer_trigger);
-	VECTOR_PUSH(timer_list, timer);
+	timer_add(timer);
 
-	return 0;
+	return timer;
+}
+
+struct timer *waitq_set_timer(struct waitq *waitq, struct timespec timespec) {
+	waitq->timespec = timespec;
+
+	return waitq_set_deadline(waitq, clock_monotonic_ns() + timespec_to_ns(timespec));
+}
+
+void waitq_cancel_timer(struct waitq *waitq, struct timer *timer) {
+	if(timer == NULL) {
+		return;
+	}
+
+	// once this returns the expiry can no longer touch the timer or its triggers
+	timer_cancel(timer);
+
+	for(size_t i = 0; i < timer->triggers.length; i++) {
+		waitq_remove(waitq, timer->triggers.data[i]);
+	}
+
+	spinlock_irqsave(&waitq->lock);
+
+	waitq->timer_trigger = NULL;
+	waitq_release(waitq, EVENT_TIMER);
+
+	spinrelease_irqsave(&waitq->lock);
+
+	VECTOR_CLEAR(timer->triggers);
+	free(timer);
 }
 
 int waitq_add(struct waitq *waitq, struct waitq_trigger *trigger) {
@@ -102,7 +141,7 @@ int waitq_remove(struct waitq *waitq, struct waitq_trigger *trigger) {
 	return 0;
 }
 
-int waitq_wake(struct waitq_trigger *trigger) {
+static int waitq_wake_common(struct waitq_trigger *trigger, bool sync) {
 	if(trigger == NULL || trigger->waitq == NULL) {
 		return -1;
 	}
@@ -115,13 +154,22 @@ int waitq_wake(struct waitq_trigger *trigger) {
 
 	waitq_obtain(waitq, trigger->type);
 
+	// a handoff only makes sense towards a single peer
+	if(waitq->tasks.length != 1) {
+		sync = false;
+	}
+
 	for(size_t i = 0; i < waitq->tasks.length; i++) {
 		struct task *task = waitq->tasks.data[i];
 
 		task->last_trigger = trigger;
 		task->blocking = false;
 
-		sched_requeue(task);
+		if(sync) {
+			sched_requeue_sync(task);
+		} else {
+			sched_requeue(task);
+		}
 	}
 
 	VECTOR_CLEAR(waitq->tasks);
@@ -131,6 +179,14 @@ int waitq_wake(struct waitq_trigger *trigger) {
 	return 0;
 }
 
+int waitq_wake(struct waitq_trigger *trigger) {
+	return waitq_wake_common(trigger, false);
+}
+
+int waitq_wake_sync(struct waitq_trigger *trigger) {
+	return waitq_wake_common(trigger, true);
+}
+
 int waitq_trigger_calibrate(struct waitq_trigger *trigger, struct task *task, int type) {
 	if(trigger == NULL) {
 		return -1;
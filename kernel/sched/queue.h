@@ -15,9 +15,13 @@
 #define EVENT_SOCKET (1 << 8)
 #define EVENT_PROCESS_STATUS (1 << 9)
 #define EVENT_LOCK (1 << 10)
+#define EVENT_RCU (1 << 11)
+#define EVENT_WORK (1 << 12)
+#define EVENT_SOFTIRQ (1 << 13)
 
 struct task;
 struct waitq;
+struct timer;
 
 struct waitq_trigger {
 	struct task *agent_task;
@@ -45,11 +49,14 @@ struct waitq {
 };
 
 int waitq_wait(struct waitq *waitq, int type);
-int waitq_set_timer(struct waitq *waitq, struct timespec timespec);
+struct timer *waitq_set_deadline(struct waitq *waitq, uint64_t deadline);
+struct timer *waitq_set_timer(struct waitq *waitq, struct timespec timespec);
+void waitq_cancel_timer(struct waitq *waitq, struct timer *timer);
 int waitq_add(struct waitq *waitq, struct waitq_trigger *trigger);
 int waitq_remove(struct waitq *waitq, struct waitq_trigger *trigger);
 int waitq_trigger_calibrate(struct waitq_trigger *trigger, struct task *task, int type);
 int waitq_wake(struct waitq_trigger *trigger);
+int waitq_wake_sync(struct waitq_trigger *trigger);
 struct waitq_trigger *waitq_alloc(struct waitq *waitq, int type);
 
 static inline void waitq_release(struct waitq *waitq, int type) {
@@ -0,0 +1,291 @@
+#include <sched/rcu.h>
+#include <sched/sched.h>
+#include <sched/queue.h>
+#include <mm/slab.h>
+#include <lock.h>
+#include <cpu.h>
+
+static struct spinlock rcu_lock;
+
+// grace periods are numbered, one is in flight while started is ahead of completed
+static uint64_t rcu_gp_started;
+static uint64_t rcu_gp_completed;
+static uint64_t rcu_gp_requested;
+
+// ordered by the grace period each callback waits for
+static struct rcu_head *rcu_callback_list;
+static struct rcu_head **rcu_callback_tail = &rcu_callback_list;
+
+struct rcu_synchronize {
+	struct rcu_head head;
+	struct waitq waitq;
+	struct waitq_trigger trigger;
+	bool done;
+};
+
+struct rcu_free_head {
+	struct rcu_head head;
+	void *ptr;
+};
+
+// everything this cpu read before now is finished, whatever grace period is running may count it
+static void rcu_report_qs() {
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	this_cpu_write(rcu_qs_seq, __atomic_load_n(&rcu_gp_started, __ATOMIC_ACQUIRE));
+}
+
+// finishes the running grace period once every cpu that is not idle went through a quiescent
+// state, then starts the next one if somebody asked for it. called with rcu_lock held
+static bool rcu_gp_advance() {
+	uint64_t started = rcu_gp_started;
+
+	if(rcu_gp_completed < started) {
+		for(size_t i = 0; i < cpu_local_list.length; i++) {
+			struct cpu_local *local = cpu_local_list.data[i];
+
+			if(!__atomic_load_n(&local->rcu_idle, __ATOMIC_ACQUIRE) && __atomic_load_n(&local->rcu_qs_seq, __ATOMIC_ACQUIRE) < started) {
+				return false;
+			}
+		}
+
+		__atomic_store_n(&rcu_gp_completed, started, __ATOMIC_RELEASE);
+	}
+
+	if(rcu_gp_requested <= rcu_gp_completed) {
+		return false;
+	}
+
+	// pairs with the fence in rcu_report_qs, a cpu that sees the new number has seen the update
+	__atomic_store_n(&rcu_gp_started, started + 1, __ATOMIC_SEQ_CST);
+
+	return true;
+}
+
+// a grace period that is already running may have begun before the caller's update, so the
+// caller always waits for the one after it. called with rcu_lock held
+static uint64_t rcu_gp_request() {
+	uint64_t target = rcu_gp_started + 1;
+
+	if(rcu_gp_requested < target) {
+		rcu_gp_requested = target;
+	}
+
+	rcu_gp_advance();
+
+	return target;
+}
+
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head)) {
+	head->func = func;
+	head->next = NULL;
+
+	spinlock_irqsave(&rcu_lock);
+
+	head->gp = rcu_gp_request();
+
+	*rcu_callback_tail = head;
+	rcu_callback_tail = &head->next;
+
+	spinrelease_irqsave(&rcu_lock);
+}
+
+// on every pass through the scheduler, the cpu is quiescent and does the bookkeeping for everyone
+void rcu_check() {
+	if(this_cpu_read(rcu_idle)) {
+		this_cpu_write(rcu_idle, false);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	}
+
+	// somebody blocked inside a read side section, this cpu can not vouch for anything
+	if(this_cpu_read(rcu_nesting)) {
+		return;
+	}
+
+	rcu_report_qs();
+
+	if(__atomic_load_n(&rcu_gp_requested, __ATOMIC_RELAXED) <= __atomic_load_n(&rcu_gp_completed, __ATOMIC_RELAXED) &&
+		__atomic_load_n(&rcu_callback_list, __ATOMIC_RELAXED) == NULL) {
+		return;
+	}
+
+	if(!spinlock_try_irqdef(&rcu_lock)) {
+		return;
+	}
+
+	// a freshly started grace period can take our quiescent state right away
+	if(rcu_gp_advance()) {
+		rcu_report_qs();
+		rcu_gp_advance();
+	}
+
+	struct rcu_head *ready = NULL;
+	struct rcu_head **ready_tail = &ready;
+
+	while(rcu_callback_list && rcu_callback_list->gp <= rcu_gp_completed) {
+		*ready_tail = rcu_callback_list;
+		ready_tail = &rcu_callback_list->next;
+		rcu_callback_list = rcu_callback_list->next;
+	}
+
+	*ready_tail = NULL;
+
+	if(rcu_callback_list == NULL) {
+		rcu_callback_tail = &rcu_callback_list;
+	}
+
+	spinrelease_irqdef(&rcu_lock);
+
+	while(ready) {
+		struct rcu_head *next = ready->next;
+		ready->func(ready);
+		ready = next;
+	}
+}
+
+// an idle cpu reads nothing, grace periods stop waiting on it until it schedules again
+void rcu_idle_enter() {
+	rcu_report_qs();
+	this_cpu_write(rcu_idle, true);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static void rcu_synchronize_wake(struct rcu_head *head) {
+	struct rcu_synchronize *sync = (struct rcu_synchronize*)head;
+
+	waitq_wake(&sync->trigger);
+
+	// the waiter's stack goes away as soon as it sees this
+	__atomic_store_n(&sync->done, true, __ATOMIC_RELEASE);
+}
+
+void synchronize_rcu() {
+	// nothing to put to sleep, poll without running callbacks since the caller may hold anything
+	if(CURRENT_TASK == NULL || this_cpu_read(nosleep)) {
+		spinlock_irqsave(&rcu_lock);
+		uint64_t target = rcu_gp_request();
+		spinrelease_irqsave(&rcu_lock);
+
+		while(__atomic_load_n(&rcu_gp_completed, __ATOMIC_ACQUIRE) < target) {
+			rcu_report_qs();
+
+			spinlock_irqsave(&rcu_lock);
+			rcu_gp_advance();
+			spinrelease_irqsave(&rcu_lock);
+
+			spin_pause();
+		}
+
+		return;
+	}
+
+	struct rcu_synchronize sync = { 0 };
+	sync.trigger.waitq = &sync.waitq;
+	sync.trigger.type = EVENT_RCU;
+
+	call_rcu(&sync.head, rcu_synchronize_wake);
+
+	while(!__atomic_load_n(&sync.done, __ATOMIC_ACQUIRE)) {
+		waitq_wait(&sync.waitq, EVENT_RCU);
+	}
+}
+
+static void rcu_free_callback(struct rcu_head *head) {
+	struct rcu_free_head *free_head = (struct rcu_free_head*)head;
+
+	free(free_head->ptr);
+	free(free_head);
+}
+
+// for plain buffers that have no room for a head of their own
+void rcu_free(void *ptr) {
+	struct rcu_free_head *free_head = alloc(sizeof(struct rcu_free_head));
+	free_head->ptr = ptr;
+
+	call_rcu(&free_head->head, rcu_free_callback);
+}
+
+#ifdef RCU_BENCHMARK
+
+#include <fs/cdev.h>
+#include <fs/vfs.h>
+#include <string.h>
+#include <debug.h>
+
+#define RCU_BENCH_MAJOR 10
+#define RCU_BENCH_MINOR 1
+#define RCU_BENCH_ROUNDS 64
+
+static inline uint64_t rcu_bench_clock() {
+	uint32_t low, high;
+	asm volatile ("rdtsc" : "=a"(low), "=d"(high));
+	return ((uint64_t)high << 32) | low;
+}
+
+static uint64_t rcu_bench_min;
+static uint64_t rcu_bench_avg;
+static uint64_t rcu_bench_max;
+
+// a read from the start runs a fresh set of grace periods, the rest of the read reports on it
+static ssize_t rcu_bench_read(struct file_handle*, void *buf, size_t cnt, off_t offset) {
+	if(offset == 0) {
+		uint64_t total = 0;
+		uint64_t min = ~0ull;
+		uint64_t max = 0;
+
+		for(size_t i = 0; i < RCU_BENCH_ROUNDS; i++) {
+			uint64_t start = rcu_bench_clock();
+			synchronize_rcu();
+			uint64_t elapsed = rcu_bench_clock() - start;
+
+			total += elapsed;
+			if(elapsed < min) min = elapsed;
+			if(elapsed > max) max = elapsed;
+		}
+
+		rcu_bench_min = min;
+		rcu_bench_avg = total / RCU_BENCH_ROUNDS;
+		rcu_bench_max = max;
+	}
+
+	char *text = alloc(256);
+	size_t length = sprint(text, "synchronize_rcu x%d: min %d avg %d max %d (cycles)\ngrace periods %d\n",
+		RCU_BENCH_ROUNDS, rcu_bench_min, rcu_bench_avg, rcu_bench_max,
+		__atomic_load_n(&rcu_gp_completed, __ATOMIC_RELAXED)
+	);
+
+	if(offset >= length) {
+		free(text);
+		return 0;
+	}
+
+	if(offset + cnt > length) {
+		cnt = length - offset;
+	}
+
+	memcpy8(buf, (uint8_t*)text + offset, cnt);
+	free(text);
+
+	return cnt;
+}
+
+static struct file_ops rcu_bench_ops = {
+	.read = rcu_bench_read
+};
+
+void rcu_bench_init() {
+	struct cdev *cdev = alloc(sizeof(struct cdev));
+	cdev->fops = &rcu_bench_ops;
+	cdev->rdev = makedev(RCU_BENCH_MAJOR, RCU_BENCH_MINOR);
+	if(cdev_register(cdev) == -1) {
+		print("rcu: unable to register benchmark device\n");
+		return;
+	}
+
+	struct stat *stat = alloc(sizeof(struct stat));
+	stat_init(stat);
+	stat->st_mode = S_IFCHR | S_IRUSR | S_IRGRP | S_IROTH;
+	stat->st_rdev = makedev(RCU_BENCH_MAJOR, RCU_BENCH_MINOR);
+	vfs_create_node_deep(NULL, NULL, NULL, stat, "/dev/rcu_bench");
+}
+
+#endif
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <cpu.h>
+
+struct rcu_head {
+	struct rcu_head *next;
+	void (*func)(struct rcu_head *head);
+	uint64_t gp;
+};
+
+#define rcu_dereference(p) __atomic_load_n(&(p), __ATOMIC_CONSUME)
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+// a reader must not sleep, passing through the scheduler is how a cpu tells writers it is done.
+// interrupts stay off for the section, a preemptible kernel task moved to another cpu halfway
+// through would otherwise leave its nesting count behind on the first one
+static inline void rcu_read_lock() {
+	bool interrupts = get_interrupt_state();
+	asm volatile ("cli" ::: "memory");
+
+	if(this_cpu_read(rcu_nesting) == 0) {
+		this_cpu_write(rcu_interrupts, interrupts);
+	}
+
+	this_cpu_inc(rcu_nesting);
+}
+
+static inline void rcu_read_unlock() {
+	this_cpu_dec(rcu_nesting);
+
+	if(this_cpu_read(rcu_nesting) == 0 && this_cpu_read(rcu_interrupts)) {
+		asm volatile ("sti" ::: "memory");
+	}
+}
+
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head));
+void synchronize_rcu();
+void rcu_free(void *ptr);
+
+void rcu_check();
+void rcu_idle_enter();
+
+#ifdef RCU_BENCHMARK
+void rcu_bench_init();
+#endif
@@ -1,4 +1,9 @@
 #include <sched/sched.h>
+#include <sched/topology.h>
+#include <sched/fpu.h>
+#include <sched/rcu.h>
+#include <sched/softirq.h>
+#include <sched/workqueue.h>
 #include <int/apic.h>
 #include <vector.h>
 #include <cpu.h>
@@ -13,120 +18,801 @@
 #include <time.h>
 #include <lock.h>
 
-static struct hash_table namespace_list;
-static VECTOR(struct task*) task_queue;
-
-static struct bitmap nid_bitmap = {
-	.data = NULL,
-	.size = 0,
-	.resizable = true
-};
+static struct idr namespace_list;
 
 struct spinlock sched_lock;
 
 struct task *sched_translate_pid(nid_t nid, pid_t pid, tid_t tid) {
-	struct pid_namespace *namespace = hash_table_search(&namespace_list, &nid, sizeof(nid));
+	struct pid_namespace *namespace = idr_find(&namespace_list, nid);
 	if(namespace == NULL) {
 		return NULL;
 	}
 
-	struct task *task = hash_table_search(&namespace->process_list, &pid, sizeof(pid));
+	struct task *task = idr_find(&namespace->pids, pid);
 	if(task == NULL) {
 		return NULL;
 	}
 
-	struct task *thread = hash_table_search(&task->thread_group->process_list, &tid, sizeof(tid));
+	return idr_find(&task->thread_group->pids, tid);
+}
+
+// nice -20 .. 19, every step is ~10% of cpu time relative to its neighbour
+static const uint64_t sched_nice_to_weight[NICE_MAX - NICE_MIN + 1] = {
+	88761, 71755, 56483, 46273, 36291,
+	29154, 23254, 18705, 14949, 11916,
+	9548, 7620, 6100, 4904, 3906,
+	3121, 2501, 1991, 1586, 1277,
+	1024, 820, 655, 526, 423,
+	335, 272, 215, 172, 137,
+	110, 87, 70, 56, 45,
+	36, 29, 23, 18, 15
+};
 
-	return thread;
+static uint64_t sched_clock() {
+	return clock_monotonic_ns();
 }
 
-struct task *find_next_task() {
-	struct task *ret = NULL;
+static struct run_queue *sched_lock_queue(struct task *task) {
+	for(;;) {
+		struct run_queue *queue = cpu_local_list.data[task->cpu]->run_queue;
+
+		spinlock_irqsave(&queue->lock);
+
+		// the task might have been migrated while we were spinning
+		if(cpu_local_list.data[task->cpu]->run_queue == queue) {
+			return queue;
+		}
+
+		spinrelease_irqsave(&queue->lock);
+	}
+}
+
+// the second queue lock is only ever spun on in address order, every other path that nests queue locks
+// gets away with a trylock
+static struct run_queue *sched_lock_queue_pair(struct task *task, struct run_queue *target) {
+	for(;;) {
+		struct run_queue *queue = cpu_local_list.data[task->cpu]->run_queue;
+		struct run_queue *first = queue < target ? queue : target;
+		struct run_queue *second = queue < target ? target : queue;
+
+		spinlock_irqdef(&first->lock);
+		if(second != first) {
+			spinlock_irqdef(&second->lock);
+		}
+
+		if(cpu_local_list.data[task->cpu]->run_queue == queue) {
+			return queue;
+		}
+
+		if(second != first) {
+			spinrelease_irqdef(&second->lock);
+		}
+		spinrelease_irqdef(&first->lock);
+	}
+}
+
+static void sched_unlock_queue_pair(struct run_queue *queue, struct run_queue *target) {
+	if(target != queue) {
+		spinrelease_irqdef(&target->lock);
+	}
+	spinrelease_irqdef(&queue->lock);
+}
+
+static bool sched_cpu_allowed(struct task *task, int cpu) {
+	return cpuset_test(&task->affinity, cpu);
+}
+
+static struct cpu_local *sched_select_cpu(struct task *task) {
+	struct cpu_local *target = NULL;
+
+	for(size_t i = 0; i < cpu_local_list.length; i++) {
+		struct cpu_local *local = cpu_local_list.data[i];
+
+		if(!sched_cpu_allowed(task, i)) {
+			continue;
+		}
+
+		if(target == NULL || __atomic_load_n(&local->run_queue->load, __ATOMIC_RELAXED) <
+			__atomic_load_n(&target->run_queue->load, __ATOMIC_RELAXED)) {
+			target = local;
+		}
+	}
+
+	// masks are checked against the online cpus when they are set, this is just a safety net
+	return target ? target : cpu_local_list.data[0];
+}
+
+static void sched_update_load(struct run_queue *queue) {
+	size_t load = queue->timeline.node_cnt + queue->rt.nr_queued;
+
+	if(queue->current && queue->current->sched_status != TASK_YIELD) {
+		load++;
+	}
+
+	__atomic_store_n(&queue->load, load, __ATOMIC_RELAXED);
+}
+
+static void sched_update_min_vruntime(struct run_queue *queue) {
+	struct task *current = queue->current;
+	struct rb_node *leftmost = rb_tree_first(&queue->timeline);
+
+	if(current && (current->sched_status == TASK_YIELD || SCHED_POLICY_RT(current->policy))) {
+		current = NULL;
+	}
+
+	if(current == NULL && leftmost == NULL) {
+		return;
+	}
+
+	uint64_t vruntime = current ? current->vruntime : ((struct task*)leftmost->data)->vruntime;
+
+	if(leftmost && ((struct task*)leftmost->data)->vruntime < vruntime) {
+		vruntime = ((struct task*)leftmost->data)->vruntime;
+	}
+
+	// min_vruntime only ever moves forward
+	if(vruntime > queue->min_vruntime) {
+		queue->min_vruntime = vruntime;
+	}
+}
+
+static void sched_update_current(struct run_queue *queue) {
+	struct task *current = queue->current;
+	if(current == NULL) {
+		return;
+	}
+
+	uint64_t now = sched_clock();
+	uint64_t delta = now > current->exec_start ? now - current->exec_start : 0;
+
+	current->exec_start = now;
+	current->sum_exec_runtime += delta;
+
+	if(SCHED_POLICY_RT(current->policy)) {
+		if(current->policy == SCHED_RR) {
+			current->rt_time_slice = delta < current->rt_time_slice ? current->rt_time_slice - delta : 0;
+		}
+		return;
+	}
+
+	current->vruntime += delta * NICE_0_LOAD / current->weight;
+
+	sched_update_min_vruntime(queue);
+}
+
+static void sched_timeline_insert(struct run_queue *queue, struct task *task) {
+	task->sched_node.key = task->vruntime;
+	task->sched_node.data = task;
+
+	rb_tree_insert(&queue->timeline, &task->sched_node);
+
+	queue->load_weight += task->weight;
+}
+
+static void sched_timeline_remove(struct run_queue *queue, struct task *task) {
+	rb_tree_delete(&queue->timeline, &task->sched_node);
+
+	queue->load_weight -= task->weight;
+}
+
+static int sched_rt_top(struct rt_queue *rt) {
+	for(int i = RT_BITMAP_WORDS - 1; i >= 0; i--) {
+		if(rt->bitmap[i]) {
+			return i * 64 + 63 - __builtin_clzll(rt->bitmap[i]);
+		}
+	}
+
+	return -1;
+}
+
+static void sched_rt_insert(struct rt_queue *rt, struct task *task, bool head) {
+	int prio = task->rt_priority;
+
+	if(rt->head[prio] == NULL) {
+		task->rt_next = NULL;
+		task->rt_prev = NULL;
+		rt->head[prio] = task;
+		rt->tail[prio] = task;
+		rt->bitmap[prio / 64] |= 1ull << (prio % 64);
+	} else if(head) {
+		task->rt_prev = NULL;
+		task->rt_next = rt->head[prio];
+		rt->head[prio]->rt_prev = task;
+		rt->head[prio] = task;
+	} else {
+		task->rt_next = NULL;
+		task->rt_prev = rt->tail[prio];
+		rt->tail[prio]->rt_next = task;
+		rt->tail[prio] = task;
+	}
+
+	rt->nr_queued++;
+}
+
+static void sched_rt_remove(struct rt_queue *rt, struct task *task) {
+	int prio = task->rt_priority;
+
+	if(task->rt_prev) {
+		task->rt_prev->rt_next = task->rt_next;
+	} else {
+		rt->head[prio] = task->rt_next;
+	}
+
+	if(task->rt_next) {
+		task->rt_next->rt_prev = task->rt_prev;
+	} else {
+		rt->tail[prio] = task->rt_prev;
+	}
+
+	if(rt->head[prio] == NULL) {
+		rt->bitmap[prio / 64] &= ~(1ull << (prio % 64));
+	}
+
+	task->rt_next = NULL;
+	task->rt_prev = NULL;
+
+	rt->nr_queued--;
+}
+
+static void sched_queue_insert(struct run_queue *queue, struct task *task, bool head) {
+	if(SCHED_POLICY_RT(task->policy)) {
+		sched_rt_insert(&queue->rt, task, head);
+	} else {
+		sched_timeline_insert(queue, task);
+	}
+
+	task->queued = true;
+}
+
+static void sched_queue_remove(struct run_queue *queue, struct task *task) {
+	if(SCHED_POLICY_RT(task->policy)) {
+		sched_rt_remove(&queue->rt, task);
+	} else {
+		sched_timeline_remove(queue, task);
+	}
+
+	if(queue->next_buddy == task) {
+		queue->next_buddy = NULL;
+	}
+
+	task->queued = false;
+}
+
+static struct task *sched_pick_next(struct run_queue *queue) {
+	int prio = sched_rt_top(&queue->rt);
+	if(prio != -1) {
+		return queue->rt.head[prio];
+	}
+
+	struct rb_node *leftmost = rb_tree_first(&queue->timeline);
+
+	return leftmost ? leftmost->data : NULL;
+}
+
+static struct task *sched_pick_buddy(struct run_queue *queue, struct task *last_task) {
+	struct task *buddy = queue->next_buddy;
+
+	queue->next_buddy = NULL;
+
+	// only a waker that actually blocked hands the cpu over, and never past a real time task
+	if(buddy == NULL || last_task == NULL || last_task->sched_status != TASK_YIELD || queue->rt.nr_queued) {
+		return NULL;
+	}
+
+	struct rb_node *leftmost = rb_tree_first(&queue->timeline);
+	struct task *first = leftmost->data;
+
+	uint64_t granularity = SCHED_WAKEUP_GRANULARITY * NICE_0_LOAD / buddy->weight;
+
+	if((int64_t)(buddy->vruntime - first->vruntime) > (int64_t)granularity) {
+		return NULL;
+	}
+
+	return buddy;
+}
+
+static void sched_place_task(struct run_queue *queue, struct task *task, bool initial) {
+	uint64_t vruntime = queue->min_vruntime;
+
+	// sleepers get a bounded head start so interactive tasks preempt hogs quickly
+	if(!initial) {
+		vruntime = vruntime > SCHED_SLEEPER_CREDIT ? vruntime - SCHED_SLEEPER_CREDIT : 0;
+	}
+
+	if(initial || task->vruntime < vruntime) {
+		task->vruntime = vruntime;
+	}
+}
+
+static uint64_t sched_slice(struct run_queue *queue, struct task *task) {
+	uint64_t nr_running = queue->timeline.node_cnt + 1;
+	uint64_t period = SCHED_LATENCY;
+
+	if(nr_running > SCHED_NR_LATENCY) {
+		period = nr_running * SCHED_MIN_GRANULARITY;
+	}
+
+	uint64_t slice = period * task->weight / (queue->load_weight + task->weight);
+
+	return slice < SCHED_MIN_GRANULARITY ? SCHED_MIN_GRANULARITY : slice;
+}
+
+static bool sched_check_preempt_rt(struct run_queue *queue, struct task *current) {
+	int prio = sched_rt_top(&queue->rt);
+
+	if(prio > current->rt_priority) {
+		return true;
+	}
+
+	// an expired round robin task goes behind its peers, fifo tasks run until they block
+	if(current->policy == SCHED_RR && current->rt_time_slice == 0) {
+		current->rt_time_slice = SCHED_RR_TIMESLICE;
+		return prio == current->rt_priority;
+	}
+
+	return false;
+}
+
+static bool sched_check_preempt(struct run_queue *queue, struct task *current) {
+	if(SCHED_POLICY_RT(current->policy)) {
+		return sched_check_preempt_rt(queue, current);
+	}
+
+	if(queue->rt.nr_queued) {
+		return true;
+	}
+
+	struct rb_node *leftmost = rb_tree_first(&queue->timeline);
+	if(leftmost == NULL) {
+		return false;
+	}
+
+	uint64_t ran = current->sum_exec_runtime - current->prev_sum_exec_runtime;
+	if(ran < SCHED_MIN_GRANULARITY) {
+		return false;
+	}
+
+	uint64_t slice = sched_slice(queue, current);
+	if(ran >= slice) {
+		return true;
+	}
+
+	struct task *task = leftmost->data;
+
+	return (int64_t)(current->vruntime - task->vruntime) > (int64_t)slice;
+}
+
+static bool sched_check_preempt_wakeup(struct run_queue *queue, struct task *current, struct task *task) {
+	if(SCHED_POLICY_RT(task->policy)) {
+		return !SCHED_POLICY_RT(current->policy) || task->rt_priority > current->rt_priority;
+	}
 
-	for(size_t i = 0, cnt = 0; i < task_queue.length; i++) {
-		struct task *task = task_queue.data[i];
-		if(task == NULL) {
+	if(SCHED_POLICY_RT(current->policy)) {
+		return false;
+	}
+
+	sched_update_current(queue);
+
+	// scaled like vruntime so a light wakee needs a bigger lead before it may kick a heavy task off
+	uint64_t granularity = SCHED_WAKEUP_GRANULARITY * NICE_0_LOAD / task->weight;
+
+	return (int64_t)(current->vruntime - task->vruntime) > (int64_t)granularity;
+}
+
+static struct task *sched_steal_domain(struct cpu_local *local, struct sched_domain *domain,
+	struct sched_domain *child, size_t hot_load) {
+	struct run_queue *busiest = NULL;
+	size_t busiest_load = 0;
+
+	for(size_t i = 0; i < cpu_local_list.length; i++) {
+		struct run_queue *queue = cpu_local_list.data[i]->run_queue;
+		if(queue == local->run_queue || !cpuset_test(&domain->span, i)) {
+			continue;
+		}
+
+		// the level below already came up empty
+		if(child && cpuset_test(&child->span, i)) {
 			continue;
 		}
 
-		task->idle_cnt++;
+		size_t load = __atomic_load_n(&queue->load, __ATOMIC_RELAXED);
+		if(load > busiest_load) {
+			busiest_load = load;
+			busiest = queue;
+		}
+	}
+
+	if(busiest == NULL) {
+		return NULL;
+	}
+
+	// never spin on a remote queue from the tick, the owner may be stealing from us
+	if(!spinlock_try_irqdef(&busiest->lock)) {
+		return NULL;
+	}
+
+	struct task *ret = NULL;
+	struct task *hot = NULL;
 
-		//print("task: %d:%d: status: %d\n", task->id.pid, task->id.tid, task->sched_status);
+	uint64_t now = sched_clock();
+
+	for(struct rb_node *node = rb_tree_first(&busiest->timeline); node; node = rb_tree_next(node)) {
+		struct task *task = node->data;
+
+		if(!sched_cpu_allowed(task, local->cpu_number)) {
+			continue;
+		}
 
-		if((task->sched_status == TASK_WAITING || task->dispatch_ready == true) && cnt < task->idle_cnt) {
-			cnt = task->idle_cnt;
-			ret = task;
+		if((now - task->last_run) < SCHED_MIGRATION_COST) {
+			if(hot == NULL) {
+				hot = task;
+			}
+			continue;
 		}
+
+		ret = task;
+		break;
+	}
+
+	// only pull a cache hot task when the victim is clearly overloaded
+	if(ret == NULL && busiest_load > hot_load) {
+		ret = hot;
 	}
 
+	if(ret) {
+		struct run_queue *queue = local->run_queue;
+
+		sched_queue_remove(busiest, ret);
+		sched_update_load(busiest);
+
+		// keep the task's lag, not its absolute vruntime, across the move
+		ret->vruntime = ret->vruntime - busiest->min_vruntime + queue->min_vruntime;
+		ret->cpu = local->cpu_number;
+
+		sched_queue_insert(queue, ret, false);
+	}
+
+	spinrelease_irqdef(&busiest->lock);
+
 	return ret;
 }
 
-void sched_idle() {
-	xapic_write(XAPIC_EOI_OFF, 0);
-	spinrelease_irqsave(&sched_lock);
+// balance within the closest cache first and only reach further out when that finds nothing
+static struct task *sched_steal(struct cpu_local *local) {
+	struct sched_domain *child = NULL;
 
-	for(;;) {
-		asm volatile ("hlt");
+	for(struct sched_domain *domain = local->sched_domain; domain; domain = domain->parent) {
+		// moving a hot task is cheap while it keeps its last level cache
+		size_t hot_load = (domain->flags & SD_SHARE_LLC) ? 1 : SCHED_STEAL_HOT_LOAD;
+
+		struct task *task = sched_steal_domain(local, domain, child, hot_load);
+		if(task) {
+			return task;
+		}
+
+		child = domain;
 	}
+
+	return NULL;
 }
 
-void reschedule(struct registers *regs, void*) {
-	if(__atomic_test_and_set(&sched_lock, __ATOMIC_ACQUIRE)) {
-		return;
+static void sched_put_prev(struct cpu_local *local, struct task *last_task, struct task *next_task, struct registers *regs) {
+	struct run_queue *queue = local->run_queue;
+
+	if(last_task->sched_status != TASK_YIELD) {
+		last_task->sched_status = TASK_WAITING;
 	}
 
-	struct task *next_task = find_next_task();
-	if(next_task == NULL) {
-		if(CORE_LOCAL->tid != -1 && CORE_LOCAL->pid != -1) {
-			signal_dispatch(CURRENT_TASK, regs);
-			spinrelease_irqsave(&sched_lock);
+	last_task->errno = local->errno;
+	last_task->regs = *regs;
+	last_task->user_fs_base = get_user_fs();
+	last_task->user_gs_base = get_user_gs();
+	fpu_switch_out(last_task);
+	last_task->user_stack.sp = local->user_stack;
+	last_task->last_run = sched_clock();
+	last_task->on_cpu = false;
+
+	if(last_task->on_rq && last_task->sched_status == TASK_WAITING && last_task->cpu == local->cpu_number) {
+		// the affinity changed under a running task, we can not take a second queue lock from here so
+		// the next interrupt on this cpu moves it
+		if(!sched_cpu_allowed(last_task, local->cpu_number)) {
+			last_task->migrating = true;
+			last_task->migrate_next = queue->migrate_list;
+			queue->migrate_list = last_task;
+
+			xapic_send_ipi(local->apic_id, SCHED_VECTOR);
 			return;
 		}
-		sched_idle();
+
+		// a real time task that lost the cpu to a higher priority keeps its place in line
+		bool head = next_task && SCHED_POLICY_RT(last_task->policy) && SCHED_POLICY_RT(next_task->policy) &&
+			next_task->rt_priority > last_task->rt_priority;
+		sched_queue_insert(queue, last_task, head);
 	}
+}
+
+static void sched_program_tick(struct cpu_local *local, struct task *current) {
+	struct run_queue *queue = local->run_queue;
+
+	uint64_t now = sched_clock();
+	uint64_t delay = 0;
+
+	// an idle cpu takes no tick at all, a busy one only as often as preemption needs
+	if(current) {
+		delay = SCHED_TICK;
 
-	if(CORE_LOCAL->tid != -1 && CORE_LOCAL->pid != -1) {
-		struct task *last_task = CURRENT_TASK;
-		if(last_task == NULL) {
-			sched_idle();
+		if(current->policy == SCHED_RR && current->rt_time_slice < delay) {
+			delay = current->rt_time_slice;
+		} else if(!SCHED_POLICY_RT(current->policy) && queue->timeline.node_cnt) {
+			uint64_t ran = current->sum_exec_runtime - current->prev_sum_exec_runtime;
+			uint64_t slice = sched_slice(queue, current);
+			uint64_t remaining = slice > ran ? slice - ran : SCHED_MIN_GRANULARITY;
+
+			if(remaining < delay) {
+				delay = remaining;
+			}
 		}
+	}
+
+	// every cpu expires the timers on its own wheel
+	uint64_t deadline = timer_next_deadline();
 
-		if(last_task->sched_status != TASK_YIELD) {
-			last_task->sched_status = TASK_WAITING;
+	if(deadline != ~0ull) {
+		uint64_t timer_delay = deadline > now ? deadline - now : 1;
+
+		if(delay == 0 || timer_delay < delay) {
+			delay = timer_delay;
 		}
+	}
+
+	__atomic_store_n(&queue->next_tick, delay ? now + delay : ~0ull, __ATOMIC_RELAXED);
+
+	apic_timer_oneshot(delay);
+}
+
+static void sched_kick(struct run_queue *queue, struct task *task) {
+	struct cpu_local *target = cpu_local_list.data[task->cpu];
+	struct task *current = queue->current;
 
-		if(last_task->sched_status != TASK_YIELD) {
-			last_task->sched_status = TASK_WAITING;
+	// an idle cpu has no tick armed and would never notice the new task
+	if(current == NULL) {
+		if(target != CORE_LOCAL) {
+			xapic_send_ipi(target->apic_id, SCHED_VECTOR);
 		}
+		return;
+	}
 
-		last_task->errno = CORE_LOCAL->errno;
-		last_task->regs = *regs;
-		last_task->user_fs_base = get_user_fs();
-		last_task->user_gs_base = get_user_gs();
-		last_task->user_stack.sp = CORE_LOCAL->user_stack;
+	// a task on its way to block is about to pick the wakee up by itself
+	if(current->sched_status == TASK_YIELD || !sched_check_preempt_wakeup(queue, current, task)) {
+		return;
+	}
+
+	// on the local cpu the ipi stays pending until interrupts are enabled again
+	queue->need_resched = true;
+	xapic_send_ipi(target->apic_id, SCHED_VECTOR);
+}
+
+static struct cpu_local *sched_try_idle(struct run_queue *queue, struct task *task, size_t cpu) {
+	struct cpu_local *local = cpu_local_list.data[cpu];
+	struct run_queue *idle = local->run_queue;
+
+	if(idle == queue || !sched_cpu_allowed(task, cpu) || __atomic_load_n(&idle->current, __ATOMIC_RELAXED) != NULL ||
+		__atomic_load_n(&idle->load, __ATOMIC_RELAXED) != 0) {
+		return NULL;
+	}
+
+	// we already hold a queue lock, never spin on a second one
+	if(!spinlock_try_irqdef(&idle->lock)) {
+		return NULL;
+	}
+
+	if(idle->current == NULL && idle->timeline.node_cnt == 0 && idle->rt.nr_queued == 0) {
+		return local;
 	}
 
-	CORE_LOCAL->pid = next_task->id.pid;
-	CORE_LOCAL->tid = next_task->id.tid;
-	CORE_LOCAL->nid = next_task->namespace->nid;
-	CORE_LOCAL->errno = next_task->errno;
+	spinrelease_irqdef(&idle->lock);
 
-	CORE_LOCAL->page_table = next_task->page_table;
+	return NULL;
+}
+
+static struct cpu_local *sched_select_idle(struct run_queue *queue, struct task *task) {
+	struct task *current = queue->current;
 
-	vmm_init_page_table(CORE_LOCAL->page_table);
+	if(current == NULL || current->sched_status == TASK_YIELD || sched_check_preempt_wakeup(queue, current, task)) {
+		return NULL;
+	}
+
+	struct cpu_local *waker = CORE_LOCAL;
+	struct sched_domain *llc = sched_domain_llc(waker);
+
+	// a whole idle core behind the waker's cache beats the smt sibling of a busy one
+	if(llc) {
+		for(size_t i = 0; i < cpu_local_list.length; i++) {
+			if(!cpuset_test(&llc->span, i) || !sched_core_idle(cpu_local_list.data[i])) {
+				continue;
+			}
+
+			struct cpu_local *local = sched_try_idle(queue, task, i);
+			if(local) {
+				return local;
+			}
+		}
+	}
+
+	// otherwise any idle cpu, closest first
+	struct sched_domain *child = NULL;
+
+	for(struct sched_domain *domain = waker->sched_domain; domain; domain = domain->parent) {
+		for(size_t i = 0; i < cpu_local_list.length; i++) {
+			if(!cpuset_test(&domain->span, i) || (child && cpuset_test(&child->span, i))) {
+				continue;
+			}
+
+			struct cpu_local *local = sched_try_idle(queue, task, i);
+			if(local) {
+				return local;
+			}
+		}
+
+		child = domain;
+	}
+
+	return NULL;
+}
+
+void sched_timer_armed(uint64_t deadline) {
+	// timers live on the wheel of the cpu that armed them, so only the local tick needs pulling in
+	bool interrupts = get_interrupt_state();
+	asm volatile ("cli");
+
+	struct run_queue *queue = this_cpu_read(run_queue);
+
+	if(deadline < __atomic_load_n(&queue->next_tick, __ATOMIC_RELAXED)) {
+		uint64_t now = sched_clock();
+
+		__atomic_store_n(&queue->next_tick, deadline, __ATOMIC_RELAXED);
+		apic_timer_oneshot(deadline > now ? deadline - now : 1);
+	}
+
+	if(interrupts) {
+		asm volatile ("sti");
+	}
+}
+
+static void sched_idle(struct cpu_local *local) {
+	struct run_queue *queue = local->run_queue;
+
+	queue->current = NULL;
+	sched_update_load(queue);
+	sched_program_tick(local, NULL);
+
+	local->pid = -1;
+	local->tid = -1;
+	local->current_task = NULL;
+
+	fpu_idle();
+	rcu_idle_enter();
+
+	irqsoff_end();
+
+	// the stack we came in on may belong to a blocked task that another cpu is about to resume
+	asm volatile (
+		"mov %0, %%rsp\n\t"
+		"movb $0, (%1)\n\t"
+		"sti\n\t"
+		"1: hlt\n\t"
+		"jmp 1b\n\t"
+		:: "r" (local->idle_stack), "r" (&queue->lock.locked)
+	);
+
+	__builtin_unreachable();
+}
+
+static void schedule(struct registers *regs) {
+	struct cpu_local *local = CORE_LOCAL;
+	struct run_queue *queue = local->run_queue;
+
+	// before the queue lock, finished callbacks may wake tasks
+	rcu_check();
+
+	spinlock_irqdef(&queue->lock);
+
+	struct task *last_task = local->current_task;
+
+	sched_update_current(queue);
+
+	// set by a wakeup that should run ahead of the current task
+	bool need_resched = queue->need_resched;
+	queue->need_resched = false;
+
+	// a task whose affinity no longer covers this cpu has to give it up even with nothing else to run
+	bool allowed = last_task && sched_cpu_allowed(last_task, local->cpu_number);
+
+	if(last_task && allowed && last_task->sched_status != TASK_YIELD && !need_resched && !sched_check_preempt(queue, last_task)) {
+		signal_dispatch(last_task, regs);
+		sched_update_load(queue);
+		sched_program_tick(local, last_task);
+		spinrelease_irqdef(&queue->lock);
+		return;
+	}
+
+	struct task *next_task = sched_pick_buddy(queue, last_task);
+	bool handoff = next_task != NULL;
+
+	if(next_task == NULL) {
+		next_task = sched_pick_next(queue);
+	}
+
+	if(next_task == NULL) {
+		next_task = sched_steal(local);
+	}
+
+	if(next_task == NULL) {
+		if(last_task && allowed && last_task->sched_status != TASK_YIELD) {
+			signal_dispatch(last_task, regs);
+			sched_update_load(queue);
+			sched_program_tick(local, last_task);
+			spinrelease_irqdef(&queue->lock);
+			return;
+		}
+
+		// a blocked task is never resumed just because there is nothing else to do
+		if(last_task) {
+			sched_put_prev(local, last_task, NULL, regs);
+		}
+
+		sched_idle(local);
+	}
+
+	sched_queue_remove(queue, next_task);
+
+	if(last_task) {
+		sched_put_prev(local, last_task, next_task, regs);
+	}
+
+	local->pid = next_task->id.pid;
+	local->tid = next_task->id.tid;
+	local->nid = next_task->namespace->nid;
+	local->current_task = next_task;
+	local->errno = next_task->errno;
+
+	local->page_table = next_task->page_table;
+
+	vmm_init_page_table(local->page_table);
 
 	signal_dispatch(next_task, &next_task->regs);
 
-	CORE_LOCAL->kernel_stack = next_task->kernel_stack.sp;
-	CORE_LOCAL->user_stack = next_task->user_stack.sp;
+	local->kernel_stack = next_task->kernel_stack.sp;
+	local->user_stack = next_task->user_stack.sp;
 
-	next_task->idle_cnt = 0;
-	next_task->idle_cnt = 0;
 	next_task->sched_status = TASK_RUNNING;
+	next_task->on_cpu = true;
+	next_task->exec_start = sched_clock();
+	next_task->last_run = next_task->exec_start;
+	next_task->prev_sum_exec_runtime = next_task->sum_exec_runtime;
+
+	// the wakee carries on with what is left of the waker's slice
+	if(handoff) {
+		next_task->prev_sum_exec_runtime -= last_task->sum_exec_runtime - last_task->prev_sum_exec_runtime;
+	}
+
+	queue->current = next_task;
+	sched_update_load(queue);
+	sched_program_tick(local, next_task);
+
+	// threads mostly leave gs alone, so the bases often match and the writes can be skipped
+	uint64_t fs_base = last_task ? last_task->user_fs_base : get_user_fs();
+	uint64_t gs_base = last_task ? last_task->user_gs_base : get_user_gs();
+
+	if(next_task->user_fs_base != fs_base) {
+		set_user_fs(next_task->user_fs_base);
+	}
+
+	if(next_task->user_gs_base != gs_base) {
+		set_user_gs(next_task->user_gs_base);
+	}
 
-	set_user_fs(next_task->user_fs_base);
-	set_user_gs(next_task->user_gs_base);
+	fpu_switch_in(next_task);
 
 	if(next_task->regs.cs & 0x3) {
 		swapgs();
@@ -134,11 +820,12 @@ void reschedule(struct registers *regs, void*) {
 
 	//print("rescheduling to %x:%x to %x:%x [stack] %x:%x rax %x\n", next_task->regs.cs, next_task->regs.rip, next_task->id.pid, next_task->id.tid, next_task->regs.ss, next_task->regs.rsp, next_task->regs.rax);
 
-	xapic_write(XAPIC_EOI_OFF, 0);
-	spinrelease_irqsave(&sched_lock);
+	irqsoff_end();
 
+	// the queue lock is dropped only once we are off the old stack
 	asm volatile (
 		"mov %0, %%rsp\n\t"
+		"movb $0, (%1)\n\t"
 		"pop %%r15\n\t"
 		"pop %%r14\n\t"
 		"pop %%r13\n\t"
@@ -156,34 +843,455 @@ void reschedule(struct registers *regs, void*) {
 		"pop %%rax\n\t"
 		"addq $16, %%rsp\n\t"
 		"iretq\n\t"
-		:: "r" (&next_task->regs)
+		:: "r" (&next_task->regs), "r" (&queue->lock.locked)
 	);
 }
 
-void sched_dequeue(struct task *task) {
-	spinlock_irqsave(&sched_lock);
+static void sched_migrate_task(struct task *task) {
+	bool interrupts = get_interrupt_state();
+	asm volatile ("cli");
+
+	struct cpu_local *local = sched_select_cpu(task);
+	struct run_queue *target = local->run_queue;
+	struct run_queue *queue = sched_lock_queue_pair(task, target);
+
+	task->migrating = false;
+
+	// it may have been woken, blocked or killed while it was waiting to be moved
+	if(task->on_rq && !task->on_cpu && !task->queued && task->sched_status == TASK_WAITING) {
+		if(target != queue) {
+			task->vruntime = task->vruntime - queue->min_vruntime + target->min_vruntime;
+			task->cpu = local->cpu_number;
+			sched_update_load(queue);
+		}
+
+		sched_place_task(target, task, false);
+		sched_queue_insert(target, task, false);
+		sched_update_load(target);
+		sched_kick(target, task);
+	}
+
+	sched_unlock_queue_pair(queue, target);
+
+	if(interrupts) {
+		asm volatile ("sti");
+	}
+}
+
+static void sched_migrate_pending(struct cpu_local *local) {
+	struct run_queue *queue = local->run_queue;
+
+	if(__atomic_load_n(&queue->migrate_list, __ATOMIC_RELAXED) == NULL) {
+		return;
+	}
+
+	spinlock_irqdef(&queue->lock);
+
+	struct task *task = queue->migrate_list;
+	queue->migrate_list = NULL;
+
+	spinrelease_irqdef(&queue->lock);
+
+	while(task) {
+		struct task *next = task->migrate_next;
+		task->migrate_next = NULL;
+
+		sched_migrate_task(task);
+
+		task = next;
+	}
+}
+
+static void sched_migrate_cancel(struct run_queue *queue, struct task *task) {
+	for(struct task **link = &queue->migrate_list; *link; link = &(*link)->migrate_next) {
+		if(*link == task) {
+			*link = task->migrate_next;
+			task->migrate_next = NULL;
+			task->migrating = false;
+			return;
+		}
+	}
+}
+
+void reschedule(struct registers*, void*) {
+	clock_update();
+	raise_softirq(SOFTIRQ_TIMER);
+}
+
+// the tail of the tick, called once it has been acked and the expired timers ran
+void sched_tick(struct registers *regs) {
+	// the tick landed on top of running softirq actions, they reschedule once they are done
+	if(softirq_defer_resched()) {
+		return;
+	}
+
+	sched_migrate_pending(CORE_LOCAL);
+
+	schedule(regs);
+}
+
+extern void sched_switch_main(struct registers *regs) {
+	sched_migrate_pending(CORE_LOCAL);
+
+	schedule(regs);
+}
+
+void sched_enqueue(struct task *task) {
+	struct cpu_local *target = sched_select_cpu(task);
+
+	struct run_queue *queue = target->run_queue;
+
+	spinlock_irqsave(&queue->lock);
+
+	task->cpu = target->cpu_number;
+	task->last_run = 0;
+	task->on_rq = true;
+
+	if(task->weight == 0) {
+		task->weight = sched_nice_to_weight[task->nice - NICE_MIN];
+	}
+
+	sched_update_current(queue);
+	sched_place_task(queue, task, true);
+
+	if(task->policy == SCHED_RR && task->rt_time_slice == 0) {
+		task->rt_time_slice = SCHED_RR_TIMESLICE;
+	}
+
+	if(task->sched_status == TASK_WAITING && !task->on_cpu) {
+		sched_queue_insert(queue, task, false);
+		sched_kick(queue, task);
+	}
+
+	// account for the new task straight away so back to back forks spread out
+	__atomic_add_fetch(&queue->load, 1, __ATOMIC_RELAXED);
+
+	spinrelease_irqsave(&queue->lock);
+}
+
+void sched_remove(struct task *task) {
+	struct run_queue *queue = sched_lock_queue(task);
+
+	if(task->queued) {
+		sched_queue_remove(queue, task);
+	}
+
+	if(task->migrating) {
+		sched_migrate_cancel(queue, task);
+	}
+
+	if(queue->current == task) {
+		sched_update_current(queue);
+		queue->current = NULL;
+	}
+
+	task->on_rq = false;
+
+	sched_update_load(queue);
+
+	spinrelease_irqsave(&queue->lock);
+}
+
+void sched_dequeue(struct task *task) {
+	if(task == NULL) {
+		return;
+	}
+
+	struct run_queue *queue = sched_lock_queue(task);
+
+	if(queue->current == task) {
+		sched_update_current(queue);
+	}
+
+	if(task->queued) {
+		sched_queue_remove(queue, task);
+	}
+
+	task->sched_status = TASK_YIELD;
+
+	sched_update_load(queue);
+
+	spinrelease_irqsave(&queue->lock);
+}
+
+void sched_requeue(struct task *task) {
+	struct run_queue *queue = sched_lock_queue(task);
+
+	task->sched_status = TASK_WAITING;
+
+	// the affinity was changed while it slept, the cpu it blocked on is no longer an option
+	if(task->on_rq && !task->on_cpu && !task->queued && !task->migrating && !sched_cpu_allowed(task, task->cpu)) {
+		spinrelease_irqsave(&queue->lock);
+		sched_migrate_task(task);
+		return;
+	}
+
+	if(task->on_rq && !task->on_cpu && !task->queued && !task->migrating) {
+		// rather than wait behind a busy cpu the wakee moves to one that is halted
+		struct cpu_local *idle = sched_select_idle(queue, task);
+
+		if(idle) {
+			struct run_queue *target = idle->run_queue;
+
+			task->vruntime = task->vruntime - queue->min_vruntime + target->min_vruntime;
+			task->cpu = idle->cpu_number;
+
+			sched_place_task(target, task, false);
+			sched_queue_insert(target, task, false);
+			sched_update_load(target);
+			sched_kick(target, task);
+
+			spinrelease_irqdef(&target->lock);
+		} else {
+			sched_place_task(queue, task, false);
+			sched_queue_insert(queue, task, false);
+			sched_kick(queue, task);
+		}
+	}
+
+	sched_update_load(queue);
+
+	spinrelease_irqsave(&queue->lock);
+}
+
+// end of every syscall. a waker that did not block after all must not leave its wakee sitting
+// behind it until the next tick while other cpus are halted
+void sched_sync_finish() {
+	struct task *waker = CURRENT_TASK;
+	if(waker == NULL || waker->sync_wakee == NULL) {
+		return;
+	}
+
+	struct task *task = waker->sync_wakee;
+	waker->sync_wakee = NULL;
+
+	struct cpu_local *local = CORE_LOCAL;
+	struct run_queue *queue = sched_lock_queue(task);
+
+	// it already ran, or somebody else moved it on since
+	if(!task->queued || task->on_cpu || task->migrating || task->cpu != local->cpu_number) {
+		spinrelease_irqsave(&queue->lock);
+		return;
+	}
+
+	if(queue->next_buddy == task) {
+		queue->next_buddy = NULL;
+	}
+
+	struct cpu_local *idle = sched_select_idle(queue, task);
+
+	if(idle) {
+		struct run_queue *target = idle->run_queue;
+
+		sched_queue_remove(queue, task);
+		sched_update_load(queue);
+
+		task->vruntime = task->vruntime - queue->min_vruntime + target->min_vruntime;
+		task->cpu = idle->cpu_number;
+
+		sched_place_task(target, task, false);
+		sched_queue_insert(target, task, false);
+		sched_update_load(target);
+		sched_kick(target, task);
+
+		spinrelease_irqdef(&target->lock);
+	} else {
+		// the tick was armed for a cpu the waker had to itself
+		sched_kick(queue, task);
+		sched_program_tick(local, waker);
+	}
+
+	spinrelease_irqsave(&queue->lock);
+}
+
+void sched_requeue_sync(struct task *task) {
+	struct task *waker = CURRENT_TASK;
+
+	if(waker == NULL || waker == task || SCHED_POLICY_RT(waker->policy) || SCHED_POLICY_RT(task->policy)) {
+		sched_requeue(task);
+		return;
+	}
+
+	struct cpu_local *local = CORE_LOCAL;
+	struct run_queue *queue = sched_lock_queue(task);
+	struct run_queue *target = local->run_queue;
+
+	if(!task->on_rq || task->on_cpu || task->queued || task->migrating) {
+		task->sched_status = TASK_WAITING;
+		spinrelease_irqsave(&queue->lock);
+		return;
+	}
+
+	if(!sched_cpu_allowed(task, local->cpu_number)) {
+		spinrelease_irqsave(&queue->lock);
+		sched_requeue(task);
+		return;
+	}
+
+	// pull the wakee next to the waker, its data was just written on this cpu
+	if(target != queue && !spinlock_try_irqdef(&target->lock)) {
+		spinrelease_irqsave(&queue->lock);
+		sched_requeue(task);
+		return;
+	}
+
+	task->sched_status = TASK_WAITING;
+
+	if(target != queue) {
+		task->vruntime = task->vruntime - queue->min_vruntime + target->min_vruntime;
+		task->cpu = local->cpu_number;
+		sched_update_load(queue);
+	}
+
+	sched_place_task(target, task, false);
+	sched_queue_insert(target, task, false);
+	sched_update_load(target);
+
+	// no ipi, the waker is expected to block right away and hand the cpu over. if it goes back
+	// to userspace instead, sched_sync_finish places the wakee properly
+	target->next_buddy = task;
+	waker->sync_wakee = task;
+
+	if(target != queue) {
+		spinrelease_irqdef(&target->lock);
+	}
+
+	spinrelease_irqsave(&queue->lock);
+}
+
+int sched_set_nice(struct task *task, int nice) {
+	if(nice < NICE_MIN) {
+		nice = NICE_MIN;
+	} else if(nice > NICE_MAX) {
+		nice = NICE_MAX;
+	}
+
+	if(!task->on_rq) {
+		task->nice = nice;
+		task->weight = sched_nice_to_weight[nice - NICE_MIN];
+		return 0;
+	}
+
+	struct run_queue *queue = sched_lock_queue(task);
+
+	if(queue->current == task) {
+		sched_update_current(queue);
+	}
+
+	bool queued = task->queued;
+	if(queued) {
+		sched_queue_remove(queue, task);
+	}
+
+	task->nice = nice;
+	task->weight = sched_nice_to_weight[nice - NICE_MIN];
+
+	if(queued) {
+		sched_queue_insert(queue, task, false);
+	}
+
+	spinrelease_irqsave(&queue->lock);
+
+	return 0;
+}
+
+int sched_set_policy(struct task *task, int policy, int priority) {
+	if(policy != SCHED_OTHER && policy != SCHED_FIFO && policy != SCHED_RR) {
+		set_errno(EINVAL);
+		return -1;
+	}
+
+	if((SCHED_POLICY_RT(policy) && (priority < SCHED_RT_PRIORITY_MIN || priority > SCHED_RT_PRIORITY_MAX)) ||
+		(!SCHED_POLICY_RT(policy) && priority != 0)) {
+		set_errno(EINVAL);
+		return -1;
+	}
+
+	if(!task->on_rq) {
+		task->policy = policy;
+		task->rt_priority = priority;
+		task->rt_time_slice = SCHED_RR_TIMESLICE;
+		return 0;
+	}
+
+	struct run_queue *queue = sched_lock_queue(task);
+
+	if(queue->current == task) {
+		sched_update_current(queue);
+	}
+
+	bool queued = task->queued;
+	if(queued) {
+		sched_queue_remove(queue, task);
+	}
+
+	// a task joining the fair class starts level with everyone else
+	if(SCHED_POLICY_RT(task->policy) && !SCHED_POLICY_RT(policy)) {
+		task->vruntime = queue->min_vruntime;
+	}
+
+	task->policy = policy;
+	task->rt_priority = priority;
+	task->rt_time_slice = SCHED_RR_TIMESLICE;
+
+	if(queued) {
+		sched_queue_insert(queue, task, false);
+	}
+
+	sched_update_load(queue);
+
+	spinrelease_irqsave(&queue->lock);
+
+	return 0;
+}
+
+int sched_set_affinity(struct task *task, const struct cpuset *mask) {
+	struct cpuset affinity;
+	cpuset_and(&affinity, mask, &cpu_online_mask);
+
+	if(cpuset_empty(&affinity)) {
+		set_errno(EINVAL);
+		return -1;
+	}
+
+	if(!task->on_rq) {
+		task->affinity = affinity;
+		return 0;
+	}
 
-	if(task) {
-		task->sched_status = TASK_YIELD;
+	struct run_queue *queue = sched_lock_queue(task);
+
+	task->affinity = affinity;
+
+	if(sched_cpu_allowed(task, task->cpu) || task->migrating) {
+		spinrelease_irqsave(&queue->lock);
+		return 0;
 	}
 
-	spinrelease_irqsave(&sched_lock);
-}
+	if(task->queued) {
+		sched_queue_remove(queue, task);
+		sched_update_load(queue);
+		spinrelease_irqsave(&queue->lock);
 
-void sched_requeue(struct task *task) {
-	spinlock_irqsave(&sched_lock);
+		sched_migrate_task(task);
+		return 0;
+	}
 
-	task->sched_status = TASK_WAITING;
-	task->idle_cnt = TASK_MAX_PRIORITY;
+	// a running task is pushed off by its own cpu, a sleeping one moves once it is woken up
+	if(task->on_cpu) {
+		queue->need_resched = true;
+		xapic_send_ipi(cpu_local_list.data[task->cpu]->apic_id, SCHED_VECTOR);
+	}
 
-	spinrelease_irqsave(&sched_lock);
+	spinrelease_irqsave(&queue->lock);
+
+	return 0;
 }
 
 void sched_yield() {
 	asm volatile ("sti");
 
-	xapic_write(XAPIC_ICR_OFF + 0x10, CORE_LOCAL->apic_id << 24);
-	xapic_write(XAPIC_ICR_OFF, 32);
+	xapic_send_ipi(this_cpu_read(apic_id), SCHED_VECTOR);
 
 	for(;;) {
 		asm volatile ("hlt");
@@ -194,16 +1302,18 @@ int sched_default_task(struct task *task, struct pid_namespace *namespace, int q
 	spinlock_irqsave(&sched_lock);
 
 	task->namespace = namespace;
-	task->id.pid = bitmap_alloc(&namespace->pid_bitmap);
+
+	// reserved for now, nothing should find the task before it is set up
+	task->id.pid = idr_alloc_cyclic(&namespace->pids, NULL, 0, PID_MAX);
 
 	task->fd_table = alloc(sizeof(struct fd_table));
 	fd_table_init(task->fd_table);
 
 	task->thread_group = sched_default_namespace();
-	task->id.tid = bitmap_alloc(&task->thread_group->pid_bitmap);
-	hash_table_push(&task->thread_group->process_list, &task->id.tid, task, sizeof(task->id.tid));
+	task->id.tid = idr_alloc_cyclic(&task->thread_group->pids, task, 0, PID_MAX);
 
 	task->sched_status = TASK_YIELD;
+	task->affinity = cpu_housekeeping_mask;
 
 	task->waitq = alloc(sizeof(struct waitq));
 	task->status_trigger = waitq_alloc(task->waitq, EVENT_PROCESS_STATUS);
@@ -244,14 +1354,12 @@ int sched_default_task(struct task *task, struct pid_namespace *namespace, int q
 	task->signal_kernel_stack.sp = pmm_alloc(DIV_ROUNDUP(THREAD_KERNEL_STACK_SIZE, PAGE_SIZE), 1) + THREAD_KERNEL_STACK_SIZE + HIGH_VMA;
 	task->signal_kernel_stack.size = THREAD_KERNEL_STACK_SIZE;
 
-	hash_table_push(&namespace->process_list, &task->id.pid, task, sizeof(task->id.pid));
+	idr_replace(&namespace->pids, task->id.pid, task);
 
 	task->id.nid = namespace->nid;
-	task->id.pid = task->id.pid;
-	task->id.tid = task->id.tid;
 
 	if(queue) {
-		VECTOR_PUSH(task_queue, task);
+		sched_enqueue(task);
 	}
 
 	spinrelease_irqsave(&sched_lock);
@@ -331,20 +1439,15 @@ int sched_default_task(struct task *task, struct pid_namespace *namespace, int q
 struct pid_namespace *sched_default_namespace() {
 	struct pid_namespace *namespace = alloc(sizeof(struct pid_namespace));
 
-	namespace->nid = bitmap_alloc(&nid_bitmap);
-	namespace->pid_bitmap = (struct bitmap) {
-		.data = NULL,
-		.size = 0,
-		.resizable = true
-	};
-
-	hash_table_push(&namespace_list, &namespace->nid, namespace, sizeof(namespace->nid));
+	namespace->pids = (struct idr) { 0 };
+	namespace->nid = idr_alloc(&namespace_list, namespace, 0, 0);
 
 	return namespace;
 }
 
 int sched_task_init(struct task *task, char **envp, char **argv) {
 	spinlock_irqsave(&sched_lock);
+	mutex_nosleep_begin();
 
 	struct task *current_task = CURRENT_TASK;
 	if(current_task == NULL) {
@@ -355,8 +1458,9 @@ int sched_task_init(struct task *task, char **envp, char **argv) {
 		panic("");
 	}
 
-	CORE_LOCAL->pid = task->id.pid;
-	CORE_LOCAL->tid = task->id.tid;
+	this_cpu_write(pid, task->id.pid);
+	this_cpu_write(tid, task->id.tid);
+	this_cpu_write(current_task, task);
 
 	vmm_init_page_table(task->page_table);
 
@@ -378,11 +1482,13 @@ int sched_task_init(struct task *task, char **envp, char **argv) {
 
 	int ret = program_place_parameters(&task->program, envp, argv);
 
-	CORE_LOCAL->pid = current_task->id.pid;
-	CORE_LOCAL->tid = current_task->id.tid;
+	this_cpu_write(pid, current_task->id.pid);
+	this_cpu_write(tid, current_task->id.tid);
+	this_cpu_write(current_task, current_task);
 
 	vmm_init_page_table(current_task->page_table);
 
+	mutex_nosleep_end();
 	spinrelease_irqsave(&sched_lock);
 
 	if(ret == -1) {
@@ -393,7 +1499,9 @@ int sched_task_init(struct task *task, char **envp, char **argv) {
 }
 
 int sched_load_program(struct task *task, const char *path) {
+	// the program is loaded wearing the new task's identity, nothing in there may sleep
 	spinlock_irqsave(&sched_lock);
+	mutex_nosleep_begin();
 
 	struct task *current_task = CURRENT_TASK;
 	if(current_task == NULL) {
@@ -403,19 +1511,23 @@ int sched_load_program(struct task *task, const char *path) {
 	task->program.task = task;
 
 	vmm_init_page_table(task->page_table);
-	CORE_LOCAL->tid = task->id.tid;
-	CORE_LOCAL->pid = task->id.pid;
+	this_cpu_write(tid, task->id.tid);
+	this_cpu_write(pid, task->id.pid);
+	this_cpu_write(current_task, task);
 
 	int ret = program_load(&task->program, path);
 	if(ret == -1) {
+		mutex_nosleep_end();
 		spinrelease_irqsave(&sched_lock);
 		return -1;
 	}
 
 	vmm_init_page_table(current_task->page_table);
-	CORE_LOCAL->tid = current_task->id.tid;
-	CORE_LOCAL->pid = current_task->id.pid;
+	this_cpu_write(tid, current_task->id.tid);
+	this_cpu_write(pid, current_task->id.pid);
+	this_cpu_write(current_task, current_task);
 
+	mutex_nosleep_end();
 	spinrelease_irqsave(&sched_lock);
 
 	return 0;
@@ -488,7 +1600,7 @@ void syscall_waitpid(struct registers *regs) {
 	int options = regs->rdx;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] waitpid: pid {%x}, status {%x}, options {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, pid, (uintptr_t)status, options);
+	print("syscall: [pid %x, tid %x] waitpid: pid {%x}, status {%x}, options {%x}\n", this_cpu_read(pid), this_cpu_read(tid), pid, (uintptr_t)status, options);
 #endif
 
 	asm volatile ("cli");
@@ -585,9 +1697,148 @@ finish:
 	regs->rax = ret;
 }
 
+// what is left of a dead task once it is off the cpu. queued on the worker of the cpu it died
+// on, which can not run before that cpu has left the dying stack
+struct task_reap {
+	struct work work;
+
+	struct page_table *page_table;
+	VECTOR(struct stack) stacks;
+
+	// threads taken down from another cpu may still be on their way out of schedule there,
+	// their stacks are only looked at once they are off it
+	VECTOR(struct task*) threads;
+	bool remote;
+
+	pid_t pid;
+	uint64_t exit_start;
+	uint64_t exit_time;
+};
+
+static bool task_reap_stack_holds(struct stack *stack, void *ptr) {
+	return (uintptr_t)ptr >= stack->sp - stack->size && (uintptr_t)ptr < stack->sp;
+}
+
+// a thread killed in its sleep never unwinds, whatever its frame hooked into the rest of the
+// kernel is undone here. returns false if it sleeps on a waitq of its own stack we can not undo
+static bool task_reap_unhook(struct task *task) {
+	bool unhooked = false;
+
+	// the timer's triggers point at the sleeper's waitq, it goes before the waiter
+	if(task->sleep_timer) {
+		waitq_cancel_timer(task->blocked_on, task->sleep_timer);
+		task->sleep_timer = NULL;
+		unhooked = true;
+	}
+
+	if(task->futex_waiter) {
+		futex_cancel(task->futex_waiter);
+		task->futex_waiter = NULL;
+		unhooked = true;
+	}
+
+	struct waitq *waitq = task->blocked_on;
+
+	if(unhooked || waitq == NULL) {
+		return true;
+	}
+
+	return !task_reap_stack_holds(&task->kernel_stack, waitq) && !task_reap_stack_holds(&task->signal_kernel_stack, waitq);
+}
+
+static void task_reap_work(struct work *work) {
+	struct task_reap *reap = (struct task_reap*)work;
+
+	// a remote cpu reports the first grace period on entry to schedule, only the next one
+	// happens after it switched its page table and stack away from the thread
+	if(reap->remote) {
+		synchronize_rcu();
+		synchronize_rcu();
+	}
+
+	for(size_t i = 0; i < reap->threads.length; i++) {
+		struct task *thread = reap->threads.data[i];
+
+		if(task_reap_unhook(thread)) {
+			VECTOR_PUSH(reap->stacks, thread->kernel_stack);
+			VECTOR_PUSH(reap->stacks, thread->signal_kernel_stack);
+		} else {
+			print("sched: [pid %x, tid %x] killed in a sleep on its own stack, stacks kept\n", thread->id.pid, thread->id.tid);
+		}
+	}
+
+#ifndef SYSCALL_DEBUG
+	uint64_t start = clock_monotonic_ns();
+#endif
+
+	struct pmm_batch batch = { 0 };
+
+	if(reap->page_table) {
+		vmm_destroy_page_table(reap->page_table, &batch);
+	}
+
+	for(size_t i = 0; i < reap->stacks.length; i++) {
+		struct stack *stack = &reap->stacks.data[i];
+		pmm_batch_add(&batch, stack->sp - stack->size - HIGH_VMA, DIV_ROUNDUP(stack->size, PAGE_SIZE));
+	}
+
+	pmm_batch_flush(&batch);
+
+#ifndef SYSCALL_DEBUG
+	print("sched: [pid %x] teardown: exit {%dns}, reclaim {%dns}, frames {%x}\n", reap->pid, reap->exit_time, clock_monotonic_ns() - start, batch.freed);
+#endif
+
+	VECTOR_CLEAR(reap->stacks);
+	VECTOR_CLEAR(reap->threads);
+	free(reap);
+}
+
+static struct task_reap *task_reap_alloc(struct task *task) {
+	struct task_reap *reap = alloc(sizeof(struct task_reap));
+
+	work_init(&reap->work, task_reap_work);
+	reap->pid = task->id.pid;
+	reap->exit_start = clock_monotonic_ns();
+
+	return reap;
+}
+
+static void task_reap_page_table(struct task_reap *reap, struct task *task) {
+	struct page_table *page_table = task->page_table;
+
+	if(__atomic_sub_fetch(&page_table->refcnt, 1, __ATOMIC_ACQ_REL) == 0) {
+		reap->page_table = page_table;
+	}
+}
+
+// the thread is already off the run queues, its stacks and its hold on the page table go
+static void task_reap_thread(struct task_reap *reap, struct task *task) {
+	VECTOR_PUSH(reap->stacks, task->kernel_stack);
+	VECTOR_PUSH(reap->stacks, task->signal_kernel_stack);
+
+	task_reap_page_table(reap, task);
+}
+
+// a sibling killed wherever it was, its stacks wait until the worker has unhooked it
+static void task_reap_remote(struct task_reap *reap, struct task *task) {
+	VECTOR_PUSH(reap->threads, task);
+	reap->remote = true;
+
+	task_reap_page_table(reap, task);
+}
+
+static void task_reap_queue(struct task_reap *reap) {
+	reap->exit_time = clock_monotonic_ns() - reap->exit_start;
+	queue_work_on(this_cpu_read(cpu_number), &reap->work);
+}
+
 void task_terminate(struct task *task, int status) {
 	asm volatile ("cli");
 
+	struct task_reap *reap = task_reap_alloc(task);
+
+	fpu_release(task);
+
 	task->fd_table->refcnt--;
 	if(task->fd_table->refcnt == 0) {
 		for(size_t i = 0; i < task->fd_table->fd_bitmap.size; i++) {
@@ -598,41 +1849,24 @@ void task_terminate(struct task *task, int status) {
 	}
 
 	if(task->id.tid == 0) {
-		for(size_t i = 0; i < task->thread_group->process_list.capacity; i++) {
-			struct task *thread = task->thread_group->process_list.data[i];
-			if(thread == NULL) {
-				continue;
-			}
+		struct task *thread;
 
+		for(int tid = 0; (thread = idr_get_next(&task->thread_group->pids, &tid)); tid++) {
 			thread->sched_status = TASK_YIELD;
-			hash_table_delete(&task->thread_group->process_list, &thread->id.tid, sizeof(thread->id.tid));
-			VECTOR_REMOVE_BY_VALUE(task_queue, thread);
+			idr_remove(&task->thread_group->pids, tid);
+			sched_remove(thread);
+
+			if(thread != task) {
+				task_reap_remote(reap, thread);
+			}
 		}
 	} else {
 		task->sched_status = TASK_YIELD;
-		hash_table_delete(&task->thread_group->process_list, &task->id.tid, sizeof(task->id.tid));
-		VECTOR_REMOVE_BY_VALUE(task_queue, task);
+		idr_remove(&task->thread_group->pids, task->id.tid);
+		sched_remove(task);
 	}
 
-	struct page_table *page_table = task->page_table;
-
-	page_table->refcnt--;
-	if(page_table->refcnt == 0) {
-		for(size_t i = 0; i < page_table->pages->capacity; i++) {
-			struct page *page = page_table->pages->data[i];
-
-			if(page) {
-				hash_table_delete(page_table->pages, &page->vaddr, sizeof(page->vaddr));
-
-				if((*page->reference) <= 1) { // shared page
-					(*page->reference)--;
-					continue;
-				}
-
-				pmm_free(page->frame->addr, 1);
-			}
-		}
-	}
+	task_reap_thread(reap, task);
 
 	signal_send_task(NULL, task, SIGCHLD);
 
@@ -665,14 +1899,18 @@ void task_terminate(struct task *task, int status) {
 	task->sched_status = TASK_YIELD;
 
 	if(task->id.tid == 0) {
-		hash_table_delete(&task->namespace->process_list, &task->id.pid, sizeof(task->id.pid));
+		idr_remove(&task->namespace->pids, task->id.pid);
 	}
 
-	CORE_LOCAL->pid = -1;
-	CORE_LOCAL->tid = -1;
+	this_cpu_write(pid, -1);
+	this_cpu_write(tid, -1);
+	this_cpu_write(current_task, NULL);
+	this_cpu_write(page_table, &kernel_mappings);
 
 	vmm_init_page_table(&kernel_mappings);
 
+	task_reap_queue(reap);
+
 	asm volatile ("sti");
 
 	sched_yield();
@@ -715,6 +1953,7 @@ struct task *clone(int flags, void *child_stack, pid_t *ptid, pid_t *ctid, void
 
 	task_lock(current_task);
 	spinlock_irqsave(&sched_lock);
+	mutex_nosleep_begin();
 
 	if((flags & CLONE_FILES) == CLONE_FILES) {
 		spinlock_irqsave(&current_task->fd_table->fd_lock);
@@ -727,13 +1966,15 @@ struct task *clone(int flags, void *child_stack, pid_t *ptid, pid_t *ctid, void
 		task->fd_table = alloc(sizeof(struct fd_table));
 		fd_table_init(task->fd_table);
 
-		for(size_t i = 0; i < current_task->fd_table->fd_list.capacity; i++) {
-			struct fd_handle *handle = current_task->fd_table->fd_list.data[i];
+		struct fd_array *fd_array = current_task->fd_table->fd_array;
+
+		for(size_t i = 0; fd_array && i < fd_array->capacity; i++) {
+			struct fd_handle *handle = fd_array->handles[i];
 			if(handle) {
 				struct fd_handle *new_handle = alloc(sizeof(struct fd_handle));
 				*new_handle = *handle;
 				file_get(new_handle->file_handle);
-				hash_table_push(&task->fd_table->fd_list, &new_handle->fd_number, new_handle, sizeof(new_handle->fd_number));
+				fd_table_install(task->fd_table, new_handle);
 			}
 		}
 
@@ -768,14 +2009,17 @@ struct task *clone(int flags, void *child_stack, pid_t *ptid, pid_t *ctid, void
 		memcpy(task->sigactions, current_task->sigactions, SIGNAL_MAX * sizeof(struct sigaction));
 	}
 
-	task->user_gs_base = CURRENT_TASK->user_gs_base;
+	// userspace may have moved its bases with wrfsbase since it was last switched out
+	task->user_gs_base = get_user_gs();
 
 	if((flags & CLONE_SETTLS) == CLONE_SETTLS) {
 		task->user_fs_base = (uint64_t)newtls;
 	} else {
-		task->user_fs_base = CURRENT_TASK->user_fs_base;
+		task->user_fs_base = get_user_fs();
 	}
 
+	fpu_fork(current_task, task);
+
 	if((flags & CLONE_NEWPID) == CLONE_NEWPID) {
 		task->namespace = sched_default_namespace();
 	} else {
@@ -787,19 +2031,16 @@ struct task *clone(int flags, void *child_stack, pid_t *ptid, pid_t *ctid, void
 		task->id.pid = current_task->id.pid;
 	} else {
 		task->thread_group = sched_default_namespace();
-		task->id.pid = bitmap_alloc(&task->namespace->pid_bitmap);
+		task->id.pid = idr_alloc_cyclic(&task->namespace->pids, task, 0, PID_MAX);
 	}
 
-	task->id.tid = bitmap_alloc(&task->thread_group->pid_bitmap);
-	hash_table_push(&task->thread_group->process_list, &task->id.tid, task, sizeof(task->id.tid));
-
-	hash_table_push(&task->namespace->process_list, &task->id.pid, task, sizeof(task->id.pid));
-	VECTOR_PUSH(task_queue, task);
+	task->id.tid = idr_alloc_cyclic(&task->thread_group->pids, task, 0, PID_MAX);
 
 	task->regs = *regs;
 
 	if((flags & CLONE_VM) == CLONE_VM) {
 		task->page_table = current_task->page_table;
+		__atomic_add_fetch(&task->page_table->refcnt, 1, __ATOMIC_RELAXED);
 		task->regs.rsp = (uint64_t)child_stack;
 
 		task->user_stack = (struct stack) {
@@ -812,31 +2053,35 @@ struct task *clone(int flags, void *child_stack, pid_t *ptid, pid_t *ctid, void
 	}
 
 	if((flags & CLONE_CHILD_SETTID) == CLONE_CHILD_SETTID && ctid != NULL) {
-		CORE_LOCAL->pid = task->id.pid;
-		CORE_LOCAL->tid = task->id.tid;
+		this_cpu_write(pid, task->id.pid);
+		this_cpu_write(tid, task->id.tid);
+		this_cpu_write(current_task, task);
 
 		vmm_init_page_table(task->page_table);
 
 		*ctid = task->id.tid;
 
-		vmm_init_page_table(CORE_LOCAL->page_table);
+		vmm_init_page_table(this_cpu_read(page_table));
 
-		CORE_LOCAL->pid = current_task->id.pid;
-		CORE_LOCAL->tid = current_task->id.tid;
+		this_cpu_write(pid, current_task->id.pid);
+		this_cpu_write(tid, current_task->id.tid);
+		this_cpu_write(current_task, current_task);
 	}
 
 	if((flags & CLONE_PARENT_SETTID) == CLONE_PARENT_SETTID && ptid != NULL) {
-		CORE_LOCAL->pid = task->id.pid;
-		CORE_LOCAL->tid = task->id.tid;
+		this_cpu_write(pid, task->id.pid);
+		this_cpu_write(tid, task->id.tid);
+		this_cpu_write(current_task, task);
 
 		vmm_init_page_table(task->page_table);
 
 		*ptid = task->id.tid;
 
-		vmm_init_page_table(CORE_LOCAL->page_table);
+		vmm_init_page_table(this_cpu_read(page_table));
 
-		CORE_LOCAL->pid = current_task->id.pid;
-		CORE_LOCAL->tid = current_task->id.tid;
+		this_cpu_write(pid, current_task->id.pid);
+		this_cpu_write(tid, current_task->id.tid);
+		this_cpu_write(current_task, current_task);
 	}
 
 	task->sched_status = TASK_WAITING;
@@ -844,6 +2089,11 @@ struct task *clone(int flags, void *child_stack, pid_t *ptid, pid_t *ctid, void
 	task->group = current_task->group;
 	task->session = current_task->session;
 
+	task->nice = current_task->nice;
+	task->policy = current_task->policy;
+	task->rt_priority = current_task->rt_priority;
+	task->affinity = current_task->affinity;
+
 	task->real_uid = current_task->real_uid;
 	task->effective_uid = current_task->effective_uid;
 	task->saved_uid = current_task->saved_uid;
@@ -864,6 +2114,9 @@ struct task *clone(int flags, void *child_stack, pid_t *ptid, pid_t *ctid, void
 
 	VECTOR_PUSH(current_task->children, task);
 
+	sched_enqueue(task);
+
+	mutex_nosleep_end();
 	spinrelease_irqsave(&sched_lock);
 	task_unlock(current_task);
 
@@ -872,7 +2125,7 @@ struct task *clone(int flags, void *child_stack, pid_t *ptid, pid_t *ctid, void
 
 void syscall_exit(struct registers *regs) {
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] exit: status {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, regs->rdi);
+	print("syscall: [pid %x, tid %x] exit: status {%x}\n", this_cpu_read(pid), this_cpu_read(tid), regs->rdi);
 #endif
 	struct task *task = CURRENT_TASK;
 	if(task == NULL) {
@@ -944,7 +2197,7 @@ void syscall_execve(struct registers *regs) {
 	struct task *parent = current_task->parent;
 	VECTOR_REMOVE_BY_VALUE(parent->children, current_task);
 	VECTOR_REMOVE_BY_VALUE(parent->group->process_list, current_task);
-	VECTOR_REMOVE_BY_VALUE(task_queue, current_task);
+	sched_remove(current_task);
 
 	if(stat_has_access(vfs_node->stat, current_task->effective_uid,
 		current_task->effective_gid, X_OK) == -1) {
@@ -983,18 +2236,23 @@ void syscall_execve(struct registers *regs) {
 				continue;
 			}
 
-			hash_table_push(&task->fd_table->fd_list, &handle->fd_number, handle, sizeof(handle->fd_number));
+			fd_table_install(task->fd_table, handle);
 		}
 	}
 
-	hash_table_delete(&task->namespace->process_list, &current_task->id.pid, sizeof(current_task->id.pid));
-	hash_table_delete(&task->namespace->process_list, &task->id.pid, sizeof(task->id.pid));
+	// the new image takes over the pid, the one it was created with goes back
+	idr_remove(&task->namespace->pids, task->id.pid);
 
 	task->cwd = current_task->cwd;
 	task->id.pid = current_task->id.pid;
 	task->parent = current_task->parent;
 	task->status_trigger = current_task->status_trigger;
 
+	task->nice = current_task->nice;
+	task->policy = current_task->policy;
+	task->rt_priority = current_task->rt_priority;
+	task->affinity = current_task->affinity;
+
 	task->real_uid = current_task->real_uid;
 	task->effective_uid = is_suid ? vfs_node->stat->st_uid : current_task->effective_uid;
 	task->saved_uid = task->effective_uid;
@@ -1027,13 +2285,26 @@ void syscall_execve(struct registers *regs) {
 	VECTOR_PUSH(parent->children, task);
 	VECTOR_PUSH(task->group->process_list, task);
 
-	CORE_LOCAL->pid = -1;
-	CORE_LOCAL->tid = -1;
+	// the new image starts out with a clean fpu
+	fpu_release(current_task);
 
-	hash_table_push(&task->namespace->process_list, &task->id.pid, task, sizeof(task->id.pid));
-	VECTOR_PUSH(task_queue, task);
+	// the old image goes the same way an exiting one does
+	struct task_reap *reap = task_reap_alloc(current_task);
+	task_reap_thread(reap, current_task);
+
+	this_cpu_write(pid, -1);
+	this_cpu_write(tid, -1);
+	this_cpu_write(current_task, NULL);
+	this_cpu_write(page_table, &kernel_mappings);
+
+	vmm_init_page_table(&kernel_mappings);
+
+	task_reap_queue(reap);
+
+	idr_replace(&task->namespace->pids, task->id.pid, task);
 
 	task->sched_status = TASK_WAITING;
+	sched_enqueue(task);
 
 	sched_yield();
 }
@@ -1055,7 +2326,7 @@ void syscall_clone(struct registers *regs) {
 	void *tls = (void*)clone_args->tls;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] clone: stack {%x}, flags {%x}, ptid {%x}, tls {%x}, ctid {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, stack, flags, ptid, tls, ctid);
+	print("syscall: [pid %x, tid %x] clone: stack {%x}, flags {%x}, ptid {%x}, tls {%x}, ctid {%x}\n", this_cpu_read(pid), this_cpu_read(tid), stack, flags, ptid, tls, ctid);
 #endif
 
 	struct registers registers = *regs;
@@ -1075,7 +2346,7 @@ void syscall_clone(struct registers *regs) {
 
 void syscall_fork(struct registers *regs) {
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] fork\n", CORE_LOCAL->pid, CORE_LOCAL->tid);
+	print("syscall: [pid %x, tid %x] fork\n", this_cpu_read(pid), this_cpu_read(tid));
 #endif
 	
 	struct task *task = clone(0, NULL, NULL, NULL, NULL, regs);
@@ -1090,49 +2361,49 @@ void syscall_fork(struct registers *regs) {
 
 void syscall_getpid(struct registers *regs) {
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] getpid\n", CORE_LOCAL->pid, CORE_LOCAL->tid);
+	print("syscall: [pid %x, tid %x] getpid\n", this_cpu_read(pid), this_cpu_read(tid));
 #endif
-	regs->rax = CORE_LOCAL->pid;
+	regs->rax = this_cpu_read(pid);
 }
 
 void syscall_getppid(struct registers *regs) {
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] getppid\n", CORE_LOCAL->pid, CORE_LOCAL->tid);
+	print("syscall: [pid %x, tid %x] getppid\n", this_cpu_read(pid), this_cpu_read(tid));
 #endif
 	regs->rax = CURRENT_TASK->parent->id.pid;
 }
 
 void syscall_gettid(struct registers *regs) {
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] gettid\n", CORE_LOCAL->pid, CORE_LOCAL->tid);
+	print("syscall: [pid %x, tid %x] gettid\n", this_cpu_read(pid), this_cpu_read(tid));
 #endif
-	regs->rax = CORE_LOCAL->tid;
+	regs->rax = this_cpu_read(tid);
 }
 
 void syscall_getuid(struct registers *regs) {
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] getuid\n", CORE_LOCAL->pid, CORE_LOCAL->tid);
+	print("syscall: [pid %x, tid %x] getuid\n", this_cpu_read(pid), this_cpu_read(tid));
 #endif
 	regs->rax = CURRENT_TASK->real_uid;
 }
 
 void syscall_geteuid(struct registers *regs) {
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] geteuid\n", CORE_LOCAL->pid, CORE_LOCAL->tid);
+	print("syscall: [pid %x, tid %x] geteuid\n", this_cpu_read(pid), this_cpu_read(tid));
 #endif
 	regs->rax = CURRENT_TASK->effective_uid;
 }
 
 void syscall_getgid(struct registers *regs) {
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] getgid\n", CORE_LOCAL->pid, CORE_LOCAL->tid);
+	print("syscall: [pid %x, tid %x] getgid\n", this_cpu_read(pid), this_cpu_read(tid));
 #endif
 	regs->rax = CURRENT_TASK->real_gid;
 }
 
 void syscall_getegid(struct registers *regs) {
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] getegid\n", CORE_LOCAL->pid, CORE_LOCAL->tid);
+	print("syscall: [pid %x, tid %x] getegid\n", this_cpu_read(pid), this_cpu_read(tid));
 #endif
 	regs->rax = CURRENT_TASK->effective_gid;
 }
@@ -1142,7 +2413,7 @@ void syscall_setuid(struct registers *regs) {
 	struct task *current_task = CURRENT_TASK;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] setuid: uid {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, uid);
+	print("syscall: [pid %x, tid %x] setuid: uid {%x}\n", this_cpu_read(pid), this_cpu_read(tid), uid);
 #endif
 
 	if(current_task->effective_uid == 0) {
@@ -1168,7 +2439,7 @@ void syscall_seteuid(struct registers *regs) {
 	struct task *current_task = CURRENT_TASK;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] seteuid: euid {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, euid);
+	print("syscall: [pid %x, tid %x] seteuid: euid {%x}\n", this_cpu_read(pid), this_cpu_read(tid), euid);
 #endif
 
 	if(current_task->real_uid == euid || current_task->effective_uid == euid || current_task->saved_uid == euid) {
@@ -1186,7 +2457,7 @@ void syscall_setgid(struct registers *regs) {
 	struct task *current_task = CURRENT_TASK;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] setgid: gid {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, gid);
+	print("syscall: [pid %x, tid %x] setgid: gid {%x}\n", this_cpu_read(pid), this_cpu_read(tid), gid);
 #endif
 
 	if(current_task->effective_uid == 0) {
@@ -1212,7 +2483,7 @@ void syscall_setegid(struct registers *regs) {
 	struct task *current_task = CURRENT_TASK;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] setegid: egid {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, egid);
+	print("syscall: [pid %x, tid %x] setegid: egid {%x}\n", this_cpu_read(pid), this_cpu_read(tid), egid);
 #endif
 
 	if(current_task->real_gid == egid || current_task->effective_gid == egid || current_task->saved_gid == egid) {
@@ -1226,14 +2497,14 @@ void syscall_setegid(struct registers *regs) {
 }
 
 void syscall_setpgid(struct registers *regs) {
-	pid_t pid = regs->rdi == 0 ? CORE_LOCAL->pid : regs->rdi;
-	pid_t pgid = regs->rsi == 0 ? CORE_LOCAL->pid : regs->rsi;
+	pid_t pid = regs->rdi == 0 ? this_cpu_read(pid) : regs->rdi;
+	pid_t pgid = regs->rsi == 0 ? this_cpu_read(pid) : regs->rsi;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] setpgid: pid {%x}, pgid {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, pid, pgid);
+	print("syscall: [pid %x, tid %x] setpgid: pid {%x}, pgid {%x}\n", this_cpu_read(pid), this_cpu_read(tid), pid, pgid);
 #endif
 
-	struct task *task = sched_translate_pid(CORE_LOCAL->nid, pid, 0);
+	struct task *task = sched_translate_pid(this_cpu_read(nid), pid, 0);
 	if(task == NULL) {
 		set_errno(ESRCH);
 		regs->rax = -1;
@@ -1244,13 +2515,13 @@ void syscall_setpgid(struct registers *regs) {
 }
 
 void syscall_getpgid(struct registers *regs) {
-	pid_t pid = regs->rdi == 0 ? CORE_LOCAL->pid : regs->rdi;
+	pid_t pid = regs->rdi == 0 ? this_cpu_read(pid) : regs->rdi;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] getpgid: pid {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, pid);
+	print("syscall: [pid %x, tid %x] getpgid: pid {%x}\n", this_cpu_read(pid), this_cpu_read(tid), pid);
 #endif
 
-	struct task *task = sched_translate_pid(CORE_LOCAL->nid, pid, 0);
+	struct task *task = sched_translate_pid(this_cpu_read(nid), pid, 0);
 	if(task == NULL) {
 		set_errno(ESRCH);
 		regs->rax = -1;
@@ -1268,7 +2539,7 @@ void syscall_getpgid(struct registers *regs) {
 
 void syscall_setsid(struct registers *regs) {
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] setsid\n", CORE_LOCAL->pid, CORE_LOCAL->tid);
+	print("syscall: [pid %x, tid %x] setsid\n", this_cpu_read(pid), this_cpu_read(tid));
 #endif
 
 	struct task *current_task = CURRENT_TASK;
@@ -1281,8 +2552,228 @@ void syscall_setsid(struct registers *regs) {
 
 void syscall_getsid(struct registers *regs) {
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] getsid\n", CORE_LOCAL->pid, CORE_LOCAL->tid);
+	print("syscall: [pid %x, tid %x] getsid\n", this_cpu_read(pid), this_cpu_read(tid));
 #endif
 
 	regs->rax = CURRENT_TASK->session->sid;
 }
+
+void syscall_setpriority(struct registers *regs) {
+	int which = regs->rdi;
+	pid_t who = regs->rsi;
+	int prio = regs->rdx;
+
+#ifndef SYSCALL_DEBUG
+	print("syscall: [pid %x, tid %x] setpriority: which {%x}, who {%x}, prio {%d}\n", this_cpu_read(pid), this_cpu_read(tid), which, who, prio);
+#endif
+
+	if(which != PRIO_PROCESS) {
+		set_errno(EINVAL);
+		regs->rax = -1;
+		return;
+	}
+
+	struct task *current_task = CURRENT_TASK;
+	struct task *task = who == 0 ? current_task : sched_translate_pid(this_cpu_read(nid), who, 0);
+	if(task == NULL) {
+		set_errno(ESRCH);
+		regs->rax = -1;
+		return;
+	}
+
+	if(current_task->effective_uid != 0) {
+		if(current_task->effective_uid != task->real_uid && current_task->effective_uid != task->effective_uid) {
+			set_errno(EPERM);
+			regs->rax = -1;
+			return;
+		}
+
+		// only root may raise the priority of a task
+		if(prio < task->nice) {
+			set_errno(EACCES);
+			regs->rax = -1;
+			return;
+		}
+	}
+
+	regs->rax = sched_set_nice(task, prio);
+}
+
+void syscall_getpriority(struct registers *regs) {
+	int which = regs->rdi;
+	pid_t who = regs->rsi;
+
+#ifndef SYSCALL_DEBUG
+	print("syscall: [pid %x, tid %x] getpriority: which {%x}, who {%x}\n", this_cpu_read(pid), this_cpu_read(tid), which, who);
+#endif
+
+	if(which != PRIO_PROCESS) {
+		set_errno(EINVAL);
+		regs->rax = -1;
+		return;
+	}
+
+	struct task *task = who == 0 ? CURRENT_TASK : sched_translate_pid(this_cpu_read(nid), who, 0);
+	if(task == NULL) {
+		set_errno(ESRCH);
+		regs->rax = -1;
+		return;
+	}
+
+	regs->rax = task->nice;
+}
+
+void syscall_sched_setscheduler(struct registers *regs) {
+	pid_t pid = regs->rdi;
+	int policy = regs->rsi;
+	struct sched_param *param = (void*)regs->rdx;
+
+#ifndef SYSCALL_DEBUG
+	print("syscall: [pid %x, tid %x] sched_setscheduler: pid {%x}, policy {%x}, param {%x}\n", this_cpu_read(pid), this_cpu_read(tid), pid, policy, param);
+#endif
+
+	if(param == NULL) {
+		set_errno(EINVAL);
+		regs->rax = -1;
+		return;
+	}
+
+	struct task *current_task = CURRENT_TASK;
+	struct task *task = pid == 0 ? current_task : sched_translate_pid(this_cpu_read(nid), pid, 0);
+	if(task == NULL) {
+		set_errno(ESRCH);
+		regs->rax = -1;
+		return;
+	}
+
+	if(current_task->effective_uid != 0) {
+		if(SCHED_POLICY_RT(policy) || (current_task->effective_uid != task->real_uid &&
+			current_task->effective_uid != task->effective_uid)) {
+			set_errno(EPERM);
+			regs->rax = -1;
+			return;
+		}
+	}
+
+	regs->rax = sched_set_policy(task, policy, param->sched_priority);
+}
+
+void syscall_sched_getscheduler(struct registers *regs) {
+	pid_t pid = regs->rdi;
+
+#ifndef SYSCALL_DEBUG
+	print("syscall: [pid %x, tid %x] sched_getscheduler: pid {%x}\n", this_cpu_read(pid), this_cpu_read(tid), pid);
+#endif
+
+	struct task *task = pid == 0 ? CURRENT_TASK : sched_translate_pid(this_cpu_read(nid), pid, 0);
+	if(task == NULL) {
+		set_errno(ESRCH);
+		regs->rax = -1;
+		return;
+	}
+
+	regs->rax = task->policy;
+}
+
+void syscall_sched_getparam(struct registers *regs) {
+	pid_t pid = regs->rdi;
+	struct sched_param *param = (void*)regs->rsi;
+
+#ifndef SYSCALL_DEBUG
+	print("syscall: [pid %x, tid %x] sched_getparam: pid {%x}, param {%x}\n", this_cpu_read(pid), this_cpu_read(tid), pid, param);
+#endif
+
+	if(param == NULL) {
+		set_errno(EINVAL);
+		regs->rax = -1;
+		return;
+	}
+
+	struct task *task = pid == 0 ? CURRENT_TASK : sched_translate_pid(this_cpu_read(nid), pid, 0);
+	if(task == NULL) {
+		set_errno(ESRCH);
+		regs->rax = -1;
+		return;
+	}
+
+	param->sched_priority = task->rt_priority;
+
+	regs->rax = 0;
+}
+
+void syscall_sched_setaffinity(struct registers *regs) {
+	pid_t pid = regs->rdi;
+	size_t cpusetsize = regs->rsi;
+	const uint8_t *mask = (void*)regs->rdx;
+
+#ifndef SYSCALL_DEBUG
+	print("syscall: [pid %x, tid %x] sched_setaffinity: pid {%x}, cpusetsize {%x}, mask {%x}\n", this_cpu_read(pid), this_cpu_read(tid), pid, cpusetsize, mask);
+#endif
+
+	if(mask == NULL) {
+		set_errno(EFAULT);
+		regs->rax = -1;
+		return;
+	}
+
+	struct task *current_task = CURRENT_TASK;
+	struct task *task = pid == 0 ? current_task : sched_translate_pid(this_cpu_read(nid), pid, 0);
+	if(task == NULL) {
+		set_errno(ESRCH);
+		regs->rax = -1;
+		return;
+	}
+
+	if(current_task->effective_uid != 0 && current_task->effective_uid != task->real_uid &&
+		current_task->effective_uid != task->effective_uid) {
+		set_errno(EPERM);
+		regs->rax = -1;
+		return;
+	}
+
+	// cpus past what we track can never be online, so a larger user mask is simply cut short
+	struct cpuset affinity;
+	cpuset_zero(&affinity);
+	memcpy8((uint8_t*)affinity.bits, mask, cpusetsize < sizeof(affinity.bits) ? cpusetsize : sizeof(affinity.bits));
+
+	regs->rax = sched_set_affinity(task, &affinity);
+}
+
+void syscall_sched_getaffinity(struct registers *regs) {
+	pid_t pid = regs->rdi;
+	size_t cpusetsize = regs->rsi;
+	uint8_t *mask = (void*)regs->rdx;
+
+#ifndef SYSCALL_DEBUG
+	print("syscall: [pid %x, tid %x] sched_getaffinity: pid {%x}, cpusetsize {%x}, mask {%x}\n", this_cpu_read(pid), this_cpu_read(tid), pid, cpusetsize, mask);
+#endif
+
+	if(mask == NULL) {
+		set_errno(EFAULT);
+		regs->rax = -1;
+		return;
+	}
+
+	// every online cpu has to fit into the user's mask
+	if(cpusetsize * 8 < cpu_local_list.length) {
+		set_errno(EINVAL);
+		regs->rax = -1;
+		return;
+	}
+
+	struct task *task = pid == 0 ? CURRENT_TASK : sched_translate_pid(this_cpu_read(nid), pid, 0);
+	if(task == NULL) {
+		set_errno(ESRCH);
+		regs->rax = -1;
+		return;
+	}
+
+	struct cpuset affinity = task->affinity;
+	size_t size = cpusetsize < sizeof(affinity.bits) ? cpusetsize : sizeof(affinity.bits);
+
+	memset8(mask, 0, cpusetsize);
+	memcpy8(mask, (uint8_t*)affinity.bits, size);
+
+	// like linux, libc sizes its cpu set off the number of bytes we filled in
+	regs->rax = size;
+}
@@ -7,6 +7,7 @@
 #include <cpu.h>
 #include <bitmap.h>
 #include <hash.h>
+#include <idr.h>
 #include <elf.h>
 #include <sched/signal.h>
 #include <drivers/tty/tty.h>
@@ -14,15 +15,19 @@
 #include <sched/program.h>
 #include <sched/futex.h>
 #include <lock.h>
+#include <sched/mutex.h>
+#include <rbtree.h>
 
 struct task;
 struct process_group;
 struct session;
 
+// pids are not handed out again until the namespace wraps around
+#define PID_MAX 0x8000
+
 struct pid_namespace {
 	nid_t nid;
-	struct hash_table process_list;
-	struct bitmap pid_bitmap;
+	struct idr pids;
 };
 
 struct task_id {
@@ -32,7 +37,7 @@ struct task_id {
 }; 
 
 struct task {
-	struct spinlock lock;
+	struct mutex lock;
 
 	struct pid_namespace *namespace;
 	struct task_id id;
@@ -43,13 +48,43 @@ struct task {
 
 	int has_execved;
 
-	size_t idle_cnt;
 	int sched_status;
 	int process_status;
 
+	int cpu;
+	bool on_rq;
+	bool on_cpu;
+	bool queued;
+	uint64_t last_run;
+
+	// pulled over by a sync wakeup on the promise that this task blocks next
+	struct task *sync_wakee;
+
+	struct cpuset affinity;
+	bool migrating;
+	struct task *migrate_next;
+
+	int policy;
+	int rt_priority;
+	uint64_t rt_time_slice;
+	struct task *rt_next;
+	struct task *rt_prev;
+
+	int nice;
+	uint64_t weight;
+	uint64_t vruntime;
+	uint64_t exec_start;
+	uint64_t sum_exec_runtime;
+	uint64_t prev_sum_exec_runtime;
+	struct rb_node sched_node;
+
 	size_t user_gs_base;
 	size_t user_fs_base;
 
+	void *fpu_state;
+	int fpu_cpu;
+	uint8_t fpu_counter;
+
 	struct stack signal_user_stack;
 	struct stack signal_kernel_stack;
 
@@ -65,6 +100,12 @@ struct task {
 	bool blocking;
 	bool signal_release_block;
 
+	// what a sleeping task has hooked into the kernel from its own stack, undone by the reaper
+	// for a thread that was killed before it could unwind
+	struct waitq *blocked_on;
+	struct futex_waiter *futex_waiter;
+	struct timer *sleep_timer;
+
 	struct signal_queue signal_queue;
 
 	struct registers regs;
@@ -85,7 +126,6 @@ struct task {
 
 	struct spinlock sig_lock;
 	struct sigaction *sigactions;
-	bool dispatch_ready;
 
 	VECTOR(struct task*) children;
 	VECTOR(struct task*) zombies;
@@ -134,9 +174,19 @@ int sched_task_init(struct task *task, char **envp, char **argv);
 int sched_load_program(struct task *task, const char *path);
 
 void reschedule(struct registers *regs, void *ptr);
+void sched_tick(struct registers *regs);
+void sched_enqueue(struct task *task);
+void sched_remove(struct task *task);
 void sched_dequeue(struct task *task);
 void sched_requeue(struct task *task);
+void sched_requeue_sync(struct task *task);
+void sched_sync_finish();
 void sched_yield();
+void sched_switch();
+void sched_timer_armed(uint64_t deadline);
+int sched_set_nice(struct task *task, int nice);
+int sched_set_policy(struct task *task, int policy, int priority);
+int sched_set_affinity(struct task *task, const struct cpuset *mask);
 void task_terminate(struct task *task, int status);
 void task_stop(struct task *task, int sig);
 void task_continue(struct task *task);
@@ -144,13 +194,7 @@ int task_create_session(struct task *task, bool force);
 
 extern struct spinlock sched_lock;
 
-#define CURRENT_TASK ({ \
-	struct task *ret = NULL; \
-	if(CORE_LOCAL) { \
-		ret = sched_translate_pid(CORE_LOCAL->nid, CORE_LOCAL->pid, CORE_LOCAL->tid); \
-	} \
-	ret; \
-})
+#define CURRENT_TASK this_cpu_read(current_task)
 
 #define SIGPENDING ({ \
 	CURRENT_TASK->signal_queue.sigpending; \
@@ -160,12 +204,44 @@ extern struct spinlock sched_lock;
 #define TASK_WAITING 1
 #define TASK_YIELD 2
 
+#define SCHED_VECTOR 32
+
+#define SCHED_STEAL_HOT_LOAD 2
+
+// all in nanoseconds of sched_clock
+#define SCHED_TICK 10000000
+#define SCHED_MIGRATION_COST 500000
+#define SCHED_LATENCY 6000000
+#define SCHED_MIN_GRANULARITY 750000
+#define SCHED_NR_LATENCY (SCHED_LATENCY / SCHED_MIN_GRANULARITY)
+#define SCHED_SLEEPER_CREDIT (SCHED_LATENCY / 2)
+#define SCHED_WAKEUP_GRANULARITY 1000000
+
+#define NICE_MIN -20
+#define NICE_MAX 19
+#define NICE_0_LOAD 1024
+
+#define SCHED_OTHER 0
+#define SCHED_FIFO 1
+#define SCHED_RR 2
+
+#define SCHED_POLICY_RT(policy) ((policy) == SCHED_FIFO || (policy) == SCHED_RR)
+
+#define SCHED_RT_PRIORITY_MIN 1
+#define SCHED_RT_PRIORITY_MAX (RT_PRIORITY_LEVELS - 1)
+#define SCHED_RR_TIMESLICE 100000000
+
+struct sched_param {
+	int sched_priority;
+};
+
+#define PRIO_PROCESS 0
+#define PRIO_PGRP 1
+#define PRIO_USER 2
+
 #define THREAD_KERNEL_STACK_SIZE 0x4000
 #define THREAD_USER_STACK_SIZE 0x100000
 
-#define TASK_MAX_PRIORITY ~(0ull)
-#define TASK_MIN_PRIORITY ~(0)
-
 static inline void session_lock(struct session *session) {
 	spinlock_irqsave(&session->lock);
 }
@@ -183,11 +259,11 @@ static inline void process_group_unlock(struct process_group *group) {
 }
 
 static inline void task_lock(struct task *task) {
-	spinlock_irqsave(&task->lock);
+	mutex_lock(&task->lock);
 }
 
 static inline void task_unlock(struct task *task) {
-	spinrelease_irqsave(&task->lock);
+	mutex_unlock(&task->lock);
 }
 
 #define WEXITSTATUS(x) (((x) & 0xff00) >> 8)
@@ -32,7 +32,7 @@ int sigaction(int sig, const struct sigaction *act, struct sigaction *old) {
 		*current_action = *act;
 		current_action->sa_mask &= ~(SIGMASK(SIGKILL) | SIGMASK(SIGSTOP));
 
-		//print("sigaction [pid %d, tid %d]: signum %x: handler %x\n", CORE_LOCAL->pid, CORE_LOCAL->tid, sig, act->handler);
+		//print("sigaction [pid %d, tid %d]: signum %x: handler %x\n", this_cpu_read(pid), this_cpu_read(tid), sig, act->handler);
 
 		spinlock_irqsave(&queue->siglock);
 
@@ -160,12 +160,12 @@ int signal_send_task(struct task *sender, struct task *target, int sig) {
 	signal->queue = signal_queue;
 	signal_queue->sigpending |= SIGMASK(sig);
 
-	target->dispatch_ready = true;
-	target->dispatch_ready = true;
-
 	spinrelease_irqsave(&queue->siglock);
 	spinrelease_irqsave(&target->sig_lock);
 
+	// make sure the target gets picked to run its handler
+	sched_requeue(target);
+
 	return 0;
 }
 
@@ -173,7 +173,7 @@ int signal_send_group(struct task *sender, struct process_group *target, int sig
 	for(size_t i = 0; i < target->process_list.length; i++) {
 		pid_t pid = target->process_list.data[i]->id.pid;
 
-		struct task *task = sched_translate_pid(CORE_LOCAL->nid, pid, 0);
+		struct task *task = sched_translate_pid(this_cpu_read(nid), pid, 0);
 
 		if(!task) {
 			set_errno(ESRCH);
@@ -300,8 +300,11 @@ int signal_dispatch(struct task *task, struct registers *state) {
 				return 0;
 			}
 
+			// the signal locks are still held, a busy region lock is spun on
+			mutex_nosleep_begin();
+
 			struct stack stack = {
-				.sp = (uint64_t)mmap(CORE_LOCAL->page_table,
+				.sp = (uint64_t)mmap(this_cpu_read(page_table),
 						NULL,
 						THREAD_USER_STACK_SIZE,
 						MMAP_PROT_READ | MMAP_PROT_WRITE | MMAP_PROT_USER,
@@ -312,6 +315,8 @@ int signal_dispatch(struct task *task, struct registers *state) {
 				.flags = 0
 			};
 
+			mutex_nosleep_end();
+
 			context.stack = stack;
 			context.registers = *state;
 			context.signum = signal->signum;
@@ -369,8 +374,9 @@ int signal_dispatch(struct task *task, struct registers *state) {
 }
 
 int signal_wait(struct signal_queue *signal_queue, sigset_t mask, struct timespec *timespec) {
+	struct timer *timer = NULL;
 	if(timespec) {
-		waitq_set_timer(&signal_queue->waitq, *timespec);
+		timer = waitq_set_timer(&signal_queue->waitq, *timespec);
 	}
 
 	spinlock_irqsave(&signal_queue->siglock);
@@ -387,9 +393,11 @@ int signal_wait(struct signal_queue *signal_queue, sigset_t mask, struct timespe
 	}
 	spinrelease_irqsave(&signal_queue->siglock);
 
-	int ret = waitq_wait(&signal_queue->waitq, EVENT_SIGNAL);
+	int ret = waitq_wait(&signal_queue->waitq, EVENT_SIGNAL | EVENT_TIMER);
 	waitq_release(&signal_queue->waitq, EVENT_SIGNAL);
 
+	waitq_cancel_timer(&signal_queue->waitq, timer);
+
 	if(ret == -1) {
 		return -1;
 	}
@@ -416,7 +424,7 @@ int kill(pid_t pid, int sig) {
 	}
 
 	if(pid > 0) {
-		struct task *target = sched_translate_pid(CORE_LOCAL->nid, pid, 0);
+		struct task *target = sched_translate_pid(this_cpu_read(nid), pid, 0);
 		if(target == NULL) {
 			set_errno(ESRCH);
 			return -1;
@@ -439,7 +447,7 @@ int kill(pid_t pid, int sig) {
 		for(size_t i = 0; i < group->process_list.length; i++) {
 			pid_t pid = group->process_list.data[i]->id.pid;
 
-			struct task *target = sched_translate_pid(CORE_LOCAL->nid, pid, 0);
+			struct task *target = sched_translate_pid(this_cpu_read(nid), pid, 0);
 			if(target == NULL) {
 				set_errno(ESRCH);
 				return -1;
@@ -478,11 +486,8 @@ static void sigreturn_default(int release_block) {
 		task->signal_release_block = true;
 	}
 
-	task->dispatch_ready = false;
-	task->dispatch_ready = false;
-
-	CORE_LOCAL->user_stack = task->user_stack.sp;
-	CORE_LOCAL->kernel_stack = task->kernel_stack.sp;
+	this_cpu_write(user_stack, task->user_stack.sp);
+	this_cpu_write(kernel_stack, task->kernel_stack.sp);
 
 	if(context->cs & 0x3) {
 		swapgs();
@@ -513,7 +518,7 @@ static void sigreturn_default(int release_block) {
 
 void syscall_sigreturn(struct registers*) {
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] sigreturn\n", CORE_LOCAL->pid, CORE_LOCAL->tid);
+	print("syscall: [pid %x, tid %x] sigreturn\n", this_cpu_read(pid), this_cpu_read(tid));
 #endif
 	asm volatile ("cli");
 
@@ -532,14 +537,15 @@ void syscall_sigreturn(struct registers*) {
 	struct registers *context = &task->signal_context.registers;
 
 	task->regs = *context;
+
+	// task->regs already holds the interrupted context, sleeping here would overwrite it
+	mutex_nosleep_begin();
 	munmap(task->page_table, (void*)(stack->sp - stack->size), stack->size);
+	mutex_nosleep_end();
 
 	task->blocking = false;
 	task->signal_release_block = true;
 
-	task->dispatch_ready = false;
-	task->dispatch_ready = false;
-
 	struct stack tmp = task->kernel_stack;
 	task->kernel_stack = task->signal_kernel_stack;
 	task->signal_kernel_stack = tmp;
@@ -548,8 +554,8 @@ void syscall_sigreturn(struct registers*) {
 	task->user_stack = task->signal_user_stack;
 	task->signal_user_stack = tmp;
 
-	CORE_LOCAL->user_stack = task->user_stack.sp;
-	CORE_LOCAL->kernel_stack = task->kernel_stack.sp;
+	this_cpu_write(user_stack, task->user_stack.sp);
+	this_cpu_write(kernel_stack, task->kernel_stack.sp);
 
 	if(context->cs & 0x3) {
 		swapgs();
@@ -615,7 +621,7 @@ void syscall_sigaction(struct registers *regs) {
 	struct sigaction *old = (void*)regs->rdx;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] sigaction: signum {%x}, act {%x}, old {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, sig, act, old);
+	print("syscall: [pid %x, tid %x] sigaction: signum {%x}, act {%x}, old {%x}\n", this_cpu_read(pid), this_cpu_read(tid), sig, act, old);
 #endif
 
 	regs->rax = sigaction(sig, act, old);
@@ -625,7 +631,7 @@ void syscall_sigpending(struct registers *regs) {
 	sigset_t *set = (void*)regs->rdi;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] sigpending: set {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, set);
+	print("syscall: [pid %x, tid %x] sigpending: set {%x}\n", this_cpu_read(pid), this_cpu_read(tid), set);
 #endif
 
 	regs->rax = sigpending(set);
@@ -637,7 +643,7 @@ void syscall_sigprocmask(struct registers *regs) {
 	sigset_t *oldset = (void*)regs->rdx;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] sigprocmask: how {%x}, set {%x}, oldset {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, how, set, oldset);
+	print("syscall: [pid %x, tid %x] sigprocmask: how {%x}, set {%x}, oldset {%x}\n", this_cpu_read(pid), this_cpu_read(tid), how, set, oldset);
 #endif
 
 	regs->rax = sigprocmask(how, set, oldset);
@@ -648,7 +654,7 @@ void syscall_kill(struct registers *regs) {
 	int sig = regs->rsi;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] kill: pid {%x}, sig {%x}\n", CORE_LOCAL->pid, CORE_LOCAL->tid, pid, sig);
+	print("syscall: [pid %x, tid %x] kill: pid {%x}, sig {%x}\n", this_cpu_read(pid), this_cpu_read(tid), pid, sig);
 #endif
 
 	regs->rax = kill(pid, sig);
@@ -656,7 +662,7 @@ void syscall_kill(struct registers *regs) {
 
 void syscall_pause(struct registers *regs) {
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] pause\n", CORE_LOCAL->pid, CORE_LOCAL->tid);
+	print("syscall: [pid %x, tid %x] pause\n", this_cpu_read(pid), this_cpu_read(tid));
 #endif
 
 	struct task *task = CURRENT_TASK;
@@ -676,7 +682,7 @@ void syscall_sigsuspend(struct registers *regs) {
 	sigset_t *mask = (void*)regs->rdi;
 
 #ifndef SYSCALL_DEBUG
-	print("syscall: [pid %x, tid %x] pause\n", CORE_LOCAL->pid, CORE_LOCAL->tid);
+	print("syscall: [pid %x, tid %x] pause\n", this_cpu_read(pid), this_cpu_read(tid));
 #endif
 
 	struct task *task = CURRENT_TASK;
@@ -1,4 +1,6 @@
 #include <sched/smp.h>
+#include <sched/vdso.h>
+#include <sched/topology.h>
 #include <int/apic.h>
 #include <mm/pmm.h>
 #include <mm/vmm.h>
@@ -9,25 +11,37 @@
 #include <cpu.h>
 #include <debug.h>
 #include <lock.h>
+#include <time.h>
 
 static struct spinlock core_init_lock;
 
 size_t logical_processor_cnt;
 
+typeof(cpu_local_list) cpu_local_list;
+
+struct cpuset cpu_online_mask;
+struct cpuset cpu_isolated_mask;
+struct cpuset cpu_housekeeping_mask;
+
 static void core_bootstrap(struct cpu_local *cpu_local) {
+	// CORE_LOCAL dereferences gs, it has to be valid before anything else runs
+	wrmsr(MSR_GS_BASE, (uintptr_t)cpu_local);
+
 	init_cpu_features();
 	gdt_init();
 
 	print("initalising core: apic_id %x\n", xapic_read(XAPIC_ID_REG_OFF) >> 24);
 
+	topology_detect(cpu_local);
+
 	spinrelease_irqsave(&core_init_lock);
 
-	wrmsr(MSR_GS_BASE, (uintptr_t)cpu_local);
+	vdso_cpu_init(cpu_local->cpu_number);
 
 	xapic_write(XAPIC_TPR_OFF, 0);
 	xapic_write(XAPIC_SINT_OFF, xapic_read(XAPIC_SINT_OFF) | 0x1ff);
 
-	apic_timer_init(20);
+	apic_timer_init();
 
 	asm volatile ("mov %0, %%cr8\nsti" :: "r"(0ull));
 
@@ -62,18 +76,36 @@ void boot_aps() {
 			continue;
 		}
 
+		if(cpu_local_list.length == CPUSET_MAX) {
+			print("smp: ignoring apic_id %x, no more than %d cpus are supported\n", madt0->apic_id, CPUSET_MAX);
+			continue;
+		}
+
 		struct cpu_local *cpu_local = alloc(sizeof(struct cpu_local));
 
 		*cpu_local = (struct cpu_local) {
+			.self = cpu_local,
 			.kernel_stack = pmm_alloc(2, 1) + HIGH_VMA + 0x2000,
 			.apic_id = madt0->apic_id,
 			.pid = -1,
 			.tid = -1,
-			.page_table = &kernel_mappings
+			.page_table = &kernel_mappings,
+			.cpu_number = cpu_local_list.length,
+			.run_queue = alloc(sizeof(struct run_queue)),
+			.idle_stack = pmm_alloc(2, 1) + HIGH_VMA + 0x2000,
+			.timer_wheel = alloc(sizeof(struct timer_wheel)),
+			// parked until their first tick, the boot cpu clears this below
+			.rcu_idle = true
 		};
 
+		VECTOR_PUSH(cpu_local_list, cpu_local);
+		cpuset_set(&cpu_online_mask, cpu_local->cpu_number);
+
 		if(cpu_local->apic_id == (xapic_read(XAPIC_ID_REG_OFF) >> 24)) {
+			cpu_local->rcu_idle = false;
 			wrmsr(MSR_GS_BASE, (uintptr_t)cpu_local);
+			vdso_cpu_init(cpu_local->cpu_number);
+			topology_detect(cpu_local);
 			continue;
 		}
 
@@ -105,4 +137,93 @@ void boot_aps() {
 	spinlock_irqsave(&core_init_lock);
 
 	kernel_mappings.unmap_page(&kernel_mappings, 0);
+
+	cpu_housekeeping_mask = cpu_online_mask;
+
+	sched_domains_init();
+}
+
+static const char *smp_parse_cpu(const char *str, int *cpu) {
+	if(*str < '0' || *str > '9') {
+		return NULL;
+	}
+
+	*cpu = 0;
+
+	while(*str >= '0' && *str <= '9') {
+		*cpu = *cpu * 10 + (*str++ - '0');
+	}
+
+	return str;
+}
+
+// isolcpus=<list>, where list is made of comma separated cpus and ranges like 2,4-7
+void smp_isolate_cpus(const char *cmdline) {
+	static const char option[] = "isolcpus=";
+
+	if(cmdline == NULL) {
+		return;
+	}
+
+	const char *list = NULL;
+
+	for(const char *str = cmdline; *str; str++) {
+		if((str == cmdline || *(str - 1) == ' ') && strncmp(str, option, sizeof(option) - 1) == 0) {
+			list = str + sizeof(option) - 1;
+		}
+	}
+
+	if(list == NULL) {
+		return;
+	}
+
+	struct cpuset isolated;
+	cpuset_zero(&isolated);
+
+	while(*list && *list != ' ') {
+		int first, last;
+
+		list = smp_parse_cpu(list, &first);
+		if(list == NULL) {
+			print("smp: malformed isolcpus list\n");
+			return;
+		}
+
+		last = first;
+
+		if(*list == '-') {
+			list = smp_parse_cpu(list + 1, &last);
+			if(list == NULL || last < first) {
+				print("smp: malformed isolcpus list\n");
+				return;
+			}
+		}
+
+		for(int cpu = first; cpu <= last && cpu < CPUSET_MAX; cpu++) {
+			cpuset_set(&isolated, cpu);
+		}
+
+		if(*list == ',') {
+			list++;
+		}
+	}
+
+	cpuset_and(&isolated, &isolated, &cpu_online_mask);
+
+	// someone has to run everything that is not pinned
+	cpuset_andnot(&cpu_housekeeping_mask, &cpu_online_mask, &isolated);
+
+	if(cpuset_empty(&cpu_housekeeping_mask)) {
+		print("smp: refusing to isolate every cpu, keeping cpu 0 for housekeeping\n");
+		cpuset_clear(&isolated, 0);
+		cpuset_set(&cpu_housekeeping_mask, 0);
+	}
+
+	cpu_isolated_mask = isolated;
+
+	for(size_t i = 0; i < cpu_local_list.length; i++) {
+		if(cpuset_test(&cpu_isolated_mask, i)) {
+			print("smp: cpu %d is isolated\n", i);
+		}
+	}
 }
@@ -2,18 +2,164 @@
 
 #include <mm/vmm.h>
 #include <types.h>
+#include <vector.h>
+#include <lock.h>
+#include <rbtree.h>
 
+struct task;
+struct timer_wheel;
+struct worker_pool;
+
+#define RT_PRIORITY_LEVELS 100
+#define RT_BITMAP_WORDS ((RT_PRIORITY_LEVELS + 63) / 64)
+
+#define CPUSET_MAX 256
+#define CPUSET_WORDS (CPUSET_MAX / 64)
+
+struct cpuset {
+	uint64_t bits[CPUSET_WORDS];
+};
+
+static inline void cpuset_zero(struct cpuset *set) {
+	for(int i = 0; i < CPUSET_WORDS; i++) {
+		set->bits[i] = 0;
+	}
+}
+
+static inline void cpuset_set(struct cpuset *set, int cpu) {
+	set->bits[cpu / 64] |= 1ull << (cpu % 64);
+}
+
+static inline void cpuset_clear(struct cpuset *set, int cpu) {
+	set->bits[cpu / 64] &= ~(1ull << (cpu % 64));
+}
+
+static inline bool cpuset_test(const struct cpuset *set, int cpu) {
+	return (set->bits[cpu / 64] >> (cpu % 64)) & 1;
+}
+
+static inline void cpuset_and(struct cpuset *dest, const struct cpuset *a, const struct cpuset *b) {
+	for(int i = 0; i < CPUSET_WORDS; i++) {
+		dest->bits[i] = a->bits[i] & b->bits[i];
+	}
+}
+
+static inline void cpuset_andnot(struct cpuset *dest, const struct cpuset *a, const struct cpuset *b) {
+	for(int i = 0; i < CPUSET_WORDS; i++) {
+		dest->bits[i] = a->bits[i] & ~b->bits[i];
+	}
+}
+
+static inline bool cpuset_empty(const struct cpuset *set) {
+	for(int i = 0; i < CPUSET_WORDS; i++) {
+		if(set->bits[i]) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static inline bool cpuset_equal(const struct cpuset *a, const struct cpuset *b) {
+	for(int i = 0; i < CPUSET_WORDS; i++) {
+		if(a->bits[i] != b->bits[i]) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static inline int cpuset_weight(const struct cpuset *set) {
+	int weight = 0;
+
+	for(int i = 0; i < CPUSET_WORDS; i++) {
+		weight += __builtin_popcountll(set->bits[i]);
+	}
+
+	return weight;
+}
+
+struct cpu_topology {
+	uint32_t x2apic_id;
+	uint32_t core_id;
+	uint32_t llc_id;
+	uint32_t package_id;
+};
+
+#define SD_SHARE_CORE (1 << 0)
+#define SD_SHARE_LLC (1 << 1)
+#define SD_SHARE_PACKAGE (1 << 2)
+
+struct sched_domain {
+	const char *name;
+	int flags;
+	struct cpuset span;
+	struct sched_domain *parent;
+};
+
+struct rt_queue {
+	uint64_t bitmap[RT_BITMAP_WORDS];
+	struct task *head[RT_PRIORITY_LEVELS];
+	struct task *tail[RT_PRIORITY_LEVELS];
+	size_t nr_queued;
+};
+
+struct run_queue {
+	struct spinlock lock;
+
+	struct rt_queue rt;
+
+	struct rb_tree timeline;
+	struct task *current;
+	struct task *next_buddy;
+	struct task *migrate_list;
+	uint64_t min_vruntime;
+	uint64_t load_weight;
+
+	uint64_t next_tick;
+	size_t load;
+	bool need_resched;
+};
+
+// syscall.asm reaches the first fields through fixed %gs offsets
 struct cpu_local {
+	struct cpu_local *self;
 	uintptr_t kernel_stack;
 	uintptr_t user_stack;
 	uint64_t errno;
 	pid_t nid;
 	pid_t pid;
 	tid_t tid;
+	struct task *current_task;
 	int apic_id;
 	struct page_table *page_table;
+	int cpu_number;
+	struct run_queue *run_queue;
+	uintptr_t idle_stack;
+	struct timer_wheel *timer_wheel;
+	struct cpu_topology topology;
+	struct sched_domain *sched_domain;
+	struct task *fpu_owner;
+	bool fpu_active;
+	bool in_kernel_fpu;
+	bool kernel_fpu_interrupts;
+	int nosleep;
+	int rcu_nesting;
+	bool rcu_idle;
+	uint64_t rcu_qs_seq;
+	struct worker_pool *worker_pool;
+	bool rcu_interrupts;
+	uint64_t irq_count;
+	uint64_t sched_irq_count;
 } __attribute__((packed));
 
 extern size_t logical_processor_cnt;
+extern VECTOR(struct cpu_local*) cpu_local_list;
+
+extern struct cpuset cpu_online_mask;
+extern struct cpuset cpu_isolated_mask;
+extern struct cpuset cpu_housekeeping_mask;
 
 void boot_aps();
+void smp_isolate_cpus(const char *cmdline);
@@ -0,0 +1,253 @@
+#include <sched/softirq.h>
+#include <sched/kthread.h>
+#include <sched/sched.h>
+#include <int/apic.h>
+#include <irqsoff.h>
+#include <debug.h>
+#include <time.h>
+#include <cpu.h>
+
+// only ever touched by its own cpu with interrupts off, bar the ksoftirqd wakeup
+struct softirq_cpu {
+	uint32_t pending;
+
+	bool in_irq;
+	bool active;
+	bool resched;
+
+	struct tasklet *tasklet_head;
+	struct tasklet **tasklet_tail;
+
+	struct task *thread;
+	struct waitq waitq;
+	struct waitq_trigger trigger;
+} __attribute__((aligned(64)));
+
+static struct softirq_cpu softirq_cpus[CPUSET_MAX];
+
+static void tasklet_action();
+
+static void (*softirq_actions[SOFTIRQ_MAX])() = {
+	[SOFTIRQ_TIMER] = timer_run_expired,
+	[SOFTIRQ_TASKLET] = tasklet_action
+};
+
+static inline struct softirq_cpu *softirq_local() {
+	return &softirq_cpus[this_cpu_read(cpu_number)];
+}
+
+static void ksoftirqd_wake(struct softirq_cpu *cpu) {
+	if(cpu->thread) {
+		waitq_wake(&cpu->trigger);
+	}
+}
+
+// entered and left with interrupts off, the actions themselves run with them on. returns
+// false when the budget ran out with work left over
+static bool softirq_run(struct softirq_cpu *cpu) {
+	uint64_t deadline = clock_monotonic_ns() + SOFTIRQ_MAX_TIME;
+	bool done = true;
+
+	cpu->active = true;
+
+	for(int restart = SOFTIRQ_MAX_RESTART;;) {
+		uint32_t pending = cpu->pending;
+		cpu->pending = 0;
+
+		asm volatile ("sti");
+
+		while(pending) {
+			int nr = __builtin_ctz(pending);
+			pending &= ~(1 << nr);
+
+			softirq_actions[nr]();
+		}
+
+		asm volatile ("cli");
+
+		if(cpu->pending == 0) {
+			break;
+		}
+
+		if(--restart == 0 || clock_monotonic_ns() >= deadline) {
+			done = false;
+			break;
+		}
+	}
+
+	cpu->active = false;
+
+	// a tick came in while the actions ran, now that they are done it can switch tasks
+	if(cpu->resched) {
+		cpu->resched = false;
+		xapic_send_ipi(this_cpu_read(apic_id), SCHED_VECTOR);
+	}
+
+	return done;
+}
+
+void softirq_irq_enter() {
+	softirq_local()->in_irq = true;
+}
+
+// the tail of every device interrupt and tick, after the eoi where there is one
+void softirq_irq_exit() {
+	struct softirq_cpu *cpu = softirq_local();
+
+	cpu->in_irq = false;
+
+	// an interrupt that came in on top of running actions leaves the rest to them
+	if(cpu->active || cpu->pending == 0) {
+		return;
+	}
+
+	irqsoff_end();
+
+	if(!softirq_run(cpu)) {
+		ksoftirqd_wake(cpu);
+	}
+
+	irqsoff_begin();
+}
+
+// a task switch from inside an action would carry it off to wherever the task runs next, so
+// the tick has to wait for the actions to finish
+bool softirq_defer_resched() {
+	struct softirq_cpu *cpu = softirq_local();
+
+	if(!cpu->active) {
+		return false;
+	}
+
+	cpu->resched = true;
+
+	return true;
+}
+
+void raise_softirq(int nr) {
+	bool interrupts = get_interrupt_state();
+	asm volatile ("cli");
+
+	struct softirq_cpu *cpu = softirq_local();
+	cpu->pending |= 1 << nr;
+
+	// nothing on the way out of an interrupt is going to notice
+	if(!cpu->in_irq && !cpu->active) {
+		ksoftirqd_wake(cpu);
+	}
+
+	if(interrupts) {
+		asm volatile ("sti");
+	}
+}
+
+// runs on the cpu that scheduled it. once a tasklet is taken off the list it may be scheduled
+// again, even from inside its own function
+void tasklet_schedule(struct tasklet *tasklet) {
+	if(__atomic_exchange_n(&tasklet->scheduled, true, __ATOMIC_ACQ_REL)) {
+		return;
+	}
+
+	bool interrupts = get_interrupt_state();
+	asm volatile ("cli");
+
+	struct softirq_cpu *cpu = softirq_local();
+
+	if(cpu->tasklet_tail == NULL) {
+		cpu->tasklet_tail = &cpu->tasklet_head;
+	}
+
+	tasklet->next = NULL;
+	*cpu->tasklet_tail = tasklet;
+	cpu->tasklet_tail = &tasklet->next;
+
+	raise_softirq(SOFTIRQ_TASKLET);
+
+	if(interrupts) {
+		asm volatile ("sti");
+	}
+}
+
+static void tasklet_action() {
+	asm volatile ("cli");
+
+	struct softirq_cpu *cpu = softirq_local();
+
+	struct tasklet *list = cpu->tasklet_head;
+	cpu->tasklet_head = NULL;
+	cpu->tasklet_tail = &cpu->tasklet_head;
+
+	asm volatile ("sti");
+
+	for(int budget = TASKLET_BUDGET; list && budget; budget--) {
+		struct tasklet *tasklet = list;
+		list = list->next;
+
+		__atomic_store_n(&tasklet->scheduled, false, __ATOMIC_RELEASE);
+		tasklet->func(tasklet);
+	}
+
+	if(list == NULL) {
+		return;
+	}
+
+	// out of budget, whatever is left goes back in front of anything scheduled meanwhile
+	asm volatile ("cli");
+
+	struct tasklet *tail = list;
+	while(tail->next) {
+		tail = tail->next;
+	}
+
+	tail->next = cpu->tasklet_head;
+	if(cpu->tasklet_head == NULL) {
+		cpu->tasklet_tail = &tail->next;
+	}
+
+	cpu->tasklet_head = list;
+	cpu->pending |= 1 << SOFTIRQ_TASKLET;
+
+	asm volatile ("sti");
+}
+
+static void ksoftirqd(void *arg) {
+	struct softirq_cpu *cpu = arg;
+
+	for(;;) {
+		// forget older wakeups, anything raised from here on makes the wait fall through
+		spinlock_irqsave(&cpu->waitq.lock);
+		waitq_release(&cpu->waitq, EVENT_SOFTIRQ);
+		spinrelease_irqsave(&cpu->waitq.lock);
+
+		asm volatile ("cli");
+
+		if(cpu->pending == 0) {
+			asm volatile ("sti");
+			waitq_wait(&cpu->waitq, EVENT_SOFTIRQ);
+			continue;
+		}
+
+		// one budget at a time, a tick between rounds gets to switch us out
+		softirq_run(cpu);
+
+		asm volatile ("sti");
+	}
+}
+
+void softirq_init() {
+	for(size_t i = 0; i < cpu_local_list.length; i++) {
+		struct softirq_cpu *cpu = &softirq_cpus[i];
+
+		cpu->trigger.waitq = &cpu->waitq;
+		cpu->trigger.type = EVENT_SOFTIRQ;
+
+		struct task *thread = kthread_create(ksoftirqd, cpu);
+		if(kthread_bind(thread, i) == -1) {
+			panic("softirq: unable to bind ksoftirqd to cpu %d", i);
+		}
+
+		kthread_start(thread);
+
+		__atomic_store_n(&cpu->thread, thread, __ATOMIC_RELEASE);
+	}
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <types.h>
+
+#define SOFTIRQ_TIMER 0
+#define SOFTIRQ_TASKLET 1
+#define SOFTIRQ_MAX 2
+
+// how much interrupt exit takes on before the rest is left to ksoftirqd
+#define SOFTIRQ_MAX_RESTART 10
+#define SOFTIRQ_MAX_TIME 2000000 // ns
+
+// tasklets run per pass, the rest wait for the next one
+#define TASKLET_BUDGET 64
+
+struct tasklet {
+	void (*func)(struct tasklet *tasklet);
+	struct tasklet *next;
+	bool scheduled;
+};
+
+static inline void tasklet_init(struct tasklet *tasklet, void (*func)(struct tasklet *tasklet)) {
+	*tasklet = (struct tasklet) { .func = func };
+}
+
+void softirq_init();
+void softirq_irq_enter();
+void softirq_irq_exit();
+bool softirq_defer_resched();
+void raise_softirq(int nr);
+void tasklet_schedule(struct tasklet *tasklet);
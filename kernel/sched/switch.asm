@@ -0,0 +1,64 @@
+global sched_switch
+
+extern sched_switch_main
+
+; builds the frame a ring 0 interrupt would have pushed so the blocked task
+; is resumed through the same iretq path as a preempted one
+
+sched_switch:
+	mov rax, rsp
+
+	push 0x30 ; ss
+	push rax ; rsp
+	pushfq
+	cli
+	push 0x28 ; cs
+	lea rax, [rel .resume]
+	push rax ; rip
+
+	push 0
+	push 0
+
+	push rax
+	push rbx
+	push rcx
+	push rdx
+	push rbp
+	push rdi
+	push rsi
+	push r8
+	push r9
+	push r10
+	push r11
+	push r12
+	push r13
+	push r14
+	push r15
+
+	; 22 qwords on top of the return address leave rsp 8 off a 16 byte boundary
+	mov rdi, rsp
+	sub rsp, 8
+	call sched_switch_main
+	add rsp, 8
+
+	; still runnable, nothing was switched
+	pop r15
+	pop r14
+	pop r13
+	pop r12
+	pop r11
+	pop r10
+	pop r9
+	pop r8
+	pop rsi
+	pop rdi
+	pop rbp
+	pop rdx
+	pop rcx
+	pop rbx
+	pop rax
+	add rsp, 16
+
+	iretq
+.resume:
+	ret
@@ -0,0 +1,367 @@
+#include <sched/sched.h>
+#include <sched/queue.h>
+#include <time.h>
+#include <lock.h>
+#include <cpu.h>
+#include <errno.h>
+#include <debug.h>
+
+static uint64_t timer_expiry(uint64_t deadline) {
+	// round up so a timer never fires before its deadline
+	return (deadline + (1ull << TIMER_WHEEL_SHIFT) - 1) >> TIMER_WHEEL_SHIFT;
+}
+
+static void timer_wheel_link(struct timer_wheel *wheel, struct timer *timer, int level, int index) {
+	timer->level = level;
+	timer->index = index;
+	timer->prev = NULL;
+	timer->next = wheel->slots[level][index];
+
+	if(timer->next) {
+		timer->next->prev = timer;
+	}
+
+	wheel->slots[level][index] = timer;
+	wheel->occupied[level] |= 1ull << index;
+}
+
+static void timer_wheel_unlink(struct timer_wheel *wheel, struct timer *timer) {
+	if(timer->prev) {
+		timer->prev->next = timer->next;
+	} else {
+		wheel->slots[timer->level][timer->index] = timer->next;
+	}
+
+	if(timer->next) {
+		timer->next->prev = timer->prev;
+	}
+
+	if(wheel->slots[timer->level][timer->index] == NULL) {
+		wheel->occupied[timer->level] &= ~(1ull << timer->index);
+	}
+
+	timer->next = NULL;
+	timer->prev = NULL;
+}
+
+static void timer_wheel_enqueue(struct timer_wheel *wheel, struct timer *timer) {
+	uint64_t expires = timer_expiry(timer->deadline);
+
+	if(expires < wheel->clk) {
+		expires = wheel->clk;
+	}
+
+	uint64_t delta = expires - wheel->clk;
+
+	// anything past the last level parks there and is cascaded again later
+	if(delta >= TIMER_WHEEL_RANGE) {
+		delta = TIMER_WHEEL_RANGE - 1;
+		expires = wheel->clk + delta;
+	}
+
+	int level = 0;
+	while(level < TIMER_WHEEL_LEVELS - 1 && delta >= (1ull << ((level + 1) * TIMER_WHEEL_BITS))) {
+		level++;
+	}
+
+	int index = (expires >> (level * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK;
+
+	timer_wheel_link(wheel, timer, level, index);
+}
+
+static void timer_wheel_cascade(struct timer_wheel *wheel, int level) {
+	int index = (wheel->clk >> (level * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK;
+
+	struct timer *timer = wheel->slots[level][index];
+
+	wheel->slots[level][index] = NULL;
+	wheel->occupied[level] &= ~(1ull << index);
+
+	while(timer) {
+		struct timer *next = timer->next;
+		timer_wheel_enqueue(wheel, timer);
+		timer = next;
+	}
+
+	// the next level's slot is due whenever this one wraps around
+	if(index == 0 && level < TIMER_WHEEL_LEVELS - 1) {
+		timer_wheel_cascade(wheel, level + 1);
+	}
+}
+
+static int timer_wheel_next_slot(uint64_t occupied, int start) {
+	if(occupied == 0) {
+		return -1;
+	}
+
+	uint64_t upper = occupied & (~0ull << start);
+	if(upper) {
+		return __builtin_ctzll(upper);
+	}
+
+	return __builtin_ctzll(occupied);
+}
+
+void timer_add(struct timer *timer) {
+	struct timer_wheel *wheel = this_cpu_read(timer_wheel);
+
+	spinlock_irqsave(&wheel->lock);
+
+	if(wheel->pending == 0) {
+		wheel->clk = clock_monotonic_ns() >> TIMER_WHEEL_SHIFT;
+	}
+
+	timer->wheel = wheel;
+	timer->pending = true;
+
+	timer_wheel_enqueue(wheel, timer);
+	wheel->pending++;
+
+	spinrelease_irqsave(&wheel->lock);
+
+	sched_timer_armed(timer->deadline);
+}
+
+bool timer_cancel(struct timer *timer) {
+	struct timer_wheel *wheel = timer->wheel;
+	if(wheel == NULL) {
+		return false;
+	}
+
+	spinlock_irqsave(&wheel->lock);
+
+	bool pending = timer->pending;
+
+	if(pending) {
+		timer_wheel_unlink(wheel, timer);
+		timer->pending = false;
+		wheel->pending--;
+	}
+
+	spinrelease_irqsave(&wheel->lock);
+
+	// the expiry might be running on the owning cpu right now, let it finish before the caller frees
+	while(__atomic_load_n(&wheel->running, __ATOMIC_ACQUIRE) == timer) {
+		asm ("pause");
+	}
+
+	return pending;
+}
+
+uint64_t timer_next_deadline() {
+	struct timer_wheel *wheel = this_cpu_read(timer_wheel);
+	uint64_t deadline = ~0ull;
+
+	spinlock_irqsave(&wheel->lock);
+
+	for(int level = 0; level < TIMER_WHEEL_LEVELS && wheel->pending; level++) {
+		int position = (wheel->clk >> (level * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK;
+		int start = position;
+
+		// once the clock is past a slot boundary the current slot has been cascaded, whatever is
+		// left there has wrapped around and comes last
+		if(level && (wheel->clk & ((1ull << (level * TIMER_WHEEL_BITS)) - 1))) {
+			start = (position + 1) & TIMER_WHEEL_MASK;
+		}
+
+		int index = timer_wheel_next_slot(wheel->occupied[level], start);
+		if(index == -1) {
+			continue;
+		}
+
+		// report when the wheel will actually fire it, an earlier tick would find nothing to expire
+		for(struct timer *timer = wheel->slots[level][index]; timer; timer = timer->next) {
+			uint64_t expiry = timer_expiry(timer->deadline) << TIMER_WHEEL_SHIFT;
+
+			if(expiry < deadline) {
+				deadline = expiry;
+			}
+		}
+	}
+
+	spinrelease_irqsave(&wheel->lock);
+
+	return deadline;
+}
+
+void timer_run_expired() {
+	struct timer_wheel *wheel = this_cpu_read(timer_wheel);
+	uint64_t now = clock_monotonic_ns() >> TIMER_WHEEL_SHIFT;
+
+	spinlock_irqsave(&wheel->lock);
+
+	if(wheel->pending == 0) {
+		wheel->clk = now;
+		spinrelease_irqsave(&wheel->lock);
+		return;
+	}
+
+	while(wheel->clk <= now) {
+		int index = wheel->clk & TIMER_WHEEL_MASK;
+
+		if(index == 0) {
+			timer_wheel_cascade(wheel, 1);
+		}
+
+		while(wheel->slots[0][index]) {
+			struct timer *timer = wheel->slots[0][index];
+
+			timer_wheel_unlink(wheel, timer);
+			timer->pending = false;
+			wheel->pending--;
+
+			__atomic_store_n(&wheel->running, timer, __ATOMIC_RELEASE);
+
+			// wake outside of the wheel lock, waitq_wake ends up in the run queues
+			spinrelease_irqsave(&wheel->lock);
+
+			for(size_t i = 0; i < timer->triggers.length; i++) {
+				struct waitq_trigger *trigger = timer->triggers.data[i];
+				waitq_trigger_calibrate(trigger, CURRENT_TASK, EVENT_TIMER);
+				waitq_wake(trigger);
+			}
+
+			if(timer->callback) {
+				timer->callback(timer);
+			}
+
+			spinlock_irqsave(&wheel->lock);
+
+			__atomic_store_n(&wheel->running, NULL, __ATOMIC_RELEASE);
+		}
+
+		// nothing left on level 0 before it wraps, skip straight to the next cascade
+		if((wheel->occupied[0] >> index) == 0) {
+			uint64_t boundary = (wheel->clk | TIMER_WHEEL_MASK) + 1;
+			wheel->clk = boundary <= now ? boundary : now + 1;
+		} else {
+			wheel->clk++;
+		}
+	}
+
+	spinrelease_irqsave(&wheel->lock);
+}
+
+int sleep_until(uint64_t deadline) {
+	if(clock_monotonic_ns() >= deadline) {
+		return 0;
+	}
+
+	// nothing to block yet this early in boot
+	if(CURRENT_TASK == NULL) {
+		while(clock_monotonic_ns() < deadline) {
+			asm ("pause");
+		}
+
+		return 0;
+	}
+
+	struct task *task = CURRENT_TASK;
+
+	struct waitq waitq = { 0 };
+	struct timer *timer = waitq_set_deadline(&waitq, deadline);
+
+	task->sleep_timer = timer;
+	int ret = waitq_wait(&waitq, EVENT_TIMER);
+	task->sleep_timer = NULL;
+
+	waitq_cancel_timer(&waitq, timer);
+
+	return ret == -1 ? -1 : 0;
+}
+
+void msleep(size_t ms) {
+	uint64_t deadline = clock_monotonic_ns() + ms * 1000000;
+
+	while(sleep_until(deadline) == -1);
+}
+
+void usleep(size_t us) {
+	uint64_t deadline = clock_monotonic_ns() + us * 1000;
+
+	while(sleep_until(deadline) == -1);
+}
+
+static int timer_nanosleep(clockid_t clockid, int flags, const struct timespec *request, struct timespec *remaining) {
+	if(request->tv_sec < 0 || request->tv_nsec < 0 || request->tv_nsec >= TIMER_HZ) {
+		set_errno(EINVAL);
+		return -1;
+	}
+
+	uint64_t now = clock_monotonic_ns();
+	uint64_t deadline;
+
+	switch(clockid) {
+		case CLOCK_REALTIME:
+			deadline = timespec_to_ns(*request);
+
+			// absolute realtime deadlines are moved onto the monotonic clock the wheel runs on
+			if(flags & TIMER_ABSTIME) {
+				uint64_t realtime = clock_realtime_ns();
+				deadline = deadline > realtime ? now + (deadline - realtime) : now;
+			} else {
+				deadline += now;
+			}
+
+			break;
+		case CLOCK_MONOTONIC:
+		case CLOCK_BOOTTIME:
+			deadline = timespec_to_ns(*request);
+
+			if((flags & TIMER_ABSTIME) == 0) {
+				deadline += now;
+			}
+
+			break;
+		default:
+			set_errno(EINVAL);
+			return -1;
+	}
+
+	if(sleep_until(deadline) == -1) {
+		if(remaining && (flags & TIMER_ABSTIME) == 0) {
+			now = clock_monotonic_ns();
+			*remaining = timespec_convert_ns(deadline > now ? deadline - now : 0);
+		}
+
+		return -1;
+	}
+
+	return 0;
+}
+
+void syscall_nanosleep(struct registers *regs) {
+	const struct timespec *request = (void*)regs->rdi;
+	struct timespec *remaining = (void*)regs->rsi;
+
+#ifndef SYSCALL_DEBUG
+	print("syscall: [pid %x, tid %x] nanosleep: request {%x}, remaining {%x}\n", this_cpu_read(pid), this_cpu_read(tid), request, remaining);
+#endif
+
+	if(request == NULL) {
+		set_errno(EFAULT);
+		regs->rax = -1;
+		return;
+	}
+
+	regs->rax = timer_nanosleep(CLOCK_MONOTONIC, 0, request, remaining);
+}
+
+void syscall_clock_nanosleep(struct registers *regs) {
+	clockid_t clockid = regs->rdi;
+	int flags = regs->rsi;
+	const struct timespec *request = (void*)regs->rdx;
+	struct timespec *remaining = (void*)regs->r10;
+
+#ifndef SYSCALL_DEBUG
+	print("syscall: [pid %x, tid %x] clock_nanosleep: clockid {%x}, flags {%x}, request {%x}, remaining {%x}\n", this_cpu_read(pid), this_cpu_read(tid), clockid, flags, request, remaining);
+#endif
+
+	if(request == NULL) {
+		set_errno(EFAULT);
+		regs->rax = -1;
+		return;
+	}
+
+	regs->rax = timer_nanosleep(clockid, flags, request, remaining);
+}
@@ -0,0 +1,220 @@
+#include <sched/topology.h>
+#include <sched/smp.h>
+#include <mm/slab.h>
+#include <debug.h>
+#include <cpu.h>
+
+static const struct {
+	const char *name;
+	int flags;
+} topology_levels[] = {
+	{ .name = "smt", .flags = SD_SHARE_CORE | SD_SHARE_LLC | SD_SHARE_PACKAGE },
+	{ .name = "llc", .flags = SD_SHARE_LLC | SD_SHARE_PACKAGE },
+	{ .name = "package", .flags = SD_SHARE_PACKAGE },
+	{ .name = "system", .flags = 0 }
+};
+
+// number of apic id bits needed to tell count logical processors apart
+static int topology_shift(uint32_t count) {
+	int shift = 0;
+
+	while((1ull << shift) < count) {
+		shift++;
+	}
+
+	return shift;
+}
+
+// deterministic cache parameters, leaf 4 on intel and 0x8000001d on amd share the layout
+static int topology_llc_shift(uint32_t leaf) {
+	int shift = -1;
+	int level = 0;
+
+	for(int subleaf = 0; subleaf < 16; subleaf++) {
+		struct cpuid_state state = cpuid(leaf, subleaf);
+
+		if((state.rax & 0x1f) == CPUID_CACHE_NULL) {
+			break;
+		}
+
+		int cache_level = (state.rax >> 5) & 0x7;
+		uint32_t sharing = ((state.rax >> 14) & 0xfff) + 1;
+
+		if(cache_level >= level) {
+			level = cache_level;
+			shift = topology_shift(sharing);
+		}
+	}
+
+	return shift;
+}
+
+// has to run on the processor being described, cpuid only ever reports on the caller
+void topology_detect(struct cpu_local *cpu_local) {
+	uint32_t max_leaf = cpuid(0, 0).rax;
+	uint32_t max_extended_leaf = cpuid(0x80000000, 0).rax;
+
+	struct cpuid_state state = cpuid(1, 0);
+
+	uint32_t apic_id = state.rbx >> 24;
+	int smt_shift = 0;
+	int package_shift = 0;
+
+	uint32_t leaf = 0;
+	if(max_leaf >= 0x1f && cpuid(0x1f, 0).rbx) {
+		leaf = 0x1f;
+	} else if(max_leaf >= 0xb && cpuid(0xb, 0).rbx) {
+		leaf = 0xb;
+	}
+
+	if(leaf) {
+		for(int subleaf = 0; subleaf < 8; subleaf++) {
+			struct cpuid_state level = cpuid(leaf, subleaf);
+
+			int type = (level.rcx >> 8) & 0xff;
+			if(type == 0) {
+				break;
+			}
+
+			if(type == CPUID_TOPOLOGY_SMT) {
+				smt_shift = level.rax & 0x1f;
+			}
+
+			// the last level reported spans the whole package
+			package_shift = level.rax & 0x1f;
+			apic_id = level.rdx;
+		}
+	} else if(state.rdx & (1 << 28)) {
+		// no extended topology, fall back on the logical processor and core counts. without any
+		// core count every logical processor is taken for a core of its own
+		uint32_t logical = (state.rbx >> 16) & 0xff;
+		uint32_t cores = logical;
+
+		uint32_t cache = max_leaf >= 4 ? cpuid(4, 0).rax : 0;
+
+		if((cache & 0x1f) != CPUID_CACHE_NULL) {
+			cores = ((cache >> 26) & 0x3f) + 1;
+		} else if(max_extended_leaf >= 0x8000001e && (cpuid(0x80000001, 0).rcx & (1 << 22))) {
+			// amd leaves leaf 4 empty, the threads per core are in the extended apic id leaf
+			cores = logical / (((cpuid(0x8000001e, 0).rbx >> 8) & 0xff) + 1);
+		}
+
+		if(cores == 0) {
+			cores = 1;
+		}
+
+		package_shift = topology_shift(logical);
+		smt_shift = cores < logical ? topology_shift(logical / cores) : 0;
+	}
+
+	int llc_shift = -1;
+
+	if(max_leaf >= 4) {
+		llc_shift = topology_llc_shift(4);
+	}
+
+	if(llc_shift == -1 && max_extended_leaf >= 0x8000001d && (cpuid(0x80000001, 0).rcx & (1 << 22))) {
+		llc_shift = topology_llc_shift(0x8000001d);
+	}
+
+	if(llc_shift == -1 || llc_shift > package_shift) {
+		llc_shift = package_shift;
+	} else if(llc_shift < smt_shift) {
+		llc_shift = smt_shift;
+	}
+
+	cpu_local->topology = (struct cpu_topology) {
+		.x2apic_id = apic_id,
+		.core_id = apic_id >> smt_shift,
+		.llc_id = apic_id >> llc_shift,
+		.package_id = apic_id >> package_shift
+	};
+}
+
+static bool topology_shared(struct cpu_local *a, struct cpu_local *b, int flags) {
+	if(flags & SD_SHARE_CORE) {
+		return a->topology.core_id == b->topology.core_id;
+	} else if(flags & SD_SHARE_LLC) {
+		return a->topology.llc_id == b->topology.llc_id;
+	} else if(flags & SD_SHARE_PACKAGE) {
+		return a->topology.package_id == b->topology.package_id;
+	}
+
+	return true;
+}
+
+void sched_domains_init() {
+	for(size_t i = 0; i < cpu_local_list.length; i++) {
+		struct cpu_local *cpu_local = cpu_local_list.data[i];
+		struct sched_domain *child = NULL;
+
+		for(size_t j = 0; j < sizeof(topology_levels) / sizeof(topology_levels[0]); j++) {
+			struct cpuset span;
+			cpuset_zero(&span);
+
+			for(size_t k = 0; k < cpu_local_list.length; k++) {
+				if(topology_shared(cpu_local, cpu_local_list.data[k], topology_levels[j].flags)) {
+					cpuset_set(&span, k);
+				}
+			}
+
+			// a level that adds nothing over the one below it has nothing to balance
+			if((child && cpuset_equal(&span, &child->span)) || cpuset_weight(&span) == 1) {
+				continue;
+			}
+
+			struct sched_domain *domain = alloc(sizeof(struct sched_domain));
+
+			*domain = (struct sched_domain) {
+				.name = topology_levels[j].name,
+				.flags = topology_levels[j].flags,
+				.span = span,
+				.parent = NULL
+			};
+
+			if(child) {
+				child->parent = domain;
+			} else {
+				cpu_local->sched_domain = domain;
+			}
+
+			child = domain;
+		}
+
+		print("smp: cpu %d x2apic_id %x core %x llc %x package %x\n", i, cpu_local->topology.x2apic_id,
+			cpu_local->topology.core_id, cpu_local->topology.llc_id, cpu_local->topology.package_id);
+
+		for(struct sched_domain *domain = cpu_local->sched_domain; domain; domain = domain->parent) {
+			print("smp: cpu %d domain %s spans %d cpus [%x]\n", i, domain->name, cpuset_weight(&domain->span), domain->span.bits[0]);
+		}
+	}
+}
+
+struct sched_domain *sched_domain_llc(struct cpu_local *cpu_local) {
+	struct sched_domain *llc = NULL;
+
+	for(struct sched_domain *domain = cpu_local->sched_domain; domain; domain = domain->parent) {
+		if(domain->flags & SD_SHARE_LLC) {
+			llc = domain;
+		}
+	}
+
+	return llc;
+}
+
+bool sched_core_idle(struct cpu_local *cpu_local) {
+	for(size_t i = 0; i < cpu_local_list.length; i++) {
+		struct cpu_local *sibling = cpu_local_list.data[i];
+
+		if(sibling->topology.core_id != cpu_local->topology.core_id) {
+			continue;
+		}
+
+		if(__atomic_load_n(&sibling->run_queue->current, __ATOMIC_RELAXED) != NULL ||
+			__atomic_load_n(&sibling->run_queue->load, __ATOMIC_RELAXED) != 0) {
+			return false;
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <sched/smp.h>
+
+#define CPUID_TOPOLOGY_SMT 1
+#define CPUID_TOPOLOGY_CORE 2
+
+#define CPUID_CACHE_NULL 0
+
+void topology_detect(struct cpu_local *cpu_local);
+void sched_domains_init();
+
+struct sched_domain *sched_domain_llc(struct cpu_local *cpu_local);
+bool sched_core_idle(struct cpu_local *cpu_local);
@@ -0,0 +1,110 @@
+#include <sched/vdso.h>
+#include <drivers/clocksource.h>
+#include <mm/vmm.h>
+#include <mm/pmm.h>
+#include <mm/mmap.h>
+#include <elf.h>
+#include <string.h>
+#include <debug.h>
+#include <time.h>
+#include <cpu.h>
+
+asm (
+	".global vdso_image_begin\n\t"
+	"vdso_image_begin: .incbin \"vdso/vdso.so\"\n\t"
+	".global vdso_image_end\n\t"
+	"vdso_image_end:\n\t"
+);
+
+extern uint8_t vdso_image_begin[];
+extern uint8_t vdso_image_end[];
+
+volatile struct vdso_data *vdso_data;
+
+static uint64_t vdso_data_frame;
+static uint64_t vdso_image_frame;
+static size_t vdso_image_pages;
+
+static struct spinlock vdso_lock;
+
+static bool vdso_rdtscp() {
+	struct cpuid_state cpuid_state = cpuid(0x80000001, 0);
+
+	return cpuid_state.rdx & (1 << 27);
+}
+
+void vdso_update() {
+	spinlock_irqsave(&vdso_lock);
+
+	// readers retry while the sequence is odd or changed underneath them
+	__atomic_store_n(&vdso_data->seq, vdso_data->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	struct clocksource *source = clocksource;
+
+	if(source && strcmp(source->name, "tsc") == 0) {
+		vdso_data->clock_mode = VDSO_CLOCK_TSC;
+		vdso_data->cycle_base = source->base;
+		vdso_data->mult = source->mult;
+		vdso_data->monotonic_offset = source->offset;
+	} else {
+		vdso_data->clock_mode = VDSO_CLOCK_NONE;
+	}
+
+	vdso_data->realtime_offset = clock_realtime_ns() - clock_monotonic_ns();
+
+	__atomic_store_n(&vdso_data->seq, vdso_data->seq + 1, __ATOMIC_RELEASE);
+
+	spinrelease_irqsave(&vdso_lock);
+}
+
+uintptr_t vdso_map(struct page_table *page_table, uintptr_t base) {
+	size_t length = (vdso_image_pages + 1) * PAGE_SIZE;
+
+	// fork hands us the parent's base, the region itself is copied along with the rest of the tree
+	if(base == 0) {
+		void *addr = mmap(page_table, NULL, length, MMAP_PROT_READ | MMAP_PROT_EXEC | MMAP_PROT_USER, MMAP_MAP_PRIVATE | MMAP_MAP_ANONYMOUS, -1, 0);
+		if(addr == MMAP_MAP_FAILED) {
+			return 0;
+		}
+
+		base = (uintptr_t)addr;
+	}
+
+	// both are mapped up front and never enter the page hash, so exit and cow leave them alone
+	page_table->map_page(page_table, base, vdso_data_frame, VMM_FLAGS_P | VMM_FLAGS_US | VMM_FLAGS_NX);
+
+	for(size_t i = 0; i < vdso_image_pages; i++) {
+		page_table->map_page(page_table, base + (i + 1) * PAGE_SIZE, vdso_image_frame + i * PAGE_SIZE, VMM_FLAGS_P | VMM_FLAGS_US);
+	}
+
+	page_table->vdso_base = base;
+
+	return base;
+}
+
+void vdso_cpu_init(int cpu_number) {
+	if(vdso_rdtscp()) {
+		wrmsr(MSR_TSC_AUX, cpu_number);
+	}
+}
+
+void vdso_init() {
+	size_t image_size = vdso_image_end - vdso_image_begin;
+
+	if(image_size < sizeof(struct elf64_hdr) || *(uint32_t*)vdso_image_begin != ELF_SIGNATURE) {
+		panic("vdso: bad image");
+	}
+
+	vdso_image_pages = DIV_ROUNDUP(image_size, PAGE_SIZE);
+	vdso_image_frame = pmm_alloc(vdso_image_pages, 1);
+	memcpy8((void*)(vdso_image_frame + HIGH_VMA), vdso_image_begin, image_size);
+
+	vdso_data_frame = pmm_alloc(1, 1);
+	vdso_data = (void*)(vdso_data_frame + HIGH_VMA);
+	vdso_data->rdtscp = vdso_rdtscp();
+
+	vdso_update();
+
+	print("vdso: %d pages, %s clock\n", vdso_image_pages, vdso_data->clock_mode == VDSO_CLOCK_TSC ? "tsc" : "syscall");
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <types.h>
+#include <vdso/vdso_data.h>
+
+#define MSR_TSC_AUX 0xc0000103
+
+struct page_table;
+
+extern volatile struct vdso_data *vdso_data;
+
+void vdso_update();
+uintptr_t vdso_map(struct page_table *page_table, uintptr_t base);
+void vdso_cpu_init(int cpu_number);
+void vdso_init();
@@ -0,0 +1,198 @@
+#include <sched/workqueue.h>
+#include <sched/kthread.h>
+#include <sched/sched.h>
+#include <debug.h>
+#include <cpu.h>
+
+static void worker_thread(void *arg) {
+	struct worker_pool *pool = arg;
+
+	for(;;) {
+		// forget older wakeups, anything queued from here on makes the wait fall through
+		spinlock_irqsave(&pool->waitq.lock);
+		waitq_release(&pool->waitq, EVENT_WORK);
+		spinrelease_irqsave(&pool->waitq.lock);
+
+		spinlock_irqsave(&pool->lock);
+
+		struct work *work = pool->head;
+		if(work == NULL) {
+			spinrelease_irqsave(&pool->lock);
+			waitq_wait(&pool->waitq, EVENT_WORK);
+			continue;
+		}
+
+		pool->head = work->next;
+		if(pool->head == NULL) {
+			pool->tail = NULL;
+		}
+
+		work->next = NULL;
+		pool->current = work;
+
+		// cleared before it runs, so a work may queue itself again
+		__atomic_store_n(&work->pending, false, __ATOMIC_RELEASE);
+
+		spinrelease_irqsave(&pool->lock);
+
+		work->func(work);
+
+		// the work may already be gone, it is only compared against from here on
+		spinlock_irqsave(&pool->lock);
+		pool->current = NULL;
+		spinrelease_irqsave(&pool->lock);
+
+		waitq_wake(&pool->flush_trigger);
+	}
+}
+
+static void worker_pool_insert(struct worker_pool *pool, struct work *work) {
+	spinlock_irqsave(&pool->lock);
+
+	work->pool = pool;
+	work->next = NULL;
+
+	if(pool->tail) {
+		pool->tail->next = work;
+	} else {
+		pool->head = work;
+	}
+
+	pool->tail = work;
+
+	spinrelease_irqsave(&pool->lock);
+
+	waitq_wake(&pool->trigger);
+}
+
+static bool work_claim(struct work *work) {
+	bool pending = false;
+	return __atomic_compare_exchange_n(&work->pending, &pending, true, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+static struct worker_pool *worker_pool_get(int cpu) {
+	if(cpu < 0 || cpu >= (int)cpu_local_list.length || cpu_local_list.data[cpu]->worker_pool == NULL) {
+		panic("");
+	}
+
+	return cpu_local_list.data[cpu]->worker_pool;
+}
+
+// safe from interrupt context, returns false when the work was already pending
+bool queue_work_on(int cpu, struct work *work) {
+	if(!work_claim(work)) {
+		return false;
+	}
+
+	worker_pool_insert(worker_pool_get(cpu), work);
+
+	return true;
+}
+
+bool queue_work(struct work *work) {
+	return queue_work_on(this_cpu_read(cpu_number), work);
+}
+
+static void delayed_work_timer(struct timer *timer) {
+	struct delayed_work *dwork = (struct delayed_work*)((uintptr_t)timer - offsetof(struct delayed_work, timer));
+
+	worker_pool_insert(this_cpu_read(worker_pool), &dwork->work);
+}
+
+// the timer lives on this cpu's wheel, so the work ends up on this cpu's pool
+bool queue_delayed_work(struct delayed_work *dwork, uint64_t delay) {
+	if(!work_claim(&dwork->work)) {
+		return false;
+	}
+
+	struct worker_pool *pool = worker_pool_get(this_cpu_read(cpu_number));
+
+	if(delay == 0) {
+		worker_pool_insert(pool, &dwork->work);
+		return true;
+	}
+
+	dwork->work.pool = pool;
+
+	dwork->timer.deadline = clock_monotonic_ns() + delay;
+	dwork->timer.callback = delayed_work_timer;
+	timer_add(&dwork->timer);
+
+	return true;
+}
+
+// only stops a work that is still waiting on its timer, one that made it onto a pool runs
+bool cancel_delayed_work(struct delayed_work *dwork) {
+	if(!timer_cancel(&dwork->timer)) {
+		return false;
+	}
+
+	__atomic_store_n(&dwork->work.pending, false, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+// waits until the work is neither queued nor running. must be called from a task, and never
+// from the work itself
+void flush_work(struct work *work) {
+	for(;;) {
+		struct worker_pool *pool = __atomic_load_n(&work->pool, __ATOMIC_ACQUIRE);
+		if(pool == NULL) {
+			return;
+		}
+
+		// forget older completions, any from here on makes the wait fall through
+		spinlock_irqsave(&pool->flush_waitq.lock);
+		waitq_release(&pool->flush_waitq, EVENT_WORK);
+		spinrelease_irqsave(&pool->flush_waitq.lock);
+
+		spinlock_irqsave(&pool->lock);
+
+		bool moved = work->pool != pool;
+		bool busy = __atomic_load_n(&work->pending, __ATOMIC_ACQUIRE) || pool->current == work;
+
+		spinrelease_irqsave(&pool->lock);
+
+		if(moved) {
+			continue;
+		}
+
+		if(!busy) {
+			return;
+		}
+
+		waitq_wait(&pool->flush_waitq, EVENT_WORK);
+	}
+}
+
+// a work still waiting on its timer is queued right away rather than waited for
+void flush_delayed_work(struct delayed_work *dwork) {
+	if(timer_cancel(&dwork->timer)) {
+		worker_pool_insert(dwork->work.pool, &dwork->work);
+	}
+
+	flush_work(&dwork->work);
+}
+
+void workqueue_init() {
+	for(size_t i = 0; i < cpu_local_list.length; i++) {
+		struct worker_pool *pool = alloc(sizeof(struct worker_pool));
+
+		pool->cpu = i;
+
+		pool->trigger.waitq = &pool->waitq;
+		pool->trigger.type = EVENT_WORK;
+
+		pool->flush_trigger.waitq = &pool->flush_waitq;
+		pool->flush_trigger.type = EVENT_WORK;
+
+		pool->thread = kthread_create(worker_thread, pool);
+		if(kthread_bind(pool->thread, i) == -1) {
+			panic("workqueue: unable to bind worker to cpu %d", i);
+		}
+
+		cpu_local_list.data[i]->worker_pool = pool;
+
+		kthread_start(pool->thread);
+	}
+}
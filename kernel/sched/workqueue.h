@@ -0,0 +1,59 @@
+#pragma once
+
+#include <sched/queue.h>
+#include <types.h>
+#include <time.h>
+#include <lock.h>
+
+struct work;
+struct worker_pool;
+
+typedef void (*work_func_t)(struct work *work);
+
+struct work {
+	work_func_t func;
+	struct work *next;
+
+	// the pool it was last queued on, flush_work looks there
+	struct worker_pool *pool;
+	bool pending;
+};
+
+struct delayed_work {
+	struct work work;
+	struct timer timer;
+};
+
+// one per cpu, drained in order by a kernel thread bound to that cpu
+struct worker_pool {
+	struct spinlock lock;
+
+	struct work *head;
+	struct work *tail;
+	struct work *current;
+
+	struct task *thread;
+	int cpu;
+
+	struct waitq waitq;
+	struct waitq_trigger trigger;
+
+	struct waitq flush_waitq;
+	struct waitq_trigger flush_trigger;
+};
+
+static inline void work_init(struct work *work, work_func_t func) {
+	*work = (struct work) { .func = func };
+}
+
+static inline void delayed_work_init(struct delayed_work *dwork, work_func_t func) {
+	*dwork = (struct delayed_work) { .work = { .func = func } };
+}
+
+void workqueue_init();
+bool queue_work(struct work *work);
+bool queue_work_on(int cpu, struct work *work);
+bool queue_delayed_work(struct delayed_work *dwork, uint64_t delay);
+bool cancel_delayed_work(struct delayed_work *dwork);
+void flush_work(struct work *work);
+void flush_delayed_work(struct delayed_work *dwork);
@@ -0,0 +1,152 @@
+#include <stdint.h>
+#include <vdso/vdso_data.h>
+#include <lib/errno.h>
+
+#define CLOCK_REALTIME 0
+#define CLOCK_MONOTONIC 1
+#define CLOCK_MONOTONIC_RAW 4
+#define CLOCK_REALTIME_COARSE 5
+#define CLOCK_MONOTONIC_COARSE 6
+#define CLOCK_BOOTTIME 7
+
+#define SYSCALL_CLOCK_GETTIME 72
+
+#define NSEC_PER_SEC 1000000000ull
+
+struct vdso_timespec {
+	int64_t tv_sec;
+	long tv_nsec;
+};
+
+struct vdso_timeval {
+	int64_t tv_sec;
+	long tv_usec;
+};
+
+// placed one page below the image by the linker script, the kernel maps the time data page there
+extern volatile struct vdso_data __vdso_data __attribute__((visibility("hidden")));
+
+static inline uint32_t vdso_read_begin() {
+	uint32_t seq;
+
+	while((seq = __atomic_load_n(&__vdso_data.seq, __ATOMIC_ACQUIRE)) & 1) {
+		asm volatile ("pause");
+	}
+
+	return seq;
+}
+
+static inline int vdso_read_retry(uint32_t seq) {
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&__vdso_data.seq, __ATOMIC_RELAXED) != seq;
+}
+
+static inline uint64_t vdso_rdtsc() {
+	uint32_t low, high;
+	asm volatile ("lfence\n\trdtsc" : "=a"(low), "=d"(high) :: "memory");
+	return ((uint64_t)high << 32) | low;
+}
+
+static int vdso_syscall_clock_gettime(int clock, struct vdso_timespec *timespec) {
+	long ret, error;
+
+	asm volatile ("syscall" : "=a"(ret), "=d"(error) : "a"(SYSCALL_CLOCK_GETTIME), "D"(clock), "S"(timespec) : "rcx", "r11", "memory");
+
+	return ret == -1 ? error : 0;
+}
+
+// 0 when the counter is not readable from ring 3 and the caller has to go through the kernel
+static int vdso_read_ns(int realtime, uint64_t *ns) {
+	uint32_t seq;
+	uint64_t ret;
+
+	do {
+		seq = vdso_read_begin();
+
+		if(__vdso_data.clock_mode != VDSO_CLOCK_TSC) {
+			return 0;
+		}
+
+		uint64_t cycles = vdso_rdtsc() - __vdso_data.cycle_base;
+
+		ret = __vdso_data.monotonic_offset + (uint64_t)(((__uint128_t)cycles * __vdso_data.mult) >> VDSO_CLOCK_SHIFT);
+
+		if(realtime) {
+			ret += __vdso_data.realtime_offset;
+		}
+	} while(vdso_read_retry(seq));
+
+	*ns = ret;
+
+	return 1;
+}
+
+static int vdso_clock_gettime(int clock, struct vdso_timespec *timespec) {
+	int realtime;
+
+	switch(clock) {
+		case CLOCK_REALTIME:
+		case CLOCK_REALTIME_COARSE:
+			realtime = 1;
+			break;
+		case CLOCK_MONOTONIC:
+		case CLOCK_MONOTONIC_RAW:
+		case CLOCK_MONOTONIC_COARSE:
+		case CLOCK_BOOTTIME:
+			realtime = 0;
+			break;
+		default:
+			return EINVAL;
+	}
+
+	uint64_t ns;
+	if(!vdso_read_ns(realtime, &ns)) {
+		return vdso_syscall_clock_gettime(clock, timespec);
+	}
+
+	timespec->tv_sec = ns / NSEC_PER_SEC;
+	timespec->tv_nsec = ns % NSEC_PER_SEC;
+
+	return 0;
+}
+
+int __vdso_clock_gettime(int clock, struct vdso_timespec *timespec) {
+	return vdso_clock_gettime(clock, timespec);
+}
+
+int __vdso_gettimeofday(struct vdso_timeval *timeval, void *timezone) {
+	(void)timezone;
+
+	if(timeval == 0) {
+		return 0;
+	}
+
+	struct vdso_timespec timespec;
+
+	int ret = vdso_clock_gettime(CLOCK_REALTIME, &timespec);
+	if(ret) {
+		return ret;
+	}
+
+	timeval->tv_sec = timespec.tv_sec;
+	timeval->tv_usec = timespec.tv_nsec / 1000;
+
+	return 0;
+}
+
+int __vdso_getcpu(unsigned *cpu, unsigned *node, void *cache) {
+	(void)cache;
+
+	if(!__vdso_data.rdtscp) {
+		return ENOSYS;
+	}
+
+	// the kernel loads the cpu number into IA32_TSC_AUX on every core
+	uint32_t low, high, aux;
+	asm volatile ("rdtscp" : "=a"(low), "=d"(high), "=c"(aux));
+
+	if(cpu) *cpu = aux;
+	if(node) *node = 0;
+
+	return 0;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+// shared between the kernel and the vdso image, so only fixed width types and no includes
+
+#define VDSO_CLOCK_NONE 0 // no user readable counter, fall back to the syscall
+#define VDSO_CLOCK_TSC 1
+
+#define VDSO_CLOCK_SHIFT 32
+
+struct vdso_data {
+	uint32_t seq;
+	uint32_t clock_mode;
+
+	uint64_t cycle_base;
+	uint64_t mult;
+	uint64_t monotonic_offset;
+	uint64_t realtime_offset;
+
+	uint32_t rdtscp;
+} __attribute__((packed));
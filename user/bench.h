@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+// what every benchmark under user/ shares, each program only brings its own workload
+
+static inline uint64_t bench_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// positional arguments are plain counts, a missing one takes the default
+static inline uint64_t bench_arg(int argc, char *argv[], int index, uint64_t fallback) {
+	return argc > index ? strtoull(argv[index], NULL, 10) : fallback;
+}
+
+static inline void bench_usage(const char *name, const char *args) {
+	fprintf(stderr, "usage: %s %s\n", name, args);
+	exit(1);
+}
+
+// unbuffered, so the runs that finished are on the console even if a later one hangs
+static inline void bench_init() {
+	setbuf(stdout, NULL);
+}
+
+// count is how many times the measured operation ran, units names them in the plural
+static inline void bench_report(const char *name, uint64_t count, const char *units, uint64_t elapsed) {
+	printf("%s: %llu %s in %llu us, %llu ns each\n", name, (unsigned long long)count, units,
+		(unsigned long long)(elapsed / 1000), (unsigned long long)(elapsed / count));
+}
@@ -0,0 +1,73 @@
+#include <unistd.h>
+#include <sys/wait.h>
+#include "bench.h"
+
+#define DEFAULT_TASKS 8
+#define DEFAULT_WORK 200000000
+
+// pure register work, nothing here touches the kernel or shares a cache line with anyone
+static uint64_t spin(uint64_t work) {
+	uint64_t x = 0x9e3779b97f4a7c15;
+
+	for(uint64_t i = 0; i < work; i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+	}
+
+	return x;
+}
+
+// every task does the same fixed amount of work, throughput is the total over the wall time
+static uint64_t run(size_t tasks, uint64_t work) {
+	uint64_t start = bench_now();
+
+	for(size_t i = 0; i < tasks; i++) {
+		pid_t pid = fork();
+
+		if(pid == -1) {
+			perror("fork");
+			exit(1);
+		}
+
+		if(pid == 0) {
+			_exit(spin(work) == 0);
+		}
+	}
+
+	for(size_t i = 0; i < tasks; i++) {
+		int status;
+		wait(&status);
+	}
+
+	return bench_now() - start;
+}
+
+// boot with -smp 4 (make run SMP=4), a perfect scheduler scales up to the cpu count and stays flat after
+int main(int argc, char *argv[]) {
+	size_t max_tasks = bench_arg(argc, argv, 1, DEFAULT_TASKS);
+	uint64_t work = bench_arg(argc, argv, 2, DEFAULT_WORK);
+
+	if(max_tasks == 0 || work == 0) {
+		bench_usage(argv[0], "[max tasks] [work per task]");
+	}
+
+	bench_init();
+
+	double base = 0;
+
+	for(size_t tasks = 1; tasks <= max_tasks; tasks *= 2) {
+		uint64_t elapsed = run(tasks, work);
+
+		// units of work per second, in millions
+		double throughput = (double)tasks * work / elapsed * 1000.0;
+		if(tasks == 1) {
+			base = throughput;
+		}
+
+		printf("cpu: %zu tasks in %llu ms, %.1f Mops/s, scaling %.2fx\n", tasks,
+			(unsigned long long)(elapsed / 1000000), throughput, throughput / base);
+	}
+
+	return 0;
+}
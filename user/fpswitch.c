@@ -0,0 +1,120 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <sched.h>
+#include <sys/wait.h>
+#include "bench.h"
+
+#define DEFAULT_ROUNDS 10000
+
+// dirties a handful of vector registers, so every switch away from us has live simd state to save
+static double fp_work(double x) {
+	double a = x, b = x * 0.5, c = x * 0.25, d = x * 0.125;
+
+	for(int i = 0; i < 16; i++) {
+		a = a * 1.0000001 + b;
+		b = b * 0.9999999 + c;
+		c = c * 1.0000001 + d;
+		d = d * 0.9999999 + a;
+	}
+
+	return a + b + c + d;
+}
+
+static uint64_t int_work(uint64_t x) {
+	for(int i = 0; i < 16; i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+	}
+
+	return x;
+}
+
+// both sides sit on one cpu and hand a byte back and forth, every hop is one context switch
+static uint64_t run(size_t rounds, int fp) {
+	int ping[2];
+	int pong[2];
+
+	if(pipe(ping) == -1 || pipe(pong) == -1) {
+		perror("pipe");
+		exit(1);
+	}
+
+	pid_t pid = fork();
+	if(pid == -1) {
+		perror("fork");
+		exit(1);
+	}
+
+	volatile double fsink = 1.0;
+	volatile uint64_t isink = 1;
+	char byte = 0;
+
+	if(pid == 0) {
+		for(size_t i = 0; i < rounds; i++) {
+			if(read(ping[0], &byte, 1) != 1) {
+				_exit(1);
+			}
+
+			if(fp) fsink = fp_work(fsink);
+			else isink = int_work(isink);
+
+			if(write(pong[1], &byte, 1) != 1) {
+				_exit(1);
+			}
+		}
+
+		_exit(0);
+	}
+
+	uint64_t start = bench_now();
+
+	for(size_t i = 0; i < rounds; i++) {
+		if(fp) fsink = fp_work(fsink);
+		else isink = int_work(isink);
+
+		if(write(ping[1], &byte, 1) != 1 || read(pong[0], &byte, 1) != 1) {
+			perror("ping-pong");
+			exit(1);
+		}
+	}
+
+	uint64_t elapsed = bench_now() - start;
+
+	waitpid(pid, NULL, 0);
+
+	close(ping[0]);
+	close(ping[1]);
+	close(pong[0]);
+	close(pong[1]);
+
+	return elapsed;
+}
+
+int main(int argc, char *argv[]) {
+	size_t rounds = bench_arg(argc, argv, 1, DEFAULT_ROUNDS);
+
+	if(rounds == 0) {
+		bench_usage(argv[0], "[rounds]");
+	}
+
+	bench_init();
+
+	// children inherit the mask, so every switch happens on this one cpu
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(0, &set);
+
+	if(sched_setaffinity(0, sizeof(set), &set) == -1) {
+		perror("sched_setaffinity");
+	}
+
+	uint64_t integer = run(rounds, 0);
+	uint64_t fp = run(rounds, 1);
+
+	// two switches per round trip
+	bench_report("integer", rounds * 2, "switches", integer);
+	bench_report("fp", rounds * 2, "switches", fp);
+
+	return 0;
+}
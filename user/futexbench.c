@@ -0,0 +1,93 @@
+#include <pthread.h>
+#include "bench.h"
+
+#define DEFAULT_THREADS 4
+#define DEFAULT_ROUNDS 100000
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+static size_t rounds;
+static size_t threads;
+
+static volatile size_t counter;
+static volatile size_t turn;
+
+// every thread hammers the same lock, the kernel only sees the contended slow path
+static void *mutex_worker(void *arg) {
+	(void)arg;
+
+	for(size_t i = 0; i < rounds; i++) {
+		pthread_mutex_lock(&mutex);
+		counter++;
+		pthread_mutex_unlock(&mutex);
+	}
+
+	return NULL;
+}
+
+// threads pass a token around in order, each handoff is a wait and a broadcast on one condvar
+static void *cond_worker(void *arg) {
+	size_t id = (size_t)arg;
+
+	for(size_t i = 0; i < rounds / threads; i++) {
+		pthread_mutex_lock(&mutex);
+
+		while(turn % threads != id) {
+			pthread_cond_wait(&cond, &mutex);
+		}
+
+		turn++;
+
+		pthread_cond_broadcast(&cond);
+		pthread_mutex_unlock(&mutex);
+	}
+
+	return NULL;
+}
+
+static void run(const char *name, void *(*worker)(void*), size_t operations) {
+	pthread_t *list = calloc(threads, sizeof(pthread_t));
+
+	uint64_t start = bench_now();
+
+	for(size_t i = 0; i < threads; i++) {
+		pthread_create(&list[i], NULL, worker, (void*)i);
+	}
+
+	for(size_t i = 0; i < threads; i++) {
+		pthread_join(list[i], NULL);
+	}
+
+	uint64_t elapsed = bench_now() - start;
+
+	printf("%s: %zu threads, %zu ops in %llu us, %llu ns/op\n", name, threads, operations,
+		(unsigned long long)(elapsed / 1000), (unsigned long long)(elapsed / operations));
+
+	free(list);
+}
+
+int main(int argc, char *argv[]) {
+	threads = bench_arg(argc, argv, 1, DEFAULT_THREADS);
+	rounds = bench_arg(argc, argv, 2, DEFAULT_ROUNDS);
+
+	if(threads == 0 || rounds < threads) {
+		bench_usage(argv[0], "[threads] [rounds]");
+	}
+
+	bench_init();
+
+	run("mutex", mutex_worker, threads * rounds);
+	if(counter != threads * rounds) {
+		printf("mutex: lost updates, counter %zu\n", counter);
+		return 1;
+	}
+
+	run("condvar", cond_worker, (rounds / threads) * threads);
+	if(turn != (rounds / threads) * threads) {
+		printf("condvar: lost handoffs, turn %zu\n", turn);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,79 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include "bench.h"
+
+#define DEFAULT_SECONDS 5
+#define MAX_CPUS 256
+
+struct sample {
+	size_t cpus;
+	uint64_t interrupts[MAX_CPUS];
+	uint64_t sched[MAX_CPUS];
+};
+
+static void sample(struct sample *sample) {
+	static char text[16384];
+
+	int fd = open("/dev/interrupts", O_RDONLY);
+	if(fd == -1) {
+		perror("/dev/interrupts");
+		exit(1);
+	}
+
+	ssize_t length = 0;
+	for(ssize_t ret; (ret = read(fd, text + length, sizeof(text) - 1 - length)) > 0;) {
+		length += ret;
+	}
+
+	close(fd);
+	text[length] = 0;
+
+	sample->cpus = 0;
+
+	// the first line is the header
+	for(char *line = strchr(text, '\n'); line && sample->cpus < MAX_CPUS; line = strchr(line, '\n')) {
+		size_t cpu;
+		unsigned long long interrupts, sched;
+
+		line++;
+		if(sscanf(line, "%zu %llu %llu", &cpu, &interrupts, &sched) != 3) {
+			break;
+		}
+
+		sample->interrupts[sample->cpus] = interrupts;
+		sample->sched[sample->cpus] = sched;
+		sample->cpus++;
+	}
+}
+
+// run on an otherwise idle system, a tickless kernel should only wake for timers that are due
+int main(int argc, char *argv[]) {
+	uint64_t seconds = bench_arg(argc, argv, 1, DEFAULT_SECONDS);
+
+	if(seconds == 0) {
+		bench_usage(argv[0], "[seconds]");
+	}
+
+	bench_init();
+
+	static struct sample before, after;
+
+	sample(&before);
+	uint64_t start = bench_now();
+
+	sleep(seconds);
+
+	sample(&after);
+	uint64_t elapsed = bench_now() - start;
+
+	for(size_t i = 0; i < after.cpus && i < before.cpus; i++) {
+		uint64_t interrupts = after.interrupts[i] - before.interrupts[i];
+		uint64_t sched = after.sched[i] - before.sched[i];
+
+		printf("cpu%zu: %.1f interrupts/s, %.1f of them tick or reschedule\n", i,
+			interrupts * 1e9 / elapsed, sched * 1e9 / elapsed);
+	}
+
+	return 0;
+}
@@ -0,0 +1,96 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/wait.h>
+#include "bench.h"
+
+#define DEFAULT_WAITERS 100
+#define DEFAULT_MS 2000
+
+// iterations of pure register work that fit into the window, whatever the cpu gives away to
+// others is missing from the count
+static uint64_t spin(uint64_t ms) {
+	uint64_t deadline = bench_now() + ms * 1000000;
+	uint64_t count = 0;
+	uint64_t x = 0x9e3779b97f4a7c15;
+
+	while(bench_now() < deadline) {
+		for(int i = 0; i < 1000; i++) {
+			x ^= x << 13;
+			x ^= x >> 7;
+			x ^= x << 17;
+		}
+
+		count++;
+	}
+
+	return count + (x == 0);
+}
+
+// blocked readers should cost nothing, a waiter that polls shows up as lost spin iterations
+int main(int argc, char *argv[]) {
+	size_t waiters = bench_arg(argc, argv, 1, DEFAULT_WAITERS);
+	uint64_t ms = bench_arg(argc, argv, 2, DEFAULT_MS);
+
+	if(ms == 0) {
+		bench_usage(argv[0], "[waiters] [ms]");
+	}
+
+	bench_init();
+
+	// the waiters inherit the mask, anything they burn comes out of the spinner's cpu
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(0, &set);
+
+	if(sched_setaffinity(0, sizeof(set), &set) == -1) {
+		perror("sched_setaffinity");
+	}
+
+	uint64_t base = spin(ms);
+
+	int fds[2];
+	if(pipe(fds) == -1) {
+		perror("pipe");
+		return 1;
+	}
+
+	pid_t *list = calloc(waiters, sizeof(pid_t));
+
+	for(size_t i = 0; i < waiters; i++) {
+		list[i] = fork();
+
+		if(list[i] == -1) {
+			perror("fork");
+			return 1;
+		}
+
+		// nothing is ever written, the read only returns once the writers are gone
+		if(list[i] == 0) {
+			char byte;
+			close(fds[1]);
+			_exit(read(fds[0], &byte, 1) == 0 ? 0 : 1);
+		}
+	}
+
+	// give every waiter the chance to reach its read first
+	usleep(100000);
+
+	uint64_t loaded = spin(ms);
+
+	close(fds[1]);
+
+	for(size_t i = 0; i < waiters; i++) {
+		waitpid(list[i], NULL, 0);
+	}
+
+	free(list);
+
+	double lost = base > loaded ? (double)(base - loaded) * 100.0 / base : 0.0;
+
+	printf("idle: %llu iterations alone, %llu with %zu blocked readers, %.2f%% of the cpu lost\n",
+		(unsigned long long)base, (unsigned long long)loaded, waiters, lost);
+
+	return 0;
+}
@@ -0,0 +1,59 @@
+#include <unistd.h>
+#include <sys/wait.h>
+#include "bench.h"
+
+#define DEFAULT_ROUNDS 10000
+
+// one byte goes back and forth, every round trip is two wakeups of a blocked reader
+int main(int argc, char *argv[]) {
+	size_t rounds = bench_arg(argc, argv, 1, DEFAULT_ROUNDS);
+
+	if(rounds == 0) {
+		bench_usage(argv[0], "[rounds]");
+	}
+
+	bench_init();
+
+	int ping[2];
+	int pong[2];
+
+	if(pipe(ping) == -1 || pipe(pong) == -1) {
+		perror("pipe");
+		return 1;
+	}
+
+	pid_t pid = fork();
+	if(pid == -1) {
+		perror("fork");
+		return 1;
+	}
+
+	char byte = 0;
+
+	if(pid == 0) {
+		for(size_t i = 0; i < rounds; i++) {
+			if(read(ping[0], &byte, 1) != 1 || write(pong[1], &byte, 1) != 1) {
+				_exit(1);
+			}
+		}
+
+		_exit(0);
+	}
+
+	uint64_t start = bench_now();
+
+	for(size_t i = 0; i < rounds; i++) {
+		if(write(ping[1], &byte, 1) != 1 || read(pong[0], &byte, 1) != 1) {
+			perror("pipe ping-pong");
+			return 1;
+		}
+	}
+
+	uint64_t elapsed = bench_now() - start;
+
+	waitpid(pid, NULL, 0);
+
+	bench_report("pipe", rounds, "round trips", elapsed);
+
+	return 0;
+}
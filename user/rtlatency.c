@@ -0,0 +1,78 @@
+#include <unistd.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/wait.h>
+#include "bench.h"
+
+#define DEFAULT_HOGS 4
+#define DEFAULT_ROUNDS 200
+#define INTERVAL_NS 1000000
+
+// sleeps for a fixed interval and records how late every wakeup came back to userspace
+static void measure(const char *name, size_t rounds) {
+	struct timespec interval = { .tv_sec = 0, .tv_nsec = INTERVAL_NS };
+
+	uint64_t total = 0;
+	uint64_t min = ~0ull;
+	uint64_t max = 0;
+
+	for(size_t i = 0; i < rounds; i++) {
+		uint64_t start = bench_now();
+		nanosleep(&interval, NULL);
+		uint64_t late = bench_now() - start - INTERVAL_NS;
+
+		total += late;
+		if(late < min) min = late;
+		if(late > max) max = late;
+	}
+
+	printf("%s: %zu wakeups, latency min %llu us, avg %llu us, max %llu us\n", name, rounds,
+		(unsigned long long)(min / 1000), (unsigned long long)(total / rounds / 1000), (unsigned long long)(max / 1000));
+}
+
+int main(int argc, char *argv[]) {
+	size_t hogs = bench_arg(argc, argv, 1, DEFAULT_HOGS);
+	size_t rounds = bench_arg(argc, argv, 2, DEFAULT_ROUNDS);
+
+	if(rounds == 0) {
+		bench_usage(argv[0], "[hogs] [rounds]");
+	}
+
+	bench_init();
+
+	pid_t *list = calloc(hogs, sizeof(pid_t));
+
+	// plain fair class tasks that never sleep, at least one per cpu to keep every queue busy
+	for(size_t i = 0; i < hogs; i++) {
+		list[i] = fork();
+
+		if(list[i] == -1) {
+			perror("fork");
+			return 1;
+		}
+
+		if(list[i] == 0) {
+			for(;;) {
+				asm volatile ("" ::: "memory");
+			}
+		}
+	}
+
+	measure("other", rounds);
+
+	struct sched_param param = { .sched_priority = 50 };
+	if(sched_setscheduler(0, SCHED_RR, &param) == -1) {
+		perror("sched_setscheduler");
+	} else {
+		measure("rr", rounds);
+	}
+
+	for(size_t i = 0; i < hogs; i++) {
+		kill(list[i], SIGKILL);
+		waitpid(list[i], NULL, 0);
+	}
+
+	free(list);
+
+	return 0;
+}
@@ -0,0 +1,95 @@
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "bench.h"
+
+#define DEFAULT_ROUNDS 10000
+#define SOCKET_PATH "/run/sockbench"
+
+// the kernel has no socketpair, a connected pair comes out of a listener on a throwaway path
+static int connect_pair(int pair[2]) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	strcpy(addr.sun_path, SOCKET_PATH);
+
+	unlink(SOCKET_PATH);
+
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(listener == -1 || bind(listener, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(listener, 1) == -1) {
+		return -1;
+	}
+
+	pid_t pid = fork();
+	if(pid == -1) {
+		return -1;
+	}
+
+	if(pid == 0) {
+		int client = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(client == -1 || connect(client, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+			_exit(1);
+		}
+
+		pair[1] = client;
+		return 0;
+	}
+
+	pair[0] = accept(listener, NULL, NULL);
+	if(pair[0] == -1) {
+		return -1;
+	}
+
+	close(listener);
+
+	return pid;
+}
+
+// every write wakes a reader that was blocked, then the writer blocks on the reply right away
+int main(int argc, char *argv[]) {
+	size_t rounds = bench_arg(argc, argv, 1, DEFAULT_ROUNDS);
+
+	if(rounds == 0) {
+		bench_usage(argv[0], "[rounds]");
+	}
+
+	bench_init();
+
+	int pair[2];
+
+	pid_t pid = connect_pair(pair);
+	if(pid == -1) {
+		perror("sockbench");
+		return 1;
+	}
+
+	char byte = 0;
+
+	if(pid == 0) {
+		for(size_t i = 0; i < rounds; i++) {
+			if(read(pair[1], &byte, 1) != 1 || write(pair[1], &byte, 1) != 1) {
+				_exit(1);
+			}
+		}
+
+		_exit(0);
+	}
+
+	uint64_t start = bench_now();
+
+	for(size_t i = 0; i < rounds; i++) {
+		if(write(pair[0], &byte, 1) != 1 || read(pair[0], &byte, 1) != 1) {
+			perror("socket ping-pong");
+			return 1;
+		}
+	}
+
+	uint64_t elapsed = bench_now() - start;
+
+	waitpid(pid, NULL, 0);
+	unlink(SOCKET_PATH);
+
+	bench_report("socket", rounds, "round trips", elapsed);
+
+	return 0;
+}